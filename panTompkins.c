@@ -163,6 +163,7 @@
 
 #include "panTompkins.h"
 #include <stdio.h>      // Remove if not using the standard file functions.
+#include <string.h>     // Remove with <stdio.h>.
 
 
 FILE *fin, *fout;       // Remove them if not using files and <stdio.h>.
@@ -175,8 +176,19 @@ FILE *fin, *fout;       // Remove them if not using files and <stdio.h>.
 */
 void init(const char file_in[], const char file_out[])
 {
-	fin = fopen(file_in, "r");
-	fout = fopen(file_out, "w+");
+	// "-" stands for the standard input or output, so the detector can be part of a pipeline.
+	fin = strcmp(file_in, "-") ? fopen(file_in, "r") : stdin;
+	fout = strcmp(file_out, "-") ? fopen(file_out, "w+") : stdout;
+
+	// Bigger buffers than the default few KB mean far fewer read and write calls. The standard output is
+	// line buffered instead, so whatever reads it in a live pipeline gets each mark as soon as it's
+	// known (tools/panTompkinsDetect.c batches it with a flush latency when throughput matters).
+	if (fin)
+		setvbuf(fin, NULL, _IOFBF, 1 << 16);
+	if (fout == stdout)
+		setvbuf(fout, NULL, _IOLBF, BUFSIZ);
+	else if (fout)
+		setvbuf(fout, NULL, _IOFBF, 1 << 16);
 }
 
 /*
@@ -223,7 +235,7 @@ void panTompkins()
 	// rrlow is the lowest RR-interval considered normal for the current heart beat, while rrhigh is the highest.
 	// rrmiss is the longest that it would be expected until a new QRS is detected. If none is detected for such
 	// a long interval, the thresholds must be adjusted.
-	int rr1[8], rr2[8], rravg1, rravg2, rrlow = 0, rrhigh = 0, rrmiss = 0;
+	int rr1[8], rr2[8], rravg1, rravg2 = 0, rrlow = 0, rrhigh = 0, rrmiss = 0;
 
 	// i and j are iterators for loops.
 	// sample counts how many samples have been read so far.
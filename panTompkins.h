@@ -37,6 +37,6 @@ typedef int dataType;
 typedef enum {false, true} bool;
 
 void panTompkins();
-void init(char file_in[], char file_out[]);
+void init(const char file_in[], const char file_out[]);
 
 #endif
@@ -0,0 +1,381 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsBatch.c                                                      *
+ *       Multi-stream engine: many Pan-Tompkins detectors advanced together on   *
+ *       SIMD lanes                                                              *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Detects on up to PT_BATCH independent streams at once, e.g. the bedside       *
+ * monitors of a central monitoring station. The filter state of every stream is *
+ * laid out as structure-of-arrays, so each stage of the filter chain is a few   *
+ * vector instructions for all streams: AVX-512 handles 16 streams per register, *
+ * AVX2 8 and SSE4.2 4. The kernel is picked at run time (see                    *
+ * panTompkinsDispatch). The decision logic runs on the lanes of two ptLanes.    *
+ *                                                                               *
+ * All streams of a batch advance one sample at a time and share the same        *
+ * configuration. Streams that don't have a sample to give can be fed anything,  *
+ * as long as their results are ignored; a stream that starts later goes to a    *
+ * new batch.                                                                    *
+ *                                                                               *
+ * Every stream gets exactly the same beats it would get from its own ptFilter + *
+ * ptDecision (or panTompkins()), whatever the kernel.                           *
+ *-------------------------------------------------------------------------------*
+ */
+
+#include "panTompkinsBatch.h"
+#include <string.h>
+
+#if PT_X86
+#include <immintrin.h>
+#endif
+
+/*
+    Positions on the rings for the taps used by the filters. Before the first samples arrive, the taps
+    point to positions that are still zero, which is the same as leaving them out like panTompkins() does.
+*/
+typedef struct
+{
+    int c, p1, p2, p6, p12, p16, p32, pw;
+    int divisor;
+    bool first;
+} taps;
+
+static void getTaps(const ptBatch *b, taps *t)
+{
+    long unsigned int n = b->count;
+
+    t->c = n & PT_MASK;
+    t->p1 = (n - 1) & PT_MASK;
+    t->p2 = (n - 2) & PT_MASK;
+    t->p6 = (n - 6) & PT_MASK;
+    t->p12 = (n - 12) & PT_MASK;
+    t->p16 = (n - 16) & PT_MASK;
+    t->p32 = (n - 32) & PT_MASK;
+    t->pw = (n - b->config.windowSize) & PT_MASK;
+    t->divisor = n < (long unsigned int)b->config.windowSize ? (int)n + 1 : b->config.windowSize;
+    t->first = (n == 0);
+}
+
+/*
+    Portable filter chain. Same equations as panTompkins(), stream by stream. Each stage is computed in
+    64 bits and narrowed to dataType like ptFilterStep() does, so an overflowing stage wraps the same way
+    instead of being undefined. The integrator keeps a running sum; it's computed modulo 2^32, so even an
+    overflowing sum matches the sum on panTompkins().
+*/
+static void filterScalar(ptBatch *b, const dataType x[])
+{
+    taps t;
+    int k;
+    long long int y;
+
+    getTaps(b, &t);
+
+    for (k = 0; k < PT_BATCH; k++)
+    {
+        b->signal[t.c][k] = x[k];
+        if (t.first)
+            b->dcblock[t.c][k] = 0;
+        else
+            b->dcblock[t.c][k] = (dataType)(long long int)((long long int)x[k] - b->signal[t.p1][k] + 0.995*b->dcblock[t.p1][k]);
+        y = (long long int)b->dcblock[t.c][k] + 2LL*b->lowpass[t.p1][k] - b->lowpass[t.p2][k] - 2LL*b->dcblock[t.p6][k] + b->dcblock[t.p12][k];
+        b->lowpass[t.c][k] = (dataType)y;
+        y = -(long long int)b->lowpass[t.c][k] - b->highpass[t.p1][k] + 32LL*b->lowpass[t.p16][k] + b->lowpass[t.p32][k];
+        b->highpass[t.c][k] = (dataType)y;
+        b->derivative[t.c][k] = (dataType)((long long int)b->highpass[t.c][k] - b->highpass[t.p1][k]);
+        b->squared[t.c][k] = (dataType)((long long int)b->derivative[t.c][k]*b->derivative[t.c][k]);
+        b->sum[k] = (unsigned int)b->sum[k] + (unsigned int)b->squared[t.c][k] - (unsigned int)b->squared[t.pw][k];
+        b->integral[t.c][k] = b->sum[k]/t.divisor;
+    }
+}
+
+#if PT_X86
+
+/*
+    SSE4.2 filter chain: 4 streams per register, four registers per batch. Doubles only fit 2 per register.
+*/
+PT_TARGET("sse4.2") static __m128i dcblock4(__m128i diff, __m128i dcp)
+{
+    __m128d k = _mm_set1_pd(0.995);
+    __m128d lo = _mm_add_pd(_mm_cvtepi32_pd(diff), _mm_mul_pd(k, _mm_cvtepi32_pd(dcp)));
+    __m128d hi = _mm_add_pd(_mm_cvtepi32_pd(_mm_srli_si128(diff, 8)), _mm_mul_pd(k, _mm_cvtepi32_pd(_mm_srli_si128(dcp, 8))));
+
+    return _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+}
+
+PT_TARGET("sse4.2") static __m128i divide4(__m128i sum, int divisor)
+{
+    __m128d div = _mm_set1_pd(divisor);
+    __m128d lo = _mm_div_pd(_mm_cvtepi32_pd(sum), div);
+    __m128d hi = _mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(sum, 8)), div);
+
+    return _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+}
+
+#define LOAD(ring, p) _mm_loadu_si128((__m128i *)&b->ring[p][k])
+
+PT_TARGET("sse4.2") static void filterSSE42(ptBatch *b, const dataType x[])
+{
+    taps t;
+    int k;
+
+    getTaps(b, &t);
+    for (k = 0; k < PT_BATCH; k += 4)
+    {
+        __m128i s = _mm_loadu_si128((__m128i *)&x[k]);
+        __m128i dc, lp, hp, d, sq, sum;
+
+        dc = t.first ? _mm_setzero_si128() : dcblock4(_mm_sub_epi32(s, LOAD(signal, t.p1)), LOAD(dcblock, t.p1));
+
+        lp = _mm_add_epi32(dc, _mm_slli_epi32(LOAD(lowpass, t.p1), 1));
+        lp = _mm_sub_epi32(lp, LOAD(lowpass, t.p2));
+        lp = _mm_sub_epi32(lp, _mm_slli_epi32(LOAD(dcblock, t.p6), 1));
+        lp = _mm_add_epi32(lp, LOAD(dcblock, t.p12));
+
+        hp = _mm_sub_epi32(_mm_setzero_si128(), lp);
+        hp = _mm_sub_epi32(hp, LOAD(highpass, t.p1));
+        hp = _mm_add_epi32(hp, _mm_slli_epi32(LOAD(lowpass, t.p16), 5));
+        hp = _mm_add_epi32(hp, LOAD(lowpass, t.p32));
+
+        d = _mm_sub_epi32(hp, LOAD(highpass, t.p1));
+        sq = _mm_mullo_epi32(d, d);
+
+        sum = _mm_add_epi32(_mm_loadu_si128((__m128i *)&b->sum[k]), sq);
+        sum = _mm_sub_epi32(sum, LOAD(squared, t.pw));
+
+        _mm_storeu_si128((__m128i *)&b->signal[t.c][k], s);
+        _mm_storeu_si128((__m128i *)&b->dcblock[t.c][k], dc);
+        _mm_storeu_si128((__m128i *)&b->lowpass[t.c][k], lp);
+        _mm_storeu_si128((__m128i *)&b->highpass[t.c][k], hp);
+        _mm_storeu_si128((__m128i *)&b->derivative[t.c][k], d);
+        _mm_storeu_si128((__m128i *)&b->squared[t.c][k], sq);
+        _mm_storeu_si128((__m128i *)&b->sum[k], sum);
+        _mm_storeu_si128((__m128i *)&b->integral[t.c][k], divide4(sum, t.divisor));
+    }
+}
+
+#undef LOAD
+
+/*
+    DC block for 8 lanes: diff + 0.995*dcblock[n-1], computed on doubles and truncated.
+*/
+PT_TARGET("avx2") static __m256i dcblock8(__m256i diff, __m256i dcp)
+{
+    __m256d k = _mm256_set1_pd(0.995);
+    __m256d lo = _mm256_add_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(diff)), _mm256_mul_pd(k, _mm256_cvtepi32_pd(_mm256_castsi256_si128(dcp))));
+    __m256d hi = _mm256_add_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(diff, 1)), _mm256_mul_pd(k, _mm256_cvtepi32_pd(_mm256_extracti128_si256(dcp, 1))));
+
+    return _mm256_set_m128i(_mm256_cvttpd_epi32(hi), _mm256_cvttpd_epi32(lo));
+}
+
+/*
+    Integrator average for 8 lanes. The sums fit a double exactly and are far enough from the next
+    integer, so truncating the quotient gives the same result as the integer division.
+*/
+PT_TARGET("avx2") static __m256i divide8(__m256i sum, int divisor)
+{
+    __m256d div = _mm256_set1_pd(divisor);
+    __m256d lo = _mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(sum)), div);
+    __m256d hi = _mm256_div_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(sum, 1)), div);
+
+    return _mm256_set_m128i(_mm256_cvttpd_epi32(hi), _mm256_cvttpd_epi32(lo));
+}
+
+#define LOAD(ring, p) _mm256_loadu_si256((__m256i *)&b->ring[p][k])
+
+/*
+    AVX2 filter chain: 8 streams per register, two registers per batch.
+*/
+PT_TARGET("avx2") static void filterAVX2(ptBatch *b, const dataType x[])
+{
+    taps t;
+    int k;
+
+    getTaps(b, &t);
+
+    for (k = 0; k < PT_BATCH; k += 8)
+    {
+        __m256i s = _mm256_loadu_si256((__m256i *)&x[k]);
+        __m256i dc, lp, hp, d, sq, sum;
+
+        dc = t.first ? _mm256_setzero_si256() : dcblock8(_mm256_sub_epi32(s, LOAD(signal, t.p1)), LOAD(dcblock, t.p1));
+
+        lp = _mm256_add_epi32(dc, _mm256_slli_epi32(LOAD(lowpass, t.p1), 1));
+        lp = _mm256_sub_epi32(lp, LOAD(lowpass, t.p2));
+        lp = _mm256_sub_epi32(lp, _mm256_slli_epi32(LOAD(dcblock, t.p6), 1));
+        lp = _mm256_add_epi32(lp, LOAD(dcblock, t.p12));
+
+        hp = _mm256_sub_epi32(_mm256_setzero_si256(), lp);
+        hp = _mm256_sub_epi32(hp, LOAD(highpass, t.p1));
+        hp = _mm256_add_epi32(hp, _mm256_slli_epi32(LOAD(lowpass, t.p16), 5));
+        hp = _mm256_add_epi32(hp, LOAD(lowpass, t.p32));
+
+        d = _mm256_sub_epi32(hp, LOAD(highpass, t.p1));
+        sq = _mm256_mullo_epi32(d, d);
+
+        sum = _mm256_add_epi32(_mm256_loadu_si256((__m256i *)&b->sum[k]), sq);
+        sum = _mm256_sub_epi32(sum, LOAD(squared, t.pw));
+
+        _mm256_storeu_si256((__m256i *)&b->signal[t.c][k], s);
+        _mm256_storeu_si256((__m256i *)&b->dcblock[t.c][k], dc);
+        _mm256_storeu_si256((__m256i *)&b->lowpass[t.c][k], lp);
+        _mm256_storeu_si256((__m256i *)&b->highpass[t.c][k], hp);
+        _mm256_storeu_si256((__m256i *)&b->derivative[t.c][k], d);
+        _mm256_storeu_si256((__m256i *)&b->squared[t.c][k], sq);
+        _mm256_storeu_si256((__m256i *)&b->sum[k], sum);
+        _mm256_storeu_si256((__m256i *)&b->integral[t.c][k], divide8(sum, t.divisor));
+    }
+}
+
+#undef LOAD
+
+/*
+    AVX-512 filter chain: all 16 streams at once. The DC block and the integrator division go through
+    doubles, 8 lanes at a time, with the same rounding as the scalar code.
+*/
+PT_TARGET("avx512f") static void filterAVX512(ptBatch *b, const dataType x[])
+{
+    taps t;
+    __m512i s, diff, dcp, dc, lp, hp, d, sq, sum;
+    __m512d k = _mm512_set1_pd(0.995), div;
+
+    getTaps(b, &t);
+    s = _mm512_loadu_si512(x);
+    diff = _mm512_sub_epi32(s, _mm512_loadu_si512(b->signal[t.p1]));
+    dcp = _mm512_loadu_si512(b->dcblock[t.p1]);
+    div = _mm512_set1_pd(t.divisor);
+
+    dc = _mm512_inserti64x4(_mm512_castsi256_si512(_mm512_cvttpd_epi32(_mm512_add_pd(
+            _mm512_cvtepi32_pd(_mm512_castsi512_si256(diff)), _mm512_mul_pd(k, _mm512_cvtepi32_pd(_mm512_castsi512_si256(dcp)))))),
+            _mm512_cvttpd_epi32(_mm512_add_pd(
+            _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(diff, 1)), _mm512_mul_pd(k, _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(dcp, 1))))), 1);
+    if (t.first)
+        dc = _mm512_setzero_si512();
+
+    lp = _mm512_add_epi32(dc, _mm512_slli_epi32(_mm512_loadu_si512(b->lowpass[t.p1]), 1));
+    lp = _mm512_sub_epi32(lp, _mm512_loadu_si512(b->lowpass[t.p2]));
+    lp = _mm512_sub_epi32(lp, _mm512_slli_epi32(_mm512_loadu_si512(b->dcblock[t.p6]), 1));
+    lp = _mm512_add_epi32(lp, _mm512_loadu_si512(b->dcblock[t.p12]));
+
+    hp = _mm512_sub_epi32(_mm512_setzero_si512(), lp);
+    hp = _mm512_sub_epi32(hp, _mm512_loadu_si512(b->highpass[t.p1]));
+    hp = _mm512_add_epi32(hp, _mm512_slli_epi32(_mm512_loadu_si512(b->lowpass[t.p16]), 5));
+    hp = _mm512_add_epi32(hp, _mm512_loadu_si512(b->lowpass[t.p32]));
+
+    d = _mm512_sub_epi32(hp, _mm512_loadu_si512(b->highpass[t.p1]));
+    sq = _mm512_mullo_epi32(d, d);
+
+    sum = _mm512_add_epi32(_mm512_loadu_si512(b->sum), sq);
+    sum = _mm512_sub_epi32(sum, _mm512_loadu_si512(b->squared[t.pw]));
+
+    _mm512_storeu_si512(b->signal[t.c], s);
+    _mm512_storeu_si512(b->dcblock[t.c], dc);
+    _mm512_storeu_si512(b->lowpass[t.c], lp);
+    _mm512_storeu_si512(b->highpass[t.c], hp);
+    _mm512_storeu_si512(b->derivative[t.c], d);
+    _mm512_storeu_si512(b->squared[t.c], sq);
+    _mm512_storeu_si512(b->sum, sum);
+    _mm512_storeu_si512(b->integral[t.c], _mm512_inserti64x4(
+            _mm512_castsi256_si512(_mm512_cvttpd_epi32(_mm512_div_pd(_mm512_cvtepi32_pd(_mm512_castsi512_si256(sum)), div))),
+            _mm512_cvttpd_epi32(_mm512_div_pd(_mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(sum, 1)), div)), 1));
+}
+
+#endif
+
+/*
+    Resets a batch for the given number of streams (at most PT_BATCH). Every stream uses the same
+    configuration.
+*/
+void ptBatchInit(ptBatch *batch, const ptConfig *config, int streams)
+{
+    ptConfig configs[PT_LANES];
+    ptHistory history[PT_LANES];
+    int k, g, count;
+
+    memset(batch, 0, sizeof(ptBatch));
+    batch->config = *config;
+    batch->streams = streams;
+
+    // The filter kernel is chosen once, here.
+    batch->isa = ptSelectIsa();
+    batch->filter = filterScalar;
+#if PT_X86
+    if (batch->isa == PT_SSE42)
+        batch->filter = filterSSE42;
+    else if (batch->isa == PT_AVX2)
+        batch->filter = filterAVX2;
+    else if (batch->isa == PT_AVX512)
+        batch->filter = filterAVX512;
+#endif
+    for (g = 0; g < PT_BATCH/PT_LANES; g++)
+    {
+        for (k = 0; k < PT_LANES; k++)
+        {
+            configs[k] = *config;
+            history[k].highpass = &batch->highpass[0][g*PT_LANES + k];
+            history[k].squared = &batch->squared[0][g*PT_LANES + k];
+            history[k].integral = &batch->integral[0][g*PT_LANES + k];
+            history[k].mask = PT_MASK;
+            history[k].stride = PT_BATCH;
+        }
+        count = streams - g*PT_LANES;
+        count = count < 0 ? 0 : count > PT_LANES ? PT_LANES : count;
+        ptLanesInit(&batch->lanes[g], configs, history, count, true);
+    }
+}
+
+/*
+    Advances every stream by one sample: x[k] is the newest sample of stream k. The filters run on all
+    streams at once, and so does the decision logic, on groups of PT_LANES streams (see ptLanesStep()).
+    beat[k] tells whether stream k found a R peak, and position[k] where. Returns how many streams found
+    one.
+*/
+int ptBatchStep(ptBatch *batch, const dataType x[], bool beat[], long unsigned int position[])
+{
+    dataType lanes[PT_BATCH];
+    int k, g, beats = 0;
+
+    // Unused lanes are fed zeros, so they never overflow.
+    for (k = 0; k < PT_BATCH; k++)
+        lanes[k] = k < batch->streams ? x[k] : 0;
+
+    batch->filter(batch, lanes);
+    batch->count++;
+
+    for (g = 0; g*PT_LANES < batch->streams; g++)
+        beats += ptLanesStep(&batch->lanes[g], &beat[g*PT_LANES], &position[g*PT_LANES]);
+
+    return beats;
+}
+
+/*
+    Copies the counters of one stream of the batch (see ptDecisionStats()).
+*/
+bool ptBatchStats(const ptBatch *batch, int stream, ptStats *stats)
+{
+    return ptDecisionStats(&batch->lanes[stream/PT_LANES].decision[stream % PT_LANES], stats);
+}
@@ -0,0 +1,67 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsBatch.h                                                      *
+ *       Header for the multi-stream engine                                      *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ */
+
+#ifndef PAN_TOMPKINS_BATCH
+#define PAN_TOMPKINS_BATCH
+
+#include "panTompkinsLanes.h"
+
+// How many streams a batch advances together. 16 fills an AVX-512 register (or two AVX2 ones) with
+// 32-bit samples, and one position of every ring fits a 64-byte cache line.
+#define PT_BATCH 16
+
+/*
+    The state of up to PT_BATCH detectors laid out as structure-of-arrays: position n of stream k on a
+    ring is at [n & PT_MASK][k]. All streams share the same configuration and receive one sample each on
+    every step. It's a big struct (around half a megabyte), so keep it static or on the heap.
+    The decision kernel compares sample positions as signed 32-bit lanes, so a batch works up to 2^31
+    samples per stream: about 69 days at 360 Hz, 25 days at 1 kHz. Longer streams have to be restarted
+    with ptBatchInit() before count gets there (or use a ptPool, whose positions are 64-bit).
+*/
+typedef struct ptBatch
+{
+    dataType signal[PT_HISTORY][PT_BATCH], dcblock[PT_HISTORY][PT_BATCH], lowpass[PT_HISTORY][PT_BATCH];
+    dataType highpass[PT_HISTORY][PT_BATCH], derivative[PT_HISTORY][PT_BATCH], squared[PT_HISTORY][PT_BATCH];
+    dataType integral[PT_HISTORY][PT_BATCH];
+    dataType sum[PT_BATCH];     // Running sum of the integrator window.
+    ptLanes lanes[PT_BATCH/PT_LANES];
+    ptConfig config;
+    long unsigned int count;    // How many samples each stream received.
+    int streams;
+    ptIsa isa;      // Filter kernel in use.
+    void (*filter)(struct ptBatch *batch, const dataType x[]);
+} ptBatch;
+
+void ptBatchInit(ptBatch *batch, const ptConfig *config, int streams);
+int ptBatchStep(ptBatch *batch, const dataType x[], bool beat[], long unsigned int position[]);
+bool ptBatchStats(const ptBatch *batch, int stream, ptStats *stats);
+
+#endif
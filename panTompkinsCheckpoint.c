@@ -0,0 +1,484 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsCheckpoint.c                                                 *
+ *       Checkpoint and restore of the streaming detector                        *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Saves the whole state of a streaming detector (ptFilter, ptDecision and,      *
+ * optionally, ptFramer) to a small versioned binary checkpoint and restores it, *
+ * so a stream can be stopped and resumed later, in another process or on        *
+ * another machine, with exactly the output it would have had uninterrupted.     *
+ *                                                                               *
+ * Only what the detector can still read is kept: the last bufferSize samples of *
+ * the rings the decision logic looks at and the few the filters need, as        *
+ * varint-coded differences. That's 3-7 KB at the usual sampling frequencies.    *
+ * Every number is stored independently of the machine's word size and byte      *
+ * order, and a checksum catches damaged or truncated checkpoints.               *
+ *-------------------------------------------------------------------------------*
+ */
+
+#include "panTompkinsCheckpoint.h"
+#include <string.h>
+
+// Flags of the checkpoint header.
+#define PT_HAS_FRAMER 1
+#define PT_HAS_STATS 2
+
+/*
+    A checkpoint being written or read. Numbers are stored as LEB128 varints (signed ones zigzag
+    encoded first), so the format doesn't depend on the size or byte order of the machine's integers and
+    small values take one byte. A write past the end, or a read past the end, sets failed.
+*/
+typedef struct
+{
+    unsigned char *out;
+    const unsigned char *in;
+    size_t used, size;
+    bool failed;
+} cursor;
+
+static void putUnsigned(cursor *c, long long unsigned int v)
+{
+    do
+    {
+        if (c->used == c->size)
+        {
+            c->failed = true;
+            return;
+        }
+        c->out[c->used++] = (v & 0x7F) | (v > 0x7F ? 0x80 : 0);
+        v >>= 7;
+    }
+    while (v);
+}
+
+static void putSigned(cursor *c, long long int v)
+{
+    putUnsigned(c, ((long long unsigned int)v << 1) ^ (long long unsigned int)(v >> 63));
+}
+
+static void putDouble(cursor *c, double v)
+{
+    long long unsigned int bits;
+
+    memcpy(&bits, &v, sizeof(bits));
+    putUnsigned(c, bits);
+}
+
+static long long unsigned int getUnsigned(cursor *c)
+{
+    long long unsigned int v = 0;
+    int shift = 0;
+
+    for (;;)
+    {
+        if (c->used == c->size || shift > 63)
+        {
+            c->failed = true;
+            return 0;
+        }
+        v |= (long long unsigned int)(c->in[c->used] & 0x7F) << shift;
+        shift += 7;
+        if (!(c->in[c->used++] & 0x80))
+            return v;
+    }
+}
+
+static long long int getSigned(cursor *c)
+{
+    long long unsigned int v = getUnsigned(c);
+
+    return (long long int)(v >> 1) ^ -(long long int)(v & 1);
+}
+
+static double getDouble(cursor *c)
+{
+    long long unsigned int bits = getUnsigned(c);
+    double v;
+
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// FNV-1a, to catch truncated or damaged checkpoints.
+static long unsigned int checksum(const unsigned char data[], size_t size)
+{
+    long unsigned int hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        hash = ((hash ^ data[i])*16777619u) & 0xFFFFFFFFu;
+
+    return hash;
+}
+
+// Mask of each ring on ptFilter, which are shorter for the stages the decision logic doesn't read when
+// built with PT_COMPACT. The checkpoint only holds what fits on the shorter ones, so it's the same either way.
+static const long unsigned int lines[7] = {PT_LINE_SIGNAL - 1, PT_LINE_DCBLOCK - 1, PT_LINE_LOWPASS - 1, PT_MASK,
+                                           PT_LINE_DERIVATIVE - 1, PT_MASK, PT_MASK};
+
+/*
+    How many of the newest samples of each ring the filters and the decision logic may still read: the
+    filters look up to 32 samples back, the back search up to bufferSize (plus 10 for the slope) and the
+    integrator windowSize.
+*/
+static void depths(const ptConfig *config, long unsigned int count, long unsigned int depth[7])
+{
+    long unsigned int history = config->bufferSize + 10;
+    int k;
+
+    if (history < (long unsigned int)config->windowSize)
+        history = config->windowSize;
+    depth[0] = 1;           // signal
+    depth[1] = 12;          // dcblock
+    depth[2] = 32;          // lowpass
+    depth[3] = history;     // highpass
+    depth[4] = 0;           // derivative: only read on the sample it's computed
+    depth[5] = history;     // squared
+    depth[6] = history;     // integral
+    for (k = 0; k < 7; k++)
+    {
+        if (depth[k] > lines[k] + 1)
+            depth[k] = lines[k] + 1;
+        if (depth[k] > count)
+            depth[k] = count;
+    }
+}
+
+/*
+    The samples of a ring as differences from the previous one: filtered signals change slowly, so
+    most take one or two bytes.
+*/
+static void putRing(cursor *c, const dataType ring[], long unsigned int mask, long unsigned int count, long unsigned int depth)
+{
+    long unsigned int n;
+    long long int previous = 0;
+
+    for (n = count - depth; n < count; n++)
+    {
+        putSigned(c, (long long int)ring[n & mask] - previous);
+        previous = ring[n & mask];
+    }
+}
+
+static void getRing(cursor *c, dataType ring[], long unsigned int mask, long unsigned int count, long unsigned int depth)
+{
+    long unsigned int n;
+    long long int previous = 0;
+
+    for (n = count - depth; n < count; n++)
+    {
+        previous += getSigned(c);
+        ring[n & mask] = (dataType)previous;
+    }
+}
+
+// The same for the input, DC block and low pass rings, which may be narrower (see PT_SAMPLE16). A
+// checkpoint saved with wider samples saturates, like the filters would have.
+static void putSamples(cursor *c, const ptSample ring[], long unsigned int mask, long unsigned int count, long unsigned int depth)
+{
+    long unsigned int n;
+    long long int previous = 0;
+
+    for (n = count - depth; n < count; n++)
+    {
+        putSigned(c, (long long int)ring[n & mask] - previous);
+        previous = ring[n & mask];
+    }
+}
+
+static void getSamples(cursor *c, ptSample ring[], long unsigned int mask, long unsigned int count, long unsigned int depth)
+{
+    long unsigned int n;
+    long long int previous = 0;
+
+    for (n = count - depth; n < count; n++)
+    {
+        previous += getSigned(c);
+        ring[n & mask] = previous < PT_SAMPLE_MIN ? PT_SAMPLE_MIN : previous > PT_SAMPLE_MAX ? PT_SAMPLE_MAX : previous;
+    }
+}
+
+/*
+    Writes the whole state of a detector on buffer: its configuration, what the filters and the decision
+    logic still need from the rings, the decision logic's state and, when framer isn't NULL, the 0/1
+    output still waiting on the buffer. The counters of PT_STATS go too, when they're compiled in.
+    Returns the size of the checkpoint, or 0 if buffer is smaller than that (PT_CHECKPOINT_MAX is
+    always enough).
+*/
+size_t ptCheckpointSave(const ptConfig *config, const ptFilter *filter, const ptDecision *d, const ptFramer *framer, unsigned char buffer[], size_t size)
+{
+    const ptSample *samples[3];
+    const dataType *rings[7];
+    long unsigned int depth[7], hash, n, first;
+    cursor c;
+    int k, flags = framer ? PT_HAS_FRAMER : 0;
+
+#ifdef PT_STATS
+    flags |= PT_HAS_STATS;
+#endif
+    c.out = buffer;
+    c.used = 0;
+    c.size = size < 4 ? 0 : size - 4;
+    c.failed = false;
+
+    if (c.size < 6)
+        return 0;
+    memcpy(buffer, "PTCK", 4);
+    buffer[4] = PT_CHECKPOINT_VERSION;
+    buffer[5] = flags;
+    c.used = 6;
+
+    putSigned(&c, config->fs);
+    putSigned(&c, config->windowSize);
+    putSigned(&c, config->bufferSize);
+    putSigned(&c, config->delay);
+    putSigned(&c, config->refractory);
+    putSigned(&c, config->slopeWindow);
+    putDouble(&c, config->signalWeight);
+    putDouble(&c, config->noiseWeight);
+    putDouble(&c, config->thresholdRatio);
+    putDouble(&c, config->searchWeight);
+
+    putUnsigned(&c, filter->count);
+    putSigned(&c, filter->windowSize);
+    samples[0] = filter->signal;
+    samples[1] = filter->dcblock;
+    samples[2] = filter->lowpass;
+    rings[3] = filter->highpass;
+    rings[4] = filter->derivative;
+    rings[5] = filter->squared;
+    rings[6] = filter->integral;
+    depths(config, filter->count, depth);
+    for (k = 0; k < 7; k++)
+        if (k < 3)
+            putSamples(&c, samples[k], lines[k], filter->count, depth[k]);
+        else
+            putRing(&c, rings[k], lines[k], filter->count, depth[k]);
+
+    putSigned(&c, d->threshold_i1);
+    putSigned(&c, d->threshold_i2);
+    putSigned(&c, d->threshold_f1);
+    putSigned(&c, d->threshold_f2);
+    putSigned(&c, d->spk_i);
+    putSigned(&c, d->spk_f);
+    putSigned(&c, d->npk_i);
+    putSigned(&c, d->npk_f);
+    for (k = 0; k < 8; k++)
+    {
+        putSigned(&c, d->rr1[k]);
+        putSigned(&c, d->rr2[k]);
+    }
+    putSigned(&c, d->rravg1);
+    putSigned(&c, d->rravg2);
+    putSigned(&c, d->rrlow);
+    putSigned(&c, d->rrhigh);
+    putSigned(&c, d->rrmiss);
+    putUnsigned(&c, d->sample);
+    putUnsigned(&c, d->lastQRS);
+    putUnsigned(&c, d->lastSlope);
+    putUnsigned(&c, d->regular);
+    putUnsigned(&c, d->searchQRS);
+    putUnsigned(&c, d->searchEnd);
+    putSigned(&c, d->searchI);
+    putSigned(&c, d->searchF);
+
+#ifdef PT_STATS
+    putUnsigned(&c, d->stats.samples);
+    putUnsigned(&c, d->stats.candidates);
+    putUnsigned(&c, d->stats.noisePeaks);
+    putUnsigned(&c, d->stats.refractoryRejections);
+    putUnsigned(&c, d->stats.slopeRejections);
+    putUnsigned(&c, d->stats.backSearches);
+    putUnsigned(&c, d->stats.backSearchHits);
+    putUnsigned(&c, d->stats.thresholdHalvings);
+#endif
+
+    // The framer only reads back as far as bufferSize samples; its marks go as bits.
+    if (framer)
+    {
+        putUnsigned(&c, framer->sample);
+        first = framer->sample > (long unsigned int)framer->bufferSize ? framer->sample - framer->bufferSize : 0;
+        for (n = first; n < framer->sample; n += 8)
+        {
+            int bits = 0;
+            for (k = 0; k < 8 && n + k < framer->sample; k++)
+                bits |= (framer->marks[(n + k) & PT_MASK] != 0) << k;
+            if (c.used == c.size)
+                c.failed = true;
+            else
+                buffer[c.used++] = bits;
+        }
+    }
+
+    if (c.failed)
+        return 0;
+    hash = checksum(buffer, c.used);
+    for (k = 0; k < 4; k++)
+        buffer[c.used++] = (hash >> 8*k) & 0xFF;
+
+    return c.used;
+}
+
+/*
+    Restores a detector from a checkpoint written by ptCheckpointSave(): config, filter and decision
+    (and framer, which may be NULL to ignore it) continue exactly where they were saved. Ring positions
+    that weren't saved are read back as 0. Call ptFilterHistory() again afterwards. Returns false, and
+    leaves everything untouched, if the checkpoint is damaged, of another version, lacks the framer
+    asked for or has counters this build doesn't have (or the other way around).
+*/
+bool ptCheckpointLoad(const unsigned char buffer[], size_t size, ptConfig *config, ptFilter *filter, ptDecision *decision, ptFramer *framer)
+{
+    static const int expected = 0
+#ifdef PT_STATS
+        | PT_HAS_STATS
+#endif
+        ;
+    ptConfig cfg;
+    ptDecision d;
+    ptSample *samples[3];
+    dataType *rings[7];
+    long unsigned int depth[7], hash, count, sample = 0, n, first = 0;
+    int k, windowSize;
+    cursor c;
+
+    if (size < 10 || memcmp(buffer, "PTCK", 4) || buffer[4] != PT_CHECKPOINT_VERSION)
+        return false;
+    if ((buffer[5] & PT_HAS_STATS) != expected || (framer && !(buffer[5] & PT_HAS_FRAMER)))
+        return false;
+    hash = buffer[size - 4] | (buffer[size - 3] << 8) | ((long unsigned int)buffer[size - 2] << 16) | ((long unsigned int)buffer[size - 1] << 24);
+    if (checksum(buffer, size - 4) != hash)
+        return false;
+    c.in = buffer;
+    c.used = 6;
+    c.size = size - 4;
+    c.failed = false;
+
+    cfg.fs = getSigned(&c);
+    cfg.windowSize = getSigned(&c);
+    cfg.bufferSize = getSigned(&c);
+    cfg.delay = getSigned(&c);
+    cfg.refractory = getSigned(&c);
+    cfg.slopeWindow = getSigned(&c);
+    cfg.signalWeight = getDouble(&c);
+    cfg.noiseWeight = getDouble(&c);
+    cfg.thresholdRatio = getDouble(&c);
+    cfg.searchWeight = getDouble(&c);
+    count = getUnsigned(&c);
+    windowSize = getSigned(&c);
+    if (c.failed || cfg.bufferSize <= 0 || cfg.bufferSize > PT_HISTORY || windowSize <= 0 || windowSize > PT_MAXWINDOW)
+        return false;
+
+    // The rings are the only big part: decode them straight into filter, but only once the rest of
+    // the checkpoint was found to be good.
+    depths(&cfg, count, depth);
+    for (k = 0; k < 7; k++)
+        for (n = 0; n < depth[k]; n++)
+            getSigned(&c);
+
+    d.threshold_i1 = getSigned(&c);
+    d.threshold_i2 = getSigned(&c);
+    d.threshold_f1 = getSigned(&c);
+    d.threshold_f2 = getSigned(&c);
+    d.spk_i = getSigned(&c);
+    d.spk_f = getSigned(&c);
+    d.npk_i = getSigned(&c);
+    d.npk_f = getSigned(&c);
+    for (k = 0; k < 8; k++)
+    {
+        d.rr1[k] = getSigned(&c);
+        d.rr2[k] = getSigned(&c);
+    }
+    d.rravg1 = getSigned(&c);
+    d.rravg2 = getSigned(&c);
+    d.rrlow = getSigned(&c);
+    d.rrhigh = getSigned(&c);
+    d.rrmiss = getSigned(&c);
+    d.sample = getUnsigned(&c);
+    d.lastQRS = getUnsigned(&c);
+    d.lastSlope = getUnsigned(&c);
+    d.regular = getUnsigned(&c) ? true : false;
+    d.searchQRS = getUnsigned(&c);
+    d.searchEnd = getUnsigned(&c);
+    d.searchI = getSigned(&c);
+    d.searchF = getSigned(&c);
+
+#ifdef PT_STATS
+    d.stats.samples = getUnsigned(&c);
+    d.stats.candidates = getUnsigned(&c);
+    d.stats.noisePeaks = getUnsigned(&c);
+    d.stats.refractoryRejections = getUnsigned(&c);
+    d.stats.slopeRejections = getUnsigned(&c);
+    d.stats.backSearches = getUnsigned(&c);
+    d.stats.backSearchHits = getUnsigned(&c);
+    d.stats.thresholdHalvings = getUnsigned(&c);
+#endif
+
+    if (buffer[5] & PT_HAS_FRAMER)
+    {
+        sample = getUnsigned(&c);
+        first = sample > (long unsigned int)cfg.bufferSize ? sample - cfg.bufferSize : 0;
+        c.used += (sample - first + 7)/8;
+    }
+    if (c.failed || c.used != c.size)
+        return false;
+
+    // Everything checked out: nothing can fail from here on.
+    *config = cfg;
+    *decision = d;
+    memset(filter, 0, sizeof(ptFilter));
+    filter->count = count;
+    filter->windowSize = windowSize;
+    samples[0] = filter->signal;
+    samples[1] = filter->dcblock;
+    samples[2] = filter->lowpass;
+    rings[3] = filter->highpass;
+    rings[4] = filter->derivative;
+    rings[5] = filter->squared;
+    rings[6] = filter->integral;
+    c.used = 6;
+    for (k = 0; k < 12; k++)
+        getUnsigned(&c);
+    for (k = 0; k < 7; k++)
+        if (k < 3)
+            getSamples(&c, samples[k], lines[k], count, depth[k]);
+        else
+            getRing(&c, rings[k], lines[k], count, depth[k]);
+
+    if (framer)
+    {
+        ptFramerInit(framer, &cfg);
+        framer->sample = sample;
+        memset(framer->marks, 0, sizeof(framer->marks));
+        c.used = c.size - (sample - first + 7)/8;
+        for (n = first; n < sample; n++)
+            framer->marks[n & PT_MASK] = (c.in[c.used + (n - first)/8] >> ((n - first) % 8)) & 1;
+    }
+
+    return true;
+}
@@ -0,0 +1,47 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsCheckpoint.h                                                 *
+ *       Header for panTompkinsCheckpoint.c                                      *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ */
+
+#ifndef PAN_TOMPKINS_CHECKPOINT
+#define PAN_TOMPKINS_CHECKPOINT
+
+#include "panTompkinsCore.h"
+#include <stddef.h>
+
+// Version of the checkpoint format. Checkpoints of other versions are refused.
+#define PT_CHECKPOINT_VERSION 1
+
+// A buffer this big always fits a checkpoint. Typical ones (360 Hz defaults) take 3-5 KB.
+#define PT_CHECKPOINT_MAX (16*PT_HISTORY + 1024)
+
+size_t ptCheckpointSave(const ptConfig *config, const ptFilter *filter, const ptDecision *decision, const ptFramer *framer, unsigned char buffer[], size_t size);
+bool ptCheckpointLoad(const unsigned char buffer[], size_t size, ptConfig *config, ptFilter *filter, ptDecision *decision, ptFramer *framer);
+
+#endif
@@ -0,0 +1,535 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsCore.c                                                       *
+ *       Filter chain, decision logic and output framing of the Pan-Tompkins QRS *
+ *       detector as reusable, per-instance steps                                *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * The same algorithm as panTompkins(), split in pieces that can be reused by the*
+ * other engines: a filter chain, the decision logic and the output framing. Each*
+ * one keeps its state on a struct, so there can be as many detectors as needed, *
+ * and they are advanced one sample at a time.                                   *
+ *                                                                               *
+ * The buffers on panTompkins() are replaced by rings indexed by the sample      *
+ * number, so nothing has to be shifted on every new sample. The decision logic  *
+ * reads the filtered signals through a ptHistory, which may point either to the *
+ * rings or to whole signals kept in memory.                                     *
+ *                                                                               *
+ * Only the highpass, squared and integral rings are read by the decision logic. *
+ * Built with PT_COMPACT, the other stages keep just the samples the filters read*
+ * back (a few dozen instead of PT_HISTORY each), which cuts a ptFilter to less  *
+ * than half its size and keeps the whole state of a detector closer to the L1   *
+ * cache.                                                                        *
+ *                                                                               *
+ * Feeding the same samples, ptFilterStep() + ptDecisionStep() + ptFramerStep()  *
+ * write exactly the same output as panTompkins() with the default configuration.*
+ * That includes its quirks, such as the back search being skipped once the last *
+ * QRS leaves the buffer. The only difference is on signals shorter than the     *
+ * buffer, where panTompkins() writes uninitialized positions and ptFramerFlush()*
+ * writes 0.                                                                     *
+ *                                                                               *
+ * Keep in mind that the thresholds are computed with floating point, like on    *
+ * panTompkins(): if the compiler contracts them into fused multiply-adds        *
+ * (-ffp-contract=fast with FMA enabled), the results may differ from a build    *
+ * that doesn't.                                                                 *
+ *-------------------------------------------------------------------------------*
+ */
+
+#include "panTompkinsCore.h"
+#include <string.h>
+
+/*
+    Fills a configuration with the values used by panTompkins() for the given sampling frequency.
+    The integrator window and the buffer size are scaled from the 360 Hz values.
+*/
+void ptDefaultConfig(ptConfig *config, int fs)
+{
+    config->fs = fs;
+    config->windowSize = (20*fs + 180)/360;
+    config->bufferSize = (600*fs + 180)/360;
+    config->delay = (22*fs + 180)/360;
+    config->refractory = fs/5;
+    config->slopeWindow = (long unsigned int)(0.36*fs);
+    config->signalWeight = 0.125;
+    config->noiseWeight = 0.125;
+    config->thresholdRatio = 0.25;
+    config->searchWeight = 0.25;
+}
+
+/*
+    Resets the filter chain. No sample was read yet.
+*/
+void ptFilterInit(ptFilter *filter, const ptConfig *config)
+{
+    filter->count = 0;
+    filter->windowSize = config->windowSize;
+}
+
+/*
+    How the result of a stage, computed on 64 bits, is stored. By default it wraps around to dataType like
+    on panTompkins(), whose output depends on it: the integrator sum overflows on examples/test_input.txt.
+    With PT_SAMPLE16, the input, DC block and low pass are saturated to 16 bits, the later stages to
+    dataType and the integrator averages the whole 64 bit sum.
+*/
+#ifdef PT_SAMPLE16
+static long long int saturate(long long int value, long long int low, long long int high)
+{
+    return value < low ? low : value > high ? high : value;
+}
+
+#define NARROW(y) ((ptSample)saturate(y, PT_SAMPLE_MIN, PT_SAMPLE_MAX))
+#define WIDE(y) ((dataType)saturate(y, INT_MIN, INT_MAX))
+#define SUM(y) (y)
+#else
+#define NARROW(y) ((ptSample)(y))
+#define WIDE(y) ((dataType)(y))
+#define SUM(y) ((dataType)(y))
+#endif
+
+/*
+    Runs a new sample through the DC block, low pass, high pass, derivative, squaring and integrator
+    stages. The equations and the way the first samples are handled are the same as panTompkins(): a
+    tap that would read before the first sample is simply left out.
+*/
+void ptFilterStep(ptFilter *filter, dataType x)
+{
+    long unsigned int n = filter->count, i;
+    ptSample *signal = filter->signal, *dcblock = filter->dcblock, *lowpass = filter->lowpass;
+    dataType *highpass = filter->highpass, *derivative = filter->derivative, *squared = filter->squared;
+    int c = n & PT_MASK, s = n & (PT_LINE_SIGNAL - 1), dc = n & (PT_LINE_DCBLOCK - 1), lp = n & (PT_LINE_LOWPASS - 1);
+    int d = n & (PT_LINE_DERIVATIVE - 1);
+    long long int y;
+
+    // On a 32 sample low pass line, sample n - 32 is where sample n goes: read it first.
+    ptSample lowpass32 = lowpass[(n-32) & (PT_LINE_LOWPASS - 1)];
+
+    signal[s] = NARROW(x);
+
+    // DC Block filter
+    if (n >= 1)
+        dcblock[dc] = NARROW((long long int)(signal[s] - signal[(n-1) & (PT_LINE_SIGNAL - 1)] + 0.995*dcblock[(n-1) & (PT_LINE_DCBLOCK - 1)]));
+    else
+        dcblock[dc] = 0;
+
+    // Low Pass filter
+    // y(nT) = 2y(nT - T) - y(nT - 2T) + x(nT) - 2x(nT - 6T) + x(nT - 12T)
+    y = dcblock[dc];
+    if (n >= 1)
+        y += 2LL*lowpass[(n-1) & (PT_LINE_LOWPASS - 1)];
+    if (n >= 2)
+        y -= lowpass[(n-2) & (PT_LINE_LOWPASS - 1)];
+    if (n >= 6)
+        y -= 2LL*dcblock[(n-6) & (PT_LINE_DCBLOCK - 1)];
+    if (n >= 12)
+        y += dcblock[(n-12) & (PT_LINE_DCBLOCK - 1)];
+    lowpass[lp] = NARROW(y);
+
+    // High Pass filter
+    // y(nT) = 32x(nT - 16T) - [y(nT - T) + x(nT) - x(nT - 32T)]
+    y = -lowpass[lp];
+    if (n >= 1)
+        y -= highpass[(n-1) & PT_MASK];
+    if (n >= 16)
+        y += 32LL*lowpass[(n-16) & (PT_LINE_LOWPASS - 1)];
+    if (n >= 32)
+        y += lowpass32;
+    highpass[c] = WIDE(y);
+
+    // Derivative filter (central difference)
+    y = highpass[c];
+    if (n > 0)
+        y -= highpass[(n-1) & PT_MASK];
+    derivative[d] = WIDE(y);
+
+    squared[c] = WIDE((long long int)derivative[d]*derivative[d]);
+
+    // Moving-Window Integration
+    // While there aren't windowSize samples yet, the average is taken over the ones available.
+    y = 0;
+    for (i = 0; i < (long unsigned int)filter->windowSize && i <= n; i++)
+        y += squared[(n - i) & PT_MASK];
+    filter->integral[c] = SUM(y)/(long long int)i;
+
+    filter->count++;
+}
+
+/*
+    Points a history view to the rings of a filter chain.
+*/
+void ptFilterHistory(const ptFilter *filter, ptHistory *history)
+{
+    history->highpass = filter->highpass;
+    history->squared = filter->squared;
+    history->integral = filter->integral;
+    history->mask = PT_MASK;
+    history->stride = 1;
+}
+
+/*
+    Filters a whole signal kept in memory, writing the signals the decision logic needs. The outputs
+    can be read through a ptHistory with mask = ~0.
+*/
+void ptFilterSignal(const dataType signal[], long unsigned int n, const ptConfig *config, dataType highpass[], dataType squared[], dataType integral[])
+{
+    ptFilter filter;
+    long unsigned int i;
+
+    ptFilterInit(&filter, config);
+    for (i = 0; i < n; i++)
+    {
+        ptFilterStep(&filter, signal[i]);
+        highpass[i] = filter.highpass[i & PT_MASK];
+        squared[i] = filter.squared[i & PT_MASK];
+        integral[i] = filter.integral[i & PT_MASK];
+    }
+}
+
+/*
+    Resets the decision logic to the same initial state used by panTompkins().
+*/
+void ptDecisionInit(ptDecision *decision)
+{
+    int i;
+
+    decision->threshold_i1 = decision->threshold_i2 = decision->threshold_f1 = decision->threshold_f2 = 0;
+    decision->spk_i = decision->spk_f = decision->npk_i = decision->npk_f = 0;
+    for (i = 0; i < 8; i++)
+    {
+        decision->rr1[i] = 0;
+        decision->rr2[i] = 0;
+    }
+    decision->rravg1 = decision->rravg2 = 0;
+    decision->rrlow = decision->rrhigh = decision->rrmiss = 0;
+    decision->sample = decision->lastQRS = decision->lastSlope = 0;
+    decision->regular = true;
+    decision->searchQRS = decision->searchEnd = 0;
+    decision->searchI = decision->searchF = 0;
+#ifdef PT_STATS
+    memset(&decision->stats, 0, sizeof(ptStats));
+#endif
+}
+
+/*
+    The squared slope is "M" shaped, so the highest value among the last 11 samples is taken. Position is
+    the buffer index used by panTompkins(): near the start of the buffer no samples are checked.
+*/
+static long unsigned int slopeAt(const ptHistory *history, long unsigned int base, long unsigned int position)
+{
+    long unsigned int j, slope = 0;
+
+    for (j = position - 10; j <= position; j++)
+        if ((long unsigned int)history->squared[PT_AT(history, base + j)] > slope)
+            slope = history->squared[PT_AT(history, base + j)];
+
+    return slope;
+}
+
+/*
+    Adds a new RR-interval to both averages and adapts the thresholds when the rhythm turns irregular.
+    Returns the index of the last loop on the "normal" buffer (7), or -1 if it wasn't updated: the back
+    search on panTompkins() reuses its iterator on that loop.
+*/
+static int updateRR(ptDecision *d, int rr)
+{
+    int i, last = -1;
+    bool prevRegular;
+
+    d->rravg1 = 0;
+    for (i = 0; i < 7; i++)
+    {
+        d->rr1[i] = d->rr1[i+1];
+        d->rravg1 += d->rr1[i];
+    }
+    d->rr1[7] = rr;
+    d->rravg1 += d->rr1[7];
+    d->rravg1 *= 0.125;
+
+    if ( (d->rr1[7] >= d->rrlow) && (d->rr1[7] <= d->rrhigh) )
+    {
+        d->rravg2 = 0;
+        for (i = 0; i < 7; i++)
+        {
+            d->rr2[i] = d->rr2[i+1];
+            d->rravg2 += d->rr2[i];
+        }
+        d->rr2[7] = d->rr1[7];
+        d->rravg2 += d->rr2[7];
+        d->rravg2 *= 0.125;
+        d->rrlow = 0.92*d->rravg2;
+        d->rrhigh = 1.16*d->rravg2;
+        d->rrmiss = 1.66*d->rravg2;
+        last = 7;
+    }
+
+    prevRegular = d->regular;
+    if (d->rravg1 == d->rravg2)
+    {
+        d->regular = true;
+    }
+    else
+    {
+        d->regular = false;
+        if (prevRegular)
+        {
+            d->threshold_i1 /= 2;
+            d->threshold_f1 /= 2;
+            PT_COUNT(d, thresholdHalvings);
+        }
+    }
+
+    return last;
+}
+
+/*
+    Updates the noise estimates and the thresholds with a discarded peak candidate.
+*/
+static void noisePeak(ptDecision *d, const ptConfig *config, dataType peak_i, dataType peak_f)
+{
+    PT_COUNT(d, noisePeaks);
+    d->npk_i = config->noiseWeight*peak_i + (1.0 - config->noiseWeight)*d->npk_i;
+    d->threshold_i1 = d->npk_i + config->thresholdRatio*(d->spk_i - d->npk_i);
+    d->threshold_i2 = 0.5*d->threshold_i1;
+    d->npk_f = config->noiseWeight*peak_f + (1.0 - config->noiseWeight)*d->npk_f;
+    d->threshold_f1 = d->npk_f + config->thresholdRatio*(d->spk_f - d->npk_f);
+    d->threshold_f2 = 0.5*d->threshold_f1;
+}
+
+/*
+    Updates the signal estimates and the thresholds with a new R peak.
+*/
+static void signalPeak(ptDecision *d, const ptConfig *config, double weight, dataType peak_i, dataType peak_f)
+{
+    d->spk_i = weight*peak_i + (1.0 - weight)*d->spk_i;
+    d->threshold_i1 = d->npk_i + config->thresholdRatio*(d->spk_i - d->npk_i);
+    d->threshold_i2 = 0.5*d->threshold_i1;
+    d->spk_f = weight*peak_f + (1.0 - weight)*d->spk_f;
+    d->threshold_f1 = d->npk_f + config->thresholdRatio*(d->spk_f - d->npk_f);
+    d->threshold_f2 = 0.5*d->threshold_f1;
+}
+
+/*
+    Looks back for a peak above the second thresholds when no QRS was detected for too long. Returns the
+    buffer index of the sample panTompkins() marks as a R peak, or -1 if nothing was found.
+*/
+static long int backSearch(ptDecision *d, const ptConfig *config, const ptHistory *history, long unsigned int base, long unsigned int current)
+{
+    long unsigned int i, start, sample = d->sample, currentSlope;
+    int last;
+
+    // Same arithmetic as panTompkins(): if the last QRS already left the buffer, this wraps around and
+    // the search is skipped.
+    start = current - (sample - d->lastQRS) + config->refractory;
+    i = start;
+    if (start < current)
+        PT_COUNT(d, backSearches);
+
+    // Samples already known to be below the current second thresholds don't need to be tested again.
+    if (d->searchQRS == d->lastQRS && d->searchI == d->threshold_i2 && d->searchF == d->threshold_f2 && start < current)
+    {
+        if (d->searchEnd > base + i)
+            i = d->searchEnd - base;
+    }
+    d->searchQRS = d->lastQRS;
+    d->searchI = d->threshold_i2;
+    d->searchF = d->threshold_f2;
+    d->searchEnd = base + current;
+
+    for (; i < current; i++)
+    {
+        long unsigned int at = PT_AT(history, base + i);
+
+        if ( (history->integral[at] > d->threshold_i2) && (history->highpass[at] > d->threshold_f2))
+        {
+            currentSlope = slopeAt(history, base, i);
+
+            if ((currentSlope < (long unsigned int)(dataType)(d->lastSlope/2)) && (i + sample) < d->lastQRS + 0.36*d->lastQRS)
+            {
+                // Rejected for now, but the same sample might pass later: don't skip it next time.
+                PT_COUNT(d, slopeRejections);
+                if (d->searchEnd > base + i)
+                    d->searchEnd = base + i;
+            }
+            else
+            {
+                PT_COUNT(d, backSearchHits);
+                signalPeak(d, config, config->searchWeight, history->integral[at], history->highpass[at]);
+                d->lastSlope = currentSlope;
+                last = updateRR(d, sample - (current - i) - d->lastQRS);
+                d->lastQRS = sample - (current - i);
+                return last >= 0 ? last : (long int)i;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/*
+    Runs the decision logic of panTompkins() over the newest filtered sample. Returns true when a R peak
+    was detected and writes its position (counting samples from 0) on beat. The position may be in the
+    past when the peak was found by the back search.
+*/
+bool ptDecisionStep(ptDecision *d, const ptConfig *config, const ptHistory *history, long unsigned int *beat)
+{
+    long unsigned int sample, current, base, currentSlope;
+    long unsigned int at;
+    dataType integral, highpass, peak_i = 0, peak_f = 0;
+    long int found;
+    bool qrs = false;
+
+    // 'current' is where panTompkins() would keep the newest sample on its buffers, and 'base' is the
+    // sample stored at the start of those buffers.
+    sample = ++d->sample;
+    PT_COUNT(d, samples);
+    current = (sample - 1 < (long unsigned int)config->bufferSize) ? sample - 1 : (long unsigned int)config->bufferSize - 1;
+    base = sample - 1 - current;
+    at = PT_AT(history, sample - 1);
+    integral = history->integral[at];
+    highpass = history->highpass[at];
+
+    if (integral >= d->threshold_i1 || highpass >= d->threshold_f1)
+    {
+        peak_i = integral;
+        peak_f = highpass;
+    }
+
+    if ((integral >= d->threshold_i1) && (highpass >= d->threshold_f1))
+    {
+        PT_COUNT(d, candidates);
+        if (sample > d->lastQRS + config->refractory)
+        {
+            currentSlope = slopeAt(history, base, current);
+            if (sample > d->lastQRS + (long unsigned int)config->slopeWindow || currentSlope > (long unsigned int)(dataType)(d->lastSlope/2))
+            {
+                signalPeak(d, config, config->signalWeight, peak_i, peak_f);
+                d->lastSlope = currentSlope;
+                qrs = true;
+            }
+            else
+                PT_COUNT(d, slopeRejections);
+        }
+        // Doesn't respect the 200ms latency: it's noise.
+        else
+        {
+            PT_COUNT(d, refractoryRejections);
+            noisePeak(d, config, integral, highpass);
+            return false;
+        }
+    }
+
+    if (qrs)
+    {
+        updateRR(d, sample - d->lastQRS);
+        d->lastQRS = sample;
+        *beat = sample - 1;
+        return true;
+    }
+
+    if ((sample - d->lastQRS > (long unsigned int)d->rrmiss) && (sample > d->lastQRS + config->refractory))
+    {
+        found = backSearch(d, config, history, base, current);
+        if (found >= 0)
+        {
+            *beat = base + found;
+            return true;
+        }
+    }
+
+    if ((integral >= d->threshold_i1) || (highpass >= d->threshold_f1))
+        noisePeak(d, config, integral, highpass);
+
+    return false;
+}
+
+/*
+    Copies the counters of a detector into stats. It's safe to call from another thread while the
+    detector runs; each counter is read as a whole, but they aren't read at the same instant. Returns
+    false (and zeros) when the counters were compiled out.
+*/
+bool ptDecisionStats(const ptDecision *d, ptStats *stats)
+{
+#ifdef PT_STATS
+    stats->samples = PT_STAT_READ(&d->stats, samples);
+    stats->candidates = PT_STAT_READ(&d->stats, candidates);
+    stats->noisePeaks = PT_STAT_READ(&d->stats, noisePeaks);
+    stats->refractoryRejections = PT_STAT_READ(&d->stats, refractoryRejections);
+    stats->slopeRejections = PT_STAT_READ(&d->stats, slopeRejections);
+    stats->backSearches = PT_STAT_READ(&d->stats, backSearches);
+    stats->backSearchHits = PT_STAT_READ(&d->stats, backSearchHits);
+    stats->thresholdHalvings = PT_STAT_READ(&d->stats, thresholdHalvings);
+    return true;
+#else
+    (void)d;
+    memset(stats, 0, sizeof(ptStats));
+    return false;
+#endif
+}
+
+/*
+    Resets the output framing.
+*/
+void ptFramerInit(ptFramer *framer, const ptConfig *config)
+{
+    framer->sample = 0;
+    framer->bufferSize = config->bufferSize;
+    framer->delay = config->delay;
+}
+
+/*
+    Records the decision for a new sample (and the position of a beat, if one was found) and writes the
+    sample that left the buffer, once the delay has passed.
+*/
+void ptFramerStep(ptFramer *framer, bool beat, long unsigned int position, void (*emit)(int out, void *context), void *context)
+{
+    long unsigned int sample = ++framer->sample;
+
+    framer->marks[(sample - 1) & PT_MASK] = 0;
+    if (beat)
+        framer->marks[position & PT_MASK] = 1;
+
+    if (sample > (long unsigned int)(framer->delay + framer->bufferSize))
+        emit(framer->marks[(sample - framer->bufferSize) & PT_MASK], context);
+}
+
+/*
+    Writes the samples still on the buffer after the last one was read, the way panTompkins() does: the
+    buffer was shifted once more to make room for the missing sample, so the oldest sample isn't written
+    and the newest one is written twice. Positions that were never filled are written as 0.
+*/
+void ptFramerFlush(ptFramer *framer, void (*emit)(int out, void *context), void *context)
+{
+    long unsigned int n = framer->sample, size = framer->bufferSize, i;
+
+    for (i = 1; i < size; i++)
+    {
+        if (n >= size)
+            emit(framer->marks[(i < size - 1 ? n - size + 1 + i : n - 1) & PT_MASK], context);
+        else
+            emit(i < n ? framer->marks[i] : 0, context);
+    }
+}
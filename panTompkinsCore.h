@@ -0,0 +1,208 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsCore.h                                                       *
+ *       Header for the reusable pieces of the Pan-Tompkins QRS detector         *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ */
+
+#ifndef PAN_TOMPKINS_CORE
+#define PAN_TOMPKINS_CORE
+
+#include "panTompkins.h"
+#include <limits.h>
+
+// Size of the history rings, in samples. Must be a power of two and at least as large as the biggest
+// bufferSize used on a ptConfig (600 samples for the 360 Hz defaults).
+#ifndef PT_HISTORY
+#define PT_HISTORY 1024
+#endif
+#define PT_MASK (PT_HISTORY - 1)
+
+// Maximum integrator window, in samples.
+#define PT_MAXWINDOW 256
+
+// Version of the detection logic. Bump it on any change that alters what is detected, so results saved
+// by earlier versions (such as the cache of ptDetect) aren't mistaken for current ones.
+#define PT_ENGINE_VERSION 1
+
+/*
+    Every tunable value of the detector. The defaults (ptDefaultConfig) reproduce panTompkins() exactly.
+    The first four fields shape the filters and the buffers, the remaining ones only affect the decision
+    logic, so several configurations may share one pass of the filters.
+*/
+typedef struct
+{
+    int fs;                 // Sampling frequency.
+    int windowSize;         // Integrator window size, in samples (WINDOWSIZE). At most PT_MAXWINDOW.
+    int bufferSize;         // How many samples the back search can look at (BUFFSIZE). At most PT_HISTORY.
+    int delay;              // Delay introduced by the filters, in samples (DELAY).
+    int refractory;         // Hard latency after a R peak, in samples. The paper uses 200ms (FS/5).
+    int slopeWindow;        // Soft latency, in samples, where the slope is checked. The paper uses 360ms.
+    double signalWeight;    // Weight of a new signal peak on spk (0.125).
+    double noiseWeight;     // Weight of a new noise peak on npk (0.125).
+    double thresholdRatio;  // threshold1 = npk + thresholdRatio*(spk - npk) (0.25).
+    double searchWeight;    // Weight of a peak found by the back search on spk (0.25).
+} ptConfig;
+
+/*
+    A view of the filtered signals the decision logic reads. Sample number n (counting from 0) is kept
+    at position (n & mask)*stride, so the same code works on rings (mask = PT_MASK), on whole signals kept
+    in memory (mask = ~0) and on rings shared by several streams (stride = number of streams).
+*/
+typedef struct
+{
+    const dataType *highpass, *squared, *integral;
+    long unsigned int mask, stride;
+} ptHistory;
+
+#define PT_AT(history, n) ((((long unsigned int)(n)) & (history)->mask)*(history)->stride)
+
+// Length of the ring kept for each stage that the decision logic doesn't read. By default they're as long
+// as the others, so every stage can be looked at afterwards. With PT_COMPACT (on every file, since it
+// changes ptFilter) they only hold what the filters read back: 2 samples of the input, 12 of the DC block,
+// 32 of the low pass and 1 of the derivative, rounded up to powers of two. A ptFilter then takes
+// about 12 KB instead of 28 KB with the default PT_HISTORY.
+#ifdef PT_COMPACT
+#define PT_LINE_SIGNAL 2
+#define PT_LINE_DCBLOCK 16
+#define PT_LINE_LOWPASS 32
+#define PT_LINE_DERIVATIVE 1
+#else
+#define PT_LINE_SIGNAL PT_HISTORY
+#define PT_LINE_DCBLOCK PT_HISTORY
+#define PT_LINE_LOWPASS PT_HISTORY
+#define PT_LINE_DERIVATIVE PT_HISTORY
+#endif
+
+// Type of the input, DC block and low pass rings. With PT_SAMPLE16 (on every file, since it changes
+// ptFilter) they take 16 bits, which is enough for 11 and 12 bit ADCs: the low pass peaks around 15000
+// on examples/test_input.txt. The high pass gain (32) takes the later stages past 16 bits, so they stay
+// dataType. Every stage then saturates instead of wrapping around, and the integrator sum is kept on 64
+// bits: it no longer overflows like on panTompkins(), so beats may be found a few samples apart from it.
+#ifdef PT_SAMPLE16
+typedef short ptSample;
+#define PT_SAMPLE_MIN SHRT_MIN
+#define PT_SAMPLE_MAX SHRT_MAX
+#else
+typedef dataType ptSample;
+#define PT_SAMPLE_MIN INT_MIN
+#define PT_SAMPLE_MAX INT_MAX
+#endif
+
+/*
+    State of the filter chain. The rings play the role of the buffers on panTompkins(), without the
+    shifting. Sample n of a stage is at [n % length of its ring].
+*/
+typedef struct
+{
+    ptSample signal[PT_LINE_SIGNAL], dcblock[PT_LINE_DCBLOCK], lowpass[PT_LINE_LOWPASS];
+    dataType highpass[PT_HISTORY];
+    dataType derivative[PT_LINE_DERIVATIVE], squared[PT_HISTORY], integral[PT_HISTORY];
+    long unsigned int count;    // How many samples went through the filters.
+    int windowSize;
+} ptFilter;
+
+/*
+    Counters of what the decision logic did, for monitoring. They're only kept when PT_STATS is defined
+    (on every file, since it changes ptDecision); otherwise they cost nothing and read as zeros.
+*/
+typedef struct
+{
+    long unsigned int samples;              // Samples processed.
+    long unsigned int candidates;           // Samples above both first thresholds.
+    long unsigned int noisePeaks;           // Noise peak updates.
+    long unsigned int refractoryRejections; // Candidates within the 200ms latency after a QRS.
+    long unsigned int slopeRejections;      // Peaks discarded by the slope test (first try or back search).
+    long unsigned int backSearches;         // Back searches started.
+    long unsigned int backSearchHits;       // R peaks found by the back search.
+    long unsigned int thresholdHalvings;    // Times the rhythm turned irregular and threshold1 was halved.
+} ptStats;
+
+#ifdef PT_STATS
+// Counters have a single writer, the detector, but may be read by another thread while it runs.
+#if defined(__GNUC__)
+#define PT_STAT_ADD(stats, counter, n) __atomic_store_n(&(stats)->counter, (stats)->counter + (n), __ATOMIC_RELAXED)
+#define PT_STAT_READ(stats, counter) __atomic_load_n(&(stats)->counter, __ATOMIC_RELAXED)
+#else
+#define PT_STAT_ADD(stats, counter, n) ((stats)->counter += (n))
+#define PT_STAT_READ(stats, counter) ((stats)->counter)
+#endif
+#define PT_COUNT(decision, counter) PT_STAT_ADD(&(decision)->stats, counter, 1)
+#else
+#define PT_COUNT(decision, counter) ((void)0)
+#endif
+
+/*
+    State of the decision logic: thresholds, RR-interval averages and the time of the last QRS. The
+    names match the variables on panTompkins().
+*/
+typedef struct
+{
+    dataType threshold_i1, threshold_i2, threshold_f1, threshold_f2, spk_i, spk_f, npk_i, npk_f;
+    int rr1[8], rr2[8], rravg1, rravg2, rrlow, rrhigh, rrmiss;
+    long unsigned int sample, lastQRS, lastSlope;
+    bool regular;
+
+    // Back search bookkeeping. Every sample from searchQRS's search start up to searchEnd was already
+    // found to be below searchI/searchF, so there's no need to look at them again while those values
+    // don't change.
+    long unsigned int searchQRS, searchEnd;
+    dataType searchI, searchF;
+
+#ifdef PT_STATS
+    ptStats stats;
+#endif
+} ptDecision;
+
+/*
+    Rebuilds the dense 0/1 output of panTompkins() out of the detected beats: the first delay+1 samples
+    are skipped, each sample is written once it leaves the buffer and the final flush behaves exactly
+    like the loop at the end of panTompkins().
+*/
+typedef struct
+{
+    unsigned char marks[PT_HISTORY];
+    long unsigned int sample;   // How many samples were seen.
+    int bufferSize, delay;
+} ptFramer;
+
+void ptDefaultConfig(ptConfig *config, int fs);
+
+void ptFilterInit(ptFilter *filter, const ptConfig *config);
+void ptFilterStep(ptFilter *filter, dataType x);
+void ptFilterHistory(const ptFilter *filter, ptHistory *history);
+void ptFilterSignal(const dataType signal[], long unsigned int n, const ptConfig *config, dataType highpass[], dataType squared[], dataType integral[]);
+
+void ptDecisionInit(ptDecision *decision);
+bool ptDecisionStep(ptDecision *decision, const ptConfig *config, const ptHistory *history, long unsigned int *beat);
+bool ptDecisionStats(const ptDecision *decision, ptStats *stats);
+
+void ptFramerInit(ptFramer *framer, const ptConfig *config);
+void ptFramerStep(ptFramer *framer, bool beat, long unsigned int position, void (*emit)(int out, void *context), void *context);
+void ptFramerFlush(ptFramer *framer, void (*emit)(int out, void *context), void *context);
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsDispatch.c                                                   *
+ *       Run-time selection of the SIMD kernels                                  *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Picks the SIMD kernels at run time, so a single build runs on any x86-64 and  *
+ * still uses AVX2 or AVX-512 where the CPU has them. Every kernel is compiled   *
+ * with its own target attribute; no -m flag is needed. Non-x86 builds, or       *
+ * compilers other than GCC and Clang, only get the portable kernels.            *
+ *                                                                               *
+ * The choice can be forced with ptForceIsa() or with the PT_ISA environment     *
+ * variable (scalar, sse4.2, avx2 or avx512), e.g. to compare every kernel       *
+ * against the reference on the same machine. A request for something the CPU    *
+ * lacks falls back to the best it has.                                          *
+ *                                                                               *
+ * ptGolden (tools/panTompkinsGolden.c) forces each kernel the CPU has in turn   *
+ * and checks it gives exactly the output of the scalar one and panTompkins().   *
+ *-------------------------------------------------------------------------------*
+ */
+
+#include "panTompkinsDispatch.h"
+#include <stdlib.h>
+#include <string.h>
+
+static ptIsa forced = PT_AUTO;
+
+/*
+    The best instruction set this processor (and its operating system) supports, found with CPUID. It's
+    asked only once.
+*/
+ptIsa ptBestIsa(void)
+{
+    static ptIsa best = PT_AUTO;
+
+    if (best == PT_AUTO)
+    {
+        best = PT_SCALAR;
+#if PT_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2"))
+            best = PT_SSE42;
+        if (__builtin_cpu_supports("avx2"))
+            best = PT_AVX2;
+        if (__builtin_cpu_supports("avx512f"))
+            best = PT_AVX512;
+#endif
+    }
+
+    return best;
+}
+
+/*
+    Makes every detector created from now on use the given instruction set (or the best one below it the
+    processor supports). Meant for testing the kernels against each other. PT_AUTO goes back to normal.
+*/
+void ptForceIsa(ptIsa isa)
+{
+    forced = isa;
+}
+
+/*
+    The instruction set a new detector should use: the one forced by ptForceIsa(), or else the one on the
+    PT_ISA environment variable (scalar, sse4.2, avx2 or avx512), or else the best one available. It
+    never goes above what the processor supports.
+*/
+ptIsa ptSelectIsa(void)
+{
+    ptIsa isa = forced, best = ptBestIsa();
+    const char *name;
+
+    if (isa == PT_AUTO && (name = getenv("PT_ISA")) != NULL)
+        isa = ptIsaFromName(name);
+    if (isa == PT_AUTO || isa > best)
+        isa = best;
+
+    return isa;
+}
+
+const char *ptIsaName(ptIsa isa)
+{
+    switch (isa)
+    {
+        case PT_SCALAR: return "scalar";
+        case PT_SSE42:  return "sse4.2";
+        case PT_AVX2:   return "avx2";
+        case PT_AVX512: return "avx512";
+        default:        return "auto";
+    }
+}
+
+ptIsa ptIsaFromName(const char name[])
+{
+    ptIsa isa;
+
+    for (isa = PT_SCALAR; isa <= PT_AVX512; isa++)
+        if (strcmp(name, ptIsaName(isa)) == 0)
+            return isa;
+
+    return PT_AUTO;
+}
@@ -0,0 +1,56 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsDispatch.h                                                   *
+ *       Header for the run-time selection of the SIMD kernels                   *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ */
+
+#ifndef PAN_TOMPKINS_DISPATCH
+#define PAN_TOMPKINS_DISPATCH
+
+// SIMD kernels are only built for x86 with GCC or Clang. Everywhere else, only the portable code is used.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define PT_X86 1
+#define PT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PT_X86 0
+#define PT_TARGET(isa)
+#endif
+
+/*
+    Instruction sets the kernels are written for, from the least to the most capable. PT_AUTO means
+    "whatever the processor supports".
+*/
+typedef enum {PT_AUTO = -1, PT_SCALAR, PT_SSE42, PT_AVX2, PT_AVX512} ptIsa;
+
+ptIsa ptBestIsa(void);
+void ptForceIsa(ptIsa isa);
+ptIsa ptSelectIsa(void);
+const char *ptIsaName(ptIsa isa);
+ptIsa ptIsaFromName(const char name[]);
+
+#endif
@@ -0,0 +1,366 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsLanes.c                                                      *
+ *       SIMD decision kernel: several Pan-Tompkins decision logics advanced     *
+ *       together                                                                *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Runs PT_LANES decision logics side by side, one per SIMD lane. It serves two  *
+ * purposes: evaluating many configurations over the same filtered signal        *
+ * (panTompkinsMulti) and detecting on many streams at once (panTompkinsBatch).  *
+ *                                                                               *
+ * On CPUs with AVX2, thresholds, spk and npk are kept lane-wise and the if/else *
+ * tree of panTompkins() becomes a set of masks: the noise updates and the back  *
+ * search are done on every lane at once. A lane which finds a R peak candidate, *
+ * or a sample above the second thresholds on the back search, is handed to      *
+ * ptDecisionStep() for that sample. The back search remembers how far it        *
+ * already scanned under the current second thresholds, so most samples only     *
+ * test one new position per lane.                                               *
+ *                                                                               *
+ * Otherwise every lane runs ptDecisionStep() on every sample. The kernel is     *
+ * picked at run time (see panTompkinsDispatch) and both give exactly the same   *
+ * beats.                                                                        *
+ *-------------------------------------------------------------------------------*
+ */
+
+#include "panTompkinsLanes.h"
+
+#if PT_X86
+#include <immintrin.h>
+#endif
+
+static void toLane(ptLanes *l, int k)
+{
+    const ptDecision *d = &l->decision[k];
+
+    l->threshold_i1[k] = d->threshold_i1;
+    l->threshold_i2[k] = d->threshold_i2;
+    l->threshold_f1[k] = d->threshold_f1;
+    l->threshold_f2[k] = d->threshold_f2;
+    l->spk_i[k] = d->spk_i;
+    l->spk_f[k] = d->spk_f;
+    l->npk_i[k] = d->npk_i;
+    l->npk_f[k] = d->npk_f;
+    l->lastQRS[k] = d->lastQRS;
+    l->rrmiss[k] = d->rrmiss;
+    l->searchQRS[k] = d->searchQRS;
+    l->searchEnd[k] = d->searchEnd;
+    l->searchI[k] = d->searchI;
+    l->searchF[k] = d->searchF;
+}
+
+/*
+    Portable version: every lane runs ptDecisionStep() on its own.
+*/
+static int lanesScalar(ptLanes *l, bool beat[], long unsigned int position[])
+{
+    int k, beats = 0;
+
+    l->sample++;
+    for (k = 0; k < l->count; k++)
+    {
+        beat[k] = ptDecisionStep(&l->decision[k], &l->config[k], &l->history[k], &position[k]);
+        beats += beat[k];
+    }
+
+    return beats;
+}
+
+#if PT_X86
+
+static void fromLane(ptLanes *l, int k)
+{
+    ptDecision *d = &l->decision[k];
+
+    d->threshold_i1 = l->threshold_i1[k];
+    d->threshold_i2 = l->threshold_i2[k];
+    d->threshold_f1 = l->threshold_f1[k];
+    d->threshold_f2 = l->threshold_f2[k];
+    d->spk_i = l->spk_i[k];
+    d->spk_f = l->spk_f[k];
+    d->npk_i = l->npk_i[k];
+    d->npk_f = l->npk_f[k];
+    d->searchQRS = l->searchQRS[k];
+    d->searchEnd = l->searchEnd[k];
+    d->searchI = l->searchI[k];
+    d->searchF = l->searchF[k];
+}
+
+/*
+    npk = weight*peak + keep*npk, truncated the same way the assignment to dataType does on the scalar code.
+*/
+PT_TARGET("avx2") static __m256i ema(__m256i peak, __m256i old, const double weight[], const double keep[])
+{
+    __m256d w0 = _mm256_loadu_pd(weight), w1 = _mm256_loadu_pd(weight + 4);
+    __m256d k0 = _mm256_loadu_pd(keep), k1 = _mm256_loadu_pd(keep + 4);
+    __m256d lo = _mm256_add_pd(_mm256_mul_pd(w0, _mm256_cvtepi32_pd(_mm256_castsi256_si128(peak))),
+                               _mm256_mul_pd(k0, _mm256_cvtepi32_pd(_mm256_castsi256_si128(old))));
+    __m256d hi = _mm256_add_pd(_mm256_mul_pd(w1, _mm256_cvtepi32_pd(_mm256_extracti128_si256(peak, 1))),
+                               _mm256_mul_pd(k1, _mm256_cvtepi32_pd(_mm256_extracti128_si256(old, 1))));
+
+    return _mm256_set_m128i(_mm256_cvttpd_epi32(hi), _mm256_cvttpd_epi32(lo));
+}
+
+/*
+    threshold = npk + ratio*(spk - npk).
+*/
+PT_TARGET("avx2") static __m256i threshold(__m256i npk, __m256i spk, const double ratio[])
+{
+    __m256d r0 = _mm256_loadu_pd(ratio), r1 = _mm256_loadu_pd(ratio + 4);
+    __m256i diff = _mm256_sub_epi32(spk, npk);
+    __m256d lo = _mm256_add_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(npk)),
+                               _mm256_mul_pd(r0, _mm256_cvtepi32_pd(_mm256_castsi256_si128(diff))));
+    __m256d hi = _mm256_add_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(npk, 1)),
+                               _mm256_mul_pd(r1, _mm256_cvtepi32_pd(_mm256_extracti128_si256(diff, 1))));
+
+    return _mm256_set_m128i(_mm256_cvttpd_epi32(hi), _mm256_cvttpd_epi32(lo));
+}
+
+/*
+    threshold2 = 0.5*threshold1. Truncating a half is the same as the integer division by 2.
+*/
+PT_TARGET("avx2") static __m256i half(__m256i x)
+{
+    return _mm256_srai_epi32(_mm256_add_epi32(x, _mm256_srli_epi32(x, 31)), 1);
+}
+
+/*
+    Sample p of every lane: a row of an interleaved history, or the same value on every lane.
+*/
+PT_TARGET("avx2") static __m256i row(const ptLanes *l, const dataType *signal, long unsigned int p)
+{
+    if (l->interleaved)
+        return _mm256_loadu_si256((__m256i *)&signal[PT_AT(&l->history[0], p)]);
+    return _mm256_set1_epi32(signal[PT_AT(&l->history[0], p)]);
+}
+
+#ifdef PT_STATS
+/*
+    Keeps the counters of the lanes that didn't go through ptDecisionStep() on this sample: they only
+    did what the masks tell.
+*/
+PT_TARGET("avx2") static void countLanes(ptLanes *l, __m256i fast, __m256i both, __m256i search, __m256i noise)
+{
+    int f = _mm256_movemask_ps(_mm256_castsi256_ps(fast)), b = _mm256_movemask_ps(_mm256_castsi256_ps(both));
+    int s = _mm256_movemask_ps(_mm256_castsi256_ps(search)), n = _mm256_movemask_ps(_mm256_castsi256_ps(noise));
+    int k;
+
+    for (k = 0; k < PT_LANES; k++)
+    {
+        ptStats *stats = &l->decision[k].stats;
+
+        if (!((f >> k) & 1))
+            continue;
+        PT_STAT_ADD(stats, samples, 1);
+        // A fast lane above both thresholds is always within the latency.
+        PT_STAT_ADD(stats, candidates, (b >> k) & 1);
+        PT_STAT_ADD(stats, refractoryRejections, (b >> k) & 1);
+        PT_STAT_ADD(stats, noisePeaks, (n >> k) & 1);
+        PT_STAT_ADD(stats, backSearches, (s >> k) & 1);
+    }
+}
+#endif
+
+/*
+    Most samples are either below every threshold or discarded as noise; those are handled with masks on
+    all lanes at once, including the back search, which only has to test one new sample per lane while
+    the second thresholds don't change. The lanes that hit a R peak candidate (or something on the back
+    search) go through ptDecisionStep() instead, which is rare enough not to matter.
+*/
+PT_TARGET("avx2") static int lanesAVX2(ptLanes *l, bool beat[], long unsigned int position[])
+{
+    long unsigned int t = l->sample++;
+    int k, scalar, beats = 0;
+    __m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32(l->count), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i ones = _mm256_set1_epi32(-1);
+    __m256i sample = _mm256_set1_epi32(t + 1), now = _mm256_set1_epi32(t);
+    __m256i integral = row(l, l->history[0].integral, t);
+    __m256i highpass = row(l, l->history[0].highpass, t);
+    __m256i threshold_i1 = _mm256_loadu_si256((__m256i *)l->threshold_i1);
+    __m256i threshold_f1 = _mm256_loadu_si256((__m256i *)l->threshold_f1);
+    __m256i threshold_i2 = _mm256_loadu_si256((__m256i *)l->threshold_i2);
+    __m256i threshold_f2 = _mm256_loadu_si256((__m256i *)l->threshold_f2);
+    __m256i lastQRS = _mm256_loadu_si256((__m256i *)l->lastQRS);
+    __m256i refractory = _mm256_loadu_si256((__m256i *)l->refractory);
+    __m256i above_i, above_f, candidate, both, latency, search, slow, hit, noise;
+    __m256i current, base, start, from, valid;
+#ifdef PT_STATS
+    __m256i started;
+#endif
+
+    for (k = 0; k < l->count; k++)
+        beat[k] = false;
+
+    // x >= threshold is !(threshold > x).
+    above_i = _mm256_andnot_si256(_mm256_cmpgt_epi32(threshold_i1, integral), ones);
+    above_f = _mm256_andnot_si256(_mm256_cmpgt_epi32(threshold_f1, highpass), ones);
+    candidate = _mm256_and_si256(_mm256_or_si256(above_i, above_f), active);
+    both = _mm256_and_si256(above_i, above_f);
+    latency = _mm256_cmpgt_epi32(sample, _mm256_add_epi32(lastQRS, refractory));
+
+    // Above both thresholds after the 200ms latency: a possible R peak, let the scalar code decide.
+    slow = _mm256_and_si256(_mm256_and_si256(both, latency), active);
+
+    // Lanes that do a back search: nothing above both thresholds, outside the latency and rrmiss.
+    search = _mm256_andnot_si256(both, _mm256_and_si256(latency, active));
+    search = _mm256_and_si256(search, _mm256_cmpgt_epi32(_mm256_sub_epi32(sample, lastQRS), _mm256_loadu_si256((__m256i *)l->rrmiss)));
+
+    // Where the search starts, in samples. If the last QRS already left the buffer it doesn't happen.
+    current = _mm256_min_epi32(now, _mm256_loadu_si256((__m256i *)l->lastIndex));
+    base = _mm256_sub_epi32(now, current);
+    start = _mm256_add_epi32(_mm256_sub_epi32(lastQRS, _mm256_set1_epi32(1)), refractory);
+    search = _mm256_andnot_si256(_mm256_cmpgt_epi32(base, start), search);
+
+    // Resume from where the last search ended if the second thresholds are still the same.
+    valid = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i *)l->searchQRS), lastQRS),
+            _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i *)l->searchI), threshold_i2),
+                             _mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i *)l->searchF), threshold_f2)));
+    from = _mm256_blendv_epi8(start, _mm256_max_epi32(start, _mm256_loadu_si256((__m256i *)l->searchEnd)), valid);
+
+    hit = _mm256_setzero_si256();
+#ifdef PT_STATS
+    started = search;
+#endif
+    if (!_mm256_testz_si256(search, search))
+    {
+        int first = t, p;
+        int f[PT_LANES], s[PT_LANES];
+
+        _mm256_storeu_si256((__m256i *)f, from);
+        _mm256_storeu_si256((__m256i *)s, search);
+        for (k = 0; k < PT_LANES; k++)
+            if (s[k] && f[k] < first)
+                first = f[k];
+
+        for (p = first; p < (int)t; p++)
+        {
+            __m256i at = _mm256_set1_epi32(p);
+            __m256i i = row(l, l->history[0].integral, p);
+            __m256i h = row(l, l->history[0].highpass, p);
+            __m256i found = _mm256_and_si256(_mm256_cmpgt_epi32(i, threshold_i2), _mm256_cmpgt_epi32(h, threshold_f2));
+
+            found = _mm256_andnot_si256(_mm256_cmpgt_epi32(from, at), found);
+            hit = _mm256_or_si256(hit, _mm256_and_si256(found, search));
+        }
+
+        // Lanes without a hit remember how far they got.
+        search = _mm256_andnot_si256(hit, search);
+        _mm256_storeu_si256((__m256i *)l->searchQRS, _mm256_blendv_epi8(_mm256_loadu_si256((__m256i *)l->searchQRS), lastQRS, search));
+        _mm256_storeu_si256((__m256i *)l->searchI, _mm256_blendv_epi8(_mm256_loadu_si256((__m256i *)l->searchI), threshold_i2, search));
+        _mm256_storeu_si256((__m256i *)l->searchF, _mm256_blendv_epi8(_mm256_loadu_si256((__m256i *)l->searchF), threshold_f2, search));
+        _mm256_storeu_si256((__m256i *)l->searchEnd, _mm256_blendv_epi8(_mm256_loadu_si256((__m256i *)l->searchEnd), now, search));
+    }
+    slow = _mm256_or_si256(slow, hit);
+
+    // Every other peak candidate is noise.
+    noise = _mm256_andnot_si256(slow, candidate);
+    if (!_mm256_testz_si256(noise, noise))
+    {
+        __m256i spk_i = _mm256_loadu_si256((__m256i *)l->spk_i), spk_f = _mm256_loadu_si256((__m256i *)l->spk_f);
+        __m256i npk_i = _mm256_loadu_si256((__m256i *)l->npk_i), npk_f = _mm256_loadu_si256((__m256i *)l->npk_f);
+
+        npk_i = _mm256_blendv_epi8(npk_i, ema(integral, npk_i, l->weight, l->keep), noise);
+        npk_f = _mm256_blendv_epi8(npk_f, ema(highpass, npk_f, l->weight, l->keep), noise);
+        threshold_i1 = _mm256_blendv_epi8(threshold_i1, threshold(npk_i, spk_i, l->ratio), noise);
+        threshold_f1 = _mm256_blendv_epi8(threshold_f1, threshold(npk_f, spk_f, l->ratio), noise);
+        threshold_i2 = _mm256_blendv_epi8(threshold_i2, half(threshold_i1), noise);
+        threshold_f2 = _mm256_blendv_epi8(threshold_f2, half(threshold_f1), noise);
+
+        _mm256_storeu_si256((__m256i *)l->npk_i, npk_i);
+        _mm256_storeu_si256((__m256i *)l->npk_f, npk_f);
+        _mm256_storeu_si256((__m256i *)l->threshold_i1, threshold_i1);
+        _mm256_storeu_si256((__m256i *)l->threshold_f1, threshold_f1);
+        _mm256_storeu_si256((__m256i *)l->threshold_i2, threshold_i2);
+        _mm256_storeu_si256((__m256i *)l->threshold_f2, threshold_f2);
+    }
+
+#ifdef PT_STATS
+    countLanes(l, _mm256_andnot_si256(slow, active), both, started, noise);
+#endif
+
+    scalar = _mm256_movemask_ps(_mm256_castsi256_ps(slow));
+    for (k = 0; scalar; k++, scalar >>= 1)
+    {
+        if (!(scalar & 1))
+            continue;
+
+        fromLane(l, k);
+        l->decision[k].sample = t;
+        beat[k] = ptDecisionStep(&l->decision[k], &l->config[k], &l->history[k], &position[k]);
+        beats += beat[k];
+        toLane(l, k);
+    }
+
+    return beats;
+}
+
+#endif
+
+/*
+    Sets up count lanes (at most PT_LANES). Lane k uses config[k] and history[k]. Set interleaved if
+    history[k] is history[0] moved k positions ahead, with the same mask and stride.
+*/
+void ptLanesInit(ptLanes *l, const ptConfig config[], const ptHistory history[], int count, bool interleaved)
+{
+    int k;
+
+    l->sample = 0;
+    l->count = count;
+    l->interleaved = interleaved;
+
+    // The kernel is chosen once, here.
+    l->isa = ptSelectIsa() >= PT_AVX2 ? PT_AVX2 : PT_SCALAR;
+    l->step = lanesScalar;
+#if PT_X86
+    if (l->isa == PT_AVX2)
+        l->step = lanesAVX2;
+#endif
+
+    for (k = 0; k < PT_LANES; k++)
+    {
+        // Unused lanes copy the first one, they're masked out anyway.
+        l->config[k] = config[k < count ? k : 0];
+        l->history[k] = history[k < count ? k : 0];
+        ptDecisionInit(&l->decision[k]);
+        toLane(l, k);
+        l->refractory[k] = l->config[k].refractory;
+        l->lastIndex[k] = l->config[k].bufferSize - 1;
+        l->weight[k] = l->config[k].noiseWeight;
+        l->keep[k] = 1.0 - l->config[k].noiseWeight;
+        l->ratio[k] = l->config[k].thresholdRatio;
+    }
+}
+
+/*
+    Advances every lane by one sample, which must already be on the histories. beat[k] tells whether lane
+    k found a R peak, and position[k] where. Returns how many lanes found one.
+*/
+int ptLanesStep(ptLanes *l, bool beat[], long unsigned int position[])
+{
+    return l->step(l, beat, position);
+}
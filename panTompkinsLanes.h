@@ -0,0 +1,72 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsLanes.h                                                      *
+ *       Header for the SIMD decision kernel                                     *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ */
+
+#ifndef PAN_TOMPKINS_LANES
+#define PAN_TOMPKINS_LANES
+
+#include "panTompkinsCore.h"
+#include "panTompkinsDispatch.h"
+
+// How many decision logics run side by side on the SIMD decision kernel.
+#define PT_LANES 8
+
+/*
+    PT_LANES decision logics advanced together, one per SIMD lane. Each lane has its own configuration
+    and reads its own history. If the histories are interleaved (lane k's history starts right after
+    lane k-1's, as on the rings of a ptBatch), a whole row is loaded at once. Otherwise every lane reads
+    the same history, as when running several configurations over one signal. Positions are kept on
+    signed 32-bit lanes (lastQRS, searchQRS, searchEnd and the sample they're compared to), so the lanes
+    only work for the first 2^31 samples.
+*/
+typedef struct ptLanes
+{
+    // Lane-wise copy of the values touched on every sample. The RR averages, lastSlope and the rarely
+    // taken branches stay on each lane's ptDecision.
+    int threshold_i1[PT_LANES], threshold_i2[PT_LANES], threshold_f1[PT_LANES], threshold_f2[PT_LANES];
+    int spk_i[PT_LANES], spk_f[PT_LANES], npk_i[PT_LANES], npk_f[PT_LANES];
+    int lastQRS[PT_LANES], rrmiss[PT_LANES], refractory[PT_LANES], lastIndex[PT_LANES];
+    int searchQRS[PT_LANES], searchEnd[PT_LANES], searchI[PT_LANES], searchF[PT_LANES];
+    double weight[PT_LANES], keep[PT_LANES], ratio[PT_LANES];
+
+    ptDecision decision[PT_LANES];
+    ptConfig config[PT_LANES];
+    ptHistory history[PT_LANES];
+    long unsigned int sample;
+    int count;
+    bool interleaved;
+    ptIsa isa;      // Kernel in use: PT_AVX2 or PT_SCALAR.
+    int (*step)(struct ptLanes *lanes, bool beat[], long unsigned int position[]);
+} ptLanes;
+
+void ptLanesInit(ptLanes *lanes, const ptConfig config[], const ptHistory history[], int count, bool interleaved);
+int ptLanesStep(ptLanes *lanes, bool beat[], long unsigned int position[]);
+
+#endif
@@ -0,0 +1,517 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsMcu.c                                                        *
+ *       Microcontroller engine: integer-only detector with static state, a      *
+ *       memory budget, an interrupt-safe sample queue and ping-pong DMA blocks  *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * The detector for microcontrollers: no stdio, no floating point, no dynamic    *
+ * memory. The whole state is a ptMcu the caller keeps wherever it wants         *
+ * (usually a static variable), and the configuration is fixed at compile time   *
+ * by PT_MCU_FS, with the same rounding ptDefaultConfig() uses.                  *
+ *                                                                               *
+ * Only what the back search looks at is kept: the high pass and integrator      *
+ * outputs of the last bufferSize samples, besides the short delay lines of the  *
+ * DC block and low pass filters. The squared slope is computed again from the   *
+ * high pass when needed. With the sample queue that's 5300 bytes at 360 Hz and  *
+ * 3836 at 250 Hz, checked against PT_MCU_RAM_BUDGET when compiling.             *
+ *                                                                               *
+ * Everything works on integers. The DC block gain and every threshold, average  *
+ * and limit panTompkins() computes on doubles are computed with integer         *
+ * arithmetic that gives exactly the same truncated value, so the beats are the  *
+ * same as ptFilterStep() + ptDecisionStep() (and panTompkins()) give. ptGolden  *
+ * checks that on Linux, and ptFootprint reports the flash, RAM and stack the    *
+ * object built for the target needs.                                            *
+ *                                                                               *
+ * On interrupt driven acquisition the ADC interrupt calls ptMcuPush(), which    *
+ * only stores the sample on a queue inside the ptMcu and moves its head, and    *
+ * the main loop calls ptMcuDrain() to run the detector over everything pending. *
+ * The queue has a single writer on each side, so it needs no locks: only the    *
+ * order of the stores matters, kept by acquire/release atomics where the        *
+ * compiler has them. A full queue drops the sample and counts it.               *
+ *                                                                               *
+ * With DMA driven acquisition, the DMA fills the two halves of a buffer in turn *
+ * and the main loop runs ptMcuBlock() over each full half while the other one   *
+ * is filled. ptMcuDmaAcquire() and ptMcuDmaRelease() hand a half over and back; *
+ * since the DMA never waits, they count the halves it refilled before the main  *
+ * loop got to them (lost) or while it held them (overruns). ptMcuBlock() is the *
+ * only caller of the detector step, so the step is inlined on it and a block    *
+ * costs a call rather than one per sample; ptMcuStep() is a block of one. ptIsr *
+ * checks both APIs on Linux, with signals or a timer thread as the interrupt.   *
+ *-------------------------------------------------------------------------------*
+ */
+
+#include "panTompkinsMcu.h"
+#include <string.h>
+
+// Fails to compile if the size formula is off or the detector doesn't fit the budget.
+typedef char ptMcuSizeIsExact[sizeof(ptMcu) == PT_MCU_RAM ? 1 : -1];
+typedef char ptMcuFitsBudget[PT_MCU_RAM <= PT_MCU_RAM_BUDGET ? 1 : -1];
+
+const uint32_t ptMcuSize = sizeof(ptMcu);
+
+// The queue indices are handed between the interrupt handler and the main loop: the sample must be
+// stored before the new head is seen, and read before the new tail is. With GCC and Clang that's an
+// acquire/release pair (a DMB on Cortex-M); otherwise volatile, enough on a single core without caches.
+#if defined(__GNUC__)
+#define PT_MCU_LOAD(index) __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+#define PT_MCU_STORE(index, value) __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
+#else
+#define PT_MCU_LOAD(index) (index)
+#define PT_MCU_STORE(index, value) ((index) = (value))
+#endif
+
+/*
+    Resets the detector to the state panTompkins() starts from, with an empty queue. Call it before the
+    interrupt that pushes samples is enabled.
+*/
+void ptMcuInit(ptMcu *mcu)
+{
+    memset(mcu, 0, sizeof(ptMcu));
+    mcu->regular = 1;
+}
+
+// Ring slots of sample p, which must be among the newest PT_MCU_BUFFER + 1 (high pass) or PT_MCU_BUFFER
+// (integral).
+static int32_t highpassOf(const ptMcu *mcu, uint32_t p)
+{
+    uint32_t back = mcu->count - 1 - p;
+
+    return mcu->highpass[back <= mcu->highpassAt ? mcu->highpassAt - back : mcu->highpassAt + PT_MCU_BUFFER + 1 - back];
+}
+
+static int32_t integralOf(const ptMcu *mcu, uint32_t p)
+{
+    uint32_t back = mcu->count - 1 - p;
+
+    return mcu->integral[back <= mcu->integralAt ? mcu->integralAt - back : mcu->integralAt + PT_MCU_BUFFER - back];
+}
+
+// The squared derivative of sample p, wrapping around like the int on panTompkins().
+static int32_t squaredOf(const ptMcu *mcu, uint32_t p)
+{
+    uint32_t derivative = (uint32_t)highpassOf(mcu, p) - (p ? (uint32_t)highpassOf(mcu, p - 1) : 0);
+
+    return (int32_t)(derivative*derivative);
+}
+
+/*
+    trunc(k/100*r) as panTompkins() computes it on doubles, for the RR limits (k = 92, 116, 166). 1.16
+    is the only one that isn't exact: its double is a bit smaller, so when 1.16*r is a whole number the
+    product may round just below it. That happens when r*36 > 25*p, p being the power of two above it.
+    Done on 32 bits, since a 64 bit division is a library call on most microcontrollers.
+*/
+static int32_t scaleRR(int32_t r, uint32_t k)
+{
+    uint32_t a = r < 0 ? -(uint32_t)r : (uint32_t)r, q = (a/100)*k + (a%100)*k/100;
+    uint64_t p = 1;
+
+    if (k == 116 && a % 25 == 0 && a)
+    {
+        while (p < q)
+            p *= 2;
+        if ((uint64_t)a*36 > p*25)
+            q--;
+    }
+
+    return r < 0 ? -(int32_t)q : (int32_t)q;
+}
+
+// (int)(slope/2) from panTompkins(), where slope was a sign extended int: half of it, rounded down.
+static uint32_t halfSlope(uint32_t slope)
+{
+    int32_t s = (int32_t)slope;
+
+    return (uint32_t)(s/2 - (s % 2 != 0 && s < 0));
+}
+
+static uint32_t slopeAt(const ptMcu *mcu, uint32_t base, uint32_t position)
+{
+    uint32_t j, slope = 0;
+
+    for (j = position - 10; j <= position; j++)
+        if ((uint32_t)squaredOf(mcu, base + j) > slope)
+            slope = squaredOf(mcu, base + j);
+
+    return slope;
+}
+
+static int updateRR(ptMcu *mcu, int32_t rr)
+{
+    uint32_t sum = 0;
+    int i, last = -1;
+    uint32_t prevRegular;
+
+    for (i = 0; i < 7; i++)
+    {
+        mcu->rr1[i] = mcu->rr1[i+1];
+        sum += mcu->rr1[i];
+    }
+    mcu->rr1[7] = rr;
+    mcu->rravg1 = (int32_t)(sum + rr)/8;
+
+    if ( (mcu->rr1[7] >= mcu->rrlow) && (mcu->rr1[7] <= mcu->rrhigh) )
+    {
+        sum = 0;
+        for (i = 0; i < 7; i++)
+        {
+            mcu->rr2[i] = mcu->rr2[i+1];
+            sum += mcu->rr2[i];
+        }
+        mcu->rr2[7] = rr;
+        mcu->rravg2 = (int32_t)(sum + rr)/8;
+        mcu->rrlow = scaleRR(mcu->rravg2, 92);
+        mcu->rrhigh = scaleRR(mcu->rravg2, 116);
+        mcu->rrmiss = scaleRR(mcu->rravg2, 166);
+        last = 7;
+    }
+
+    prevRegular = mcu->regular;
+    mcu->regular = mcu->rravg1 == mcu->rravg2;
+    if (!mcu->regular && prevRegular)
+    {
+        mcu->threshold_i1 /= 2;
+        mcu->threshold_f1 /= 2;
+    }
+
+    return last;
+}
+
+// (peak + (n-1)*level)/n, truncated like the double expression on panTompkins(). n must be a constant:
+// the 64-bit division then compiles to a shift, with no call to __aeabi_ldivmod or __divdi3.
+#define WEIGH(peak, level, n) ((int32_t)(((peak) + ((n) - 1)*(int64_t)(level))/(n)))
+
+// npk + 0.25*(spk - npk), truncated.
+static int32_t threshold(int32_t spk, int32_t npk)
+{
+    return (int32_t)((4*(int64_t)npk + (int32_t)((uint32_t)spk - (uint32_t)npk))/4);
+}
+
+static void noisePeak(ptMcu *mcu, int32_t peak_i, int32_t peak_f)
+{
+    mcu->npk_i = WEIGH(peak_i, mcu->npk_i, 8);
+    mcu->threshold_i1 = threshold(mcu->spk_i, mcu->npk_i);
+    mcu->threshold_i2 = mcu->threshold_i1/2;
+    mcu->npk_f = WEIGH(peak_f, mcu->npk_f, 8);
+    mcu->threshold_f1 = threshold(mcu->spk_f, mcu->npk_f);
+    mcu->threshold_f2 = mcu->threshold_f1/2;
+}
+
+// The new peak weighs 1/8 on a detection and 1/4 when found by the back search.
+static void signalPeak(ptMcu *mcu, bool searched, int32_t peak_i, int32_t peak_f)
+{
+    mcu->spk_i = searched ? WEIGH(peak_i, mcu->spk_i, 4) : WEIGH(peak_i, mcu->spk_i, 8);
+    mcu->threshold_i1 = threshold(mcu->spk_i, mcu->npk_i);
+    mcu->threshold_i2 = mcu->threshold_i1/2;
+    mcu->spk_f = searched ? WEIGH(peak_f, mcu->spk_f, 4) : WEIGH(peak_f, mcu->spk_f, 8);
+    mcu->threshold_f1 = threshold(mcu->spk_f, mcu->npk_f);
+    mcu->threshold_f2 = mcu->threshold_f1/2;
+}
+
+static int32_t backSearch(ptMcu *mcu, uint32_t base, uint32_t current)
+{
+    uint32_t i, start, sample = mcu->count, currentSlope;
+    int last;
+
+    start = current - (sample - mcu->lastQRS) + PT_MCU_REFRACTORY;
+    i = start;
+    if (mcu->searchQRS == mcu->lastQRS && mcu->searchI == mcu->threshold_i2 && mcu->searchF == mcu->threshold_f2 && start < current)
+    {
+        if (mcu->searchEnd > base + i)
+            i = mcu->searchEnd - base;
+    }
+    mcu->searchQRS = mcu->lastQRS;
+    mcu->searchI = mcu->threshold_i2;
+    mcu->searchF = mcu->threshold_f2;
+    mcu->searchEnd = base + current;
+
+    for (; i < current; i++)
+    {
+        if ( (integralOf(mcu, base + i) > mcu->threshold_i2) && (highpassOf(mcu, base + i) > mcu->threshold_f2))
+        {
+            currentSlope = slopeAt(mcu, base, i);
+
+            // i + sample < 1.36*lastQRS, which is exact on integers.
+            if ((currentSlope < halfSlope(mcu->lastSlope)) && 100*((uint64_t)i + sample) < 136*(uint64_t)mcu->lastQRS)
+            {
+                if (mcu->searchEnd > base + i)
+                    mcu->searchEnd = base + i;
+            }
+            else
+            {
+                signalPeak(mcu, true, integralOf(mcu, base + i), highpassOf(mcu, base + i));
+                mcu->lastSlope = currentSlope;
+                last = updateRR(mcu, (int32_t)(sample - (current - i) - mcu->lastQRS));
+                mcu->lastQRS = sample - (current - i);
+                return last >= 0 ? last : (int32_t)i;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/*
+    Runs a new sample through the filters and the decision logic. Returns true when a R peak was
+    detected and writes its position (counting samples from 0) on beat, which may be in the past when
+    the peak was found by the back search. The beats are the same ptFilterStep() + ptDecisionStep()
+    give with the default configuration for PT_MCU_FS, up to 2^32 samples. With 16 bit samples, no
+    stage before the squaring can overflow 32 bits.
+*/
+static bool step(ptMcu *mcu, int16_t x, uint32_t *beat)
+{
+    uint32_t n = mcu->count, sample, current, base, currentSlope;
+    int32_t dc, lp, hp, derivative, squared, integral, peak_i = 0, peak_f = 0, found;
+    int32_t *dcblock = mcu->dcblock, *lowpass = mcu->lowpass;
+    bool qrs = false;
+
+    // The delay lines start zeroed, which is what the n >= k tests on panTompkins() amount to. The 32nd
+    // low pass sample back is read before the newest one takes its place.
+    dc = n ? (1000*(x - mcu->signal) + 995*dcblock[(n-1) & 15])/1000 : 0;
+    mcu->signal = x;
+    lp = dc + 2*lowpass[(n-1) & 31] - lowpass[(n-2) & 31] - 2*dcblock[(n-6) & 15] + dcblock[(n-12) & 15];
+    hp = -lp - mcu->highpass[mcu->highpassAt] + 32*lowpass[(n-16) & 31] + lowpass[n & 31];
+    derivative = hp - mcu->highpass[mcu->highpassAt];
+    dcblock[n & 15] = dc;
+    lowpass[n & 31] = lp;
+
+    mcu->highpassAt = n ? (mcu->highpassAt == PT_MCU_BUFFER ? 0 : mcu->highpassAt + 1) : 0;
+    mcu->integralAt = n ? (mcu->integralAt == PT_MCU_BUFFER - 1 ? 0 : mcu->integralAt + 1) : 0;
+    mcu->highpass[mcu->highpassAt] = hp;
+    mcu->count = sample = n + 1;
+
+    // Moving-window integration, over the samples available until there are PT_MCU_WINDOW.
+    squared = (int32_t)((uint32_t)derivative*(uint32_t)derivative);
+    mcu->sum += squared;
+    if (n >= PT_MCU_WINDOW)
+        mcu->sum -= squaredOf(mcu, n - PT_MCU_WINDOW);
+    integral = (int32_t)mcu->sum/(int32_t)(n < PT_MCU_WINDOW ? n + 1 : PT_MCU_WINDOW);
+    mcu->integral[mcu->integralAt] = integral;
+
+    // The decision logic, as on ptDecisionStep().
+    current = n < PT_MCU_BUFFER ? n : PT_MCU_BUFFER - 1;
+    base = n - current;
+
+    if (integral >= mcu->threshold_i1 || hp >= mcu->threshold_f1)
+    {
+        peak_i = integral;
+        peak_f = hp;
+    }
+
+    if ((integral >= mcu->threshold_i1) && (hp >= mcu->threshold_f1))
+    {
+        if (sample > mcu->lastQRS + PT_MCU_REFRACTORY)
+        {
+            currentSlope = slopeAt(mcu, base, current);
+            if (sample > mcu->lastQRS + PT_MCU_SLOPE || currentSlope > halfSlope(mcu->lastSlope))
+            {
+                signalPeak(mcu, false, peak_i, peak_f);
+                mcu->lastSlope = currentSlope;
+                qrs = true;
+            }
+        }
+        // Doesn't respect the 200ms latency: it's noise.
+        else
+        {
+            noisePeak(mcu, integral, hp);
+            return false;
+        }
+    }
+
+    if (qrs)
+    {
+        updateRR(mcu, (int32_t)(sample - mcu->lastQRS));
+        mcu->lastQRS = sample;
+        *beat = n;
+        return true;
+    }
+
+    if ((sample - mcu->lastQRS > (uint32_t)mcu->rrmiss) && (sample > mcu->lastQRS + PT_MCU_REFRACTORY))
+    {
+        found = backSearch(mcu, base, current);
+        if (found >= 0)
+        {
+            *beat = base + found;
+            return true;
+        }
+    }
+
+    if ((integral >= mcu->threshold_i1) || (hp >= mcu->threshold_f1))
+        noisePeak(mcu, integral, hp);
+
+    return false;
+}
+
+/*
+    Runs a block of n samples through step(), calling beat for each R peak. step() is only called from
+    here, so it's inlined and the state is loaded once per block rather than once per sample. Returns
+    how many beats were found.
+*/
+uint32_t ptMcuBlock(ptMcu *mcu, const int16_t x[], uint32_t n, void (*beat)(uint32_t position, void *context), void *context)
+{
+    uint32_t i, found = 0, position;
+
+    for (i = 0; i < n; i++)
+    {
+        if (step(mcu, x[i], &position))
+        {
+            beat(position, context);
+            found++;
+        }
+    }
+
+    return found;
+}
+
+static void keep(uint32_t position, void *context)
+{
+    *(uint32_t *)context = position;
+}
+
+/*
+    A single sample through ptMcuBlock(): returns true and writes the position on beat as step() does.
+*/
+bool ptMcuStep(ptMcu *mcu, int16_t x, uint32_t *beat)
+{
+    return ptMcuBlock(mcu, &x, 1, keep, beat) != 0;
+}
+
+/*
+    Queues a sample for ptMcuDrain(). Meant for the ADC interrupt handler: a store and an index update,
+    no locks, and it never waits. Returns false, counting the sample on dropped, when the queue is full.
+*/
+bool ptMcuPush(ptMcu *mcu, int16_t x)
+{
+    uint32_t head = mcu->head;
+
+    if (head - PT_MCU_LOAD(mcu->tail) == PT_MCU_QUEUE)
+    {
+        mcu->dropped = mcu->dropped + 1;
+        return false;
+    }
+    mcu->queue[head & (PT_MCU_QUEUE - 1)] = x;
+    PT_MCU_STORE(mcu->head, head + 1);
+
+    return true;
+}
+
+/*
+    Runs every queued sample through ptMcuStep(), including the ones pushed while it runs, calling beat
+    for each R peak. Meant for the main loop. Positions count the samples processed, so they fall behind
+    by one for every dropped sample. Returns how many samples were processed.
+*/
+uint32_t ptMcuDrain(ptMcu *mcu, void (*beat)(uint32_t position, void *context), void *context)
+{
+    uint32_t tail = mcu->tail, start = tail;
+    int16_t x;
+
+    while (tail != PT_MCU_LOAD(mcu->head))
+    {
+        x = mcu->queue[tail & (PT_MCU_QUEUE - 1)];
+        PT_MCU_STORE(mcu->tail, ++tail);
+        ptMcuBlock(mcu, &x, 1, beat, context);
+    }
+
+    return tail - start;
+}
+
+/*
+    Starts a ping-pong transfer over buffer, 2*length samples: the DMA fills the first half first. Call
+    it before the DMA is started.
+*/
+void ptMcuDmaInit(ptMcuDma *dma, int16_t buffer[], uint32_t length)
+{
+    memset(dma, 0, sizeof(ptMcuDma));
+    dma->buffer = buffer;
+    dma->length = length;
+}
+
+/*
+    Called by the DMA interrupt (half transfer and transfer complete) each time a half is full, when the
+    DMA moves on to the other one.
+*/
+void ptMcuDmaComplete(ptMcuDma *dma)
+{
+    PT_MCU_STORE(dma->filled, dma->filled + 1);
+}
+
+/*
+    Hands the oldest full half over to the main loop, or returns NULL if the DMA is still filling the
+    first one. If the main loop fell so far behind that the DMA refilled a half before it was acquired,
+    that half is skipped and counted as lost: only the newest full half can still be read.
+*/
+const int16_t *ptMcuDmaAcquire(ptMcuDma *dma)
+{
+    uint32_t filled = PT_MCU_LOAD(dma->filled);
+
+    if (filled == dma->released)
+        return NULL;
+    if (filled - dma->released > 1)
+    {
+        dma->lost += filled - dma->released - 1;
+        dma->released = filled - 1;
+    }
+
+    return dma->buffer + (dma->released & 1)*dma->length;
+}
+
+/*
+    Hands the half taken by ptMcuDmaAcquire() back to the DMA. Returns false, counting an overrun, if
+    the DMA completed the other half meanwhile and started writing on this one before it was released:
+    the samples processed may be partly newer ones.
+*/
+bool ptMcuDmaRelease(ptMcuDma *dma)
+{
+    bool overrun = PT_MCU_LOAD(dma->filled) - dma->released > 1;
+
+    dma->released++;
+    if (overrun)
+        dma->overruns++;
+
+    return !overrun;
+}
+
+/*
+    The main loop side of a ping-pong transfer: runs every full half through ptMcuBlock(), calling beat
+    for each R peak. Lost halves don't count on the positions, like dropped samples on ptMcuDrain().
+    Returns how many samples were processed.
+*/
+uint32_t ptMcuDmaRun(ptMcu *mcu, ptMcuDma *dma, void (*beat)(uint32_t position, void *context), void *context)
+{
+    const int16_t *half;
+    uint32_t count = 0;
+
+    while ((half = ptMcuDmaAcquire(dma)))
+    {
+        ptMcuBlock(mcu, half, dma->length, beat, context);
+        ptMcuDmaRelease(dma);
+        count += dma->length;
+    }
+
+    return count;
+}
@@ -0,0 +1,122 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsMcu.h                                                        *
+ *       Header for the microcontroller engine                                   *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ */
+
+#ifndef PAN_TOMPKINS_MCU
+#define PAN_TOMPKINS_MCU
+
+#include "panTompkins.h"
+#include <stdint.h>
+
+// Sampling frequency the detector is built for. The rest of the configuration is derived from it at
+// compile time, with the same rounding as ptDefaultConfig().
+#ifndef PT_MCU_FS
+#define PT_MCU_FS 360
+#endif
+
+#define PT_MCU_WINDOW ((20*PT_MCU_FS + 180)/360)
+#define PT_MCU_BUFFER ((600*PT_MCU_FS + 180)/360)
+#define PT_MCU_DELAY ((22*PT_MCU_FS + 180)/360)
+#define PT_MCU_REFRACTORY (PT_MCU_FS/5)
+#define PT_MCU_SLOPE (36*PT_MCU_FS/100)
+
+// Samples the interrupt handler may push (ptMcuPush) before the main loop drains them (ptMcuDrain). A
+// power of two; 64 samples give the main loop 178ms at 360 Hz.
+#ifndef PT_MCU_QUEUE
+#define PT_MCU_QUEUE 64
+#endif
+
+// Exact size of a ptMcu, in bytes: every field is 4 bytes wide but the queue, which holds an even number
+// of 16 bit samples, so it's the same on every target. The build fails if it's larger than
+// PT_MCU_RAM_BUDGET.
+#define PT_MCU_RAM (4*(2*PT_MCU_BUFFER + 93) + 2*PT_MCU_QUEUE)
+#ifndef PT_MCU_RAM_BUDGET
+#define PT_MCU_RAM_BUDGET 8192
+#endif
+
+/*
+    The whole state of a detector, filters and decision logic. It's kept wherever the caller wants it
+    (usually a static variable): nothing is allocated. The high pass and integrator rings hold exactly
+    what the back search looks at; the squared slope isn't kept, it's computed again from the high pass.
+*/
+typedef struct
+{
+    int32_t highpass[PT_MCU_BUFFER + 1], integral[PT_MCU_BUFFER];
+    int32_t dcblock[16], lowpass[32];
+    int32_t signal;                 // Previous input.
+    uint32_t sum;                   // Integrator sum, wrapping around like the int on panTompkins().
+    uint32_t count;                 // Samples received.
+    uint32_t highpassAt, integralAt;  // Slot of the newest sample on each ring.
+
+    // Decision logic, as on ptDecision. lastSlope keeps the bits of the squared sample it came from.
+    int32_t threshold_i1, threshold_i2, threshold_f1, threshold_f2, spk_i, spk_f, npk_i, npk_f;
+    int32_t rr1[8], rr2[8], rravg1, rravg2, rrlow, rrhigh, rrmiss;
+    uint32_t lastQRS, lastSlope, searchQRS, searchEnd;
+    int32_t searchI, searchF;
+    uint32_t regular;
+
+    // Samples pushed by the interrupt handler and not drained yet. Only the handler writes head and
+    // dropped, only the main loop writes tail.
+    int16_t queue[PT_MCU_QUEUE];
+    volatile uint32_t head, tail;
+    volatile uint32_t dropped;      // Samples lost because the queue was full.
+} ptMcu;
+
+/*
+    Ping-pong acquisition: the DMA fills the two halves of buffer in turn, raising an interrupt as each
+    one completes, while the main loop runs the detector over the other. A half belongs to the main loop
+    from ptMcuDmaAcquire() to ptMcuDmaRelease(). The hardware doesn't wait for it: the counters only
+    tell when it got back to a half before it was released.
+*/
+typedef struct
+{
+    int16_t *buffer;                // 2*length samples.
+    uint32_t length;                // Samples on each half.
+    volatile uint32_t filled;       // Halves completed, written by the DMA interrupt only.
+    uint32_t released;              // Halves handed back to the DMA.
+    uint32_t lost;                  // Halves overwritten before they were acquired, never processed.
+    uint32_t overruns;              // Halves the DMA wrote into while the main loop held them.
+} ptMcuDma;
+
+// sizeof(ptMcu) in this build, kept on the object file for ptFootprint.
+extern const uint32_t ptMcuSize;
+
+void ptMcuInit(ptMcu *mcu);
+bool ptMcuStep(ptMcu *mcu, int16_t x, uint32_t *beat);
+bool ptMcuPush(ptMcu *mcu, int16_t x);
+uint32_t ptMcuDrain(ptMcu *mcu, void (*beat)(uint32_t position, void *context), void *context);
+uint32_t ptMcuBlock(ptMcu *mcu, const int16_t x[], uint32_t n, void (*beat)(uint32_t position, void *context), void *context);
+void ptMcuDmaInit(ptMcuDma *dma, int16_t buffer[], uint32_t length);
+void ptMcuDmaComplete(ptMcuDma *dma);
+const int16_t *ptMcuDmaAcquire(ptMcuDma *dma);
+bool ptMcuDmaRelease(ptMcuDma *dma);
+uint32_t ptMcuDmaRun(ptMcu *mcu, ptMcuDma *dma, void (*beat)(uint32_t position, void *context), void *context);
+
+#endif
@@ -0,0 +1,89 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsMulti.c                                                      *
+ *       Runs many configurations of the Pan-Tompkins decision logic over the    *
+ *       same filtered signal                                                    *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Evaluates several configurations of the decision logic over one pass of the   *
+ * filters. The filtered signals don't depend on the thresholds, so a parameter  *
+ * sweep only has to filter the signal once (ptFilterSignal()) and then run      *
+ * ptMultiDetect() over it. The configurations run on the lanes of a ptLanes, so *
+ * on CPUs with AVX2 eight of them cost about as much as three on their own.     *
+ *-------------------------------------------------------------------------------*
+ */
+
+#include "panTompkinsMulti.h"
+#include <stddef.h>
+
+static void addBeat(ptBeatList *beats, long unsigned int position)
+{
+    if (beats->position != NULL && beats->count < beats->capacity)
+        beats->position[beats->count] = position;
+    beats->count++;
+}
+
+/*
+    Runs the decision logic of panTompkins() for several configurations over the same filtered signals
+    (see ptFilterSignal()), writing the beats found for each one. The configurations may differ on
+    anything but the filter settings (windowSize). They're evaluated PT_LANES at a time on a ptLanes,
+    all the lanes advanced over the same sample before moving on to the next one, so the filtered
+    signals are read once per group of PT_LANES configurations rather than once per configuration.
+    Signals must be shorter than 2^31 samples.
+*/
+void ptMultiDetect(const dataType highpass[], const dataType squared[], const dataType integral[], long unsigned int n, const ptConfig config[], int count, ptBeatList beats[])
+{
+    ptHistory history[PT_LANES];
+    ptLanes lanes;
+    bool beat[PT_LANES];
+    long unsigned int position[PT_LANES], t;
+    int k, j, group;
+
+    for (k = 0; k < PT_LANES; k++)
+    {
+        history[k].highpass = highpass;
+        history[k].squared = squared;
+        history[k].integral = integral;
+        history[k].mask = ~0UL;
+        history[k].stride = 1;
+    }
+
+    for (k = 0; k < count; k++)
+        beats[k].count = 0;
+
+    for (k = 0; k < count; k += PT_LANES)
+    {
+        group = count - k < PT_LANES ? count - k : PT_LANES;
+        ptLanesInit(&lanes, &config[k], history, group, false);
+        for (t = 0; t < n; t++)
+            if (ptLanesStep(&lanes, beat, position))
+                for (j = 0; j < group; j++)
+                    if (beat[j])
+                        addBeat(&beats[k + j], position[j]);
+    }
+}
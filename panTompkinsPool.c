@@ -0,0 +1,295 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsPool.c                                                       *
+ *       Detector pool: the state of many streams split into hot and cold parts, *
+ *       stepped by a batch scheduler                                            *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Pool of detectors for servers with thousands of streams that receive their    *
+ * samples at different times. A ptFilter keeps seven rings of PT_HISTORY        *
+ * samples per stream and a ptDecision sits apart from them, so switching from   *
+ * stream to stream misses the cache on every ring. The pool splits each stream  *
+ * in two: what every sample touches (sample counter, first thresholds, last     *
+ * QRS, rrmiss, the previous input and high pass output, the integrator sum and  *
+ * the short delay lines of the DC block and low pass filters) is kept hot, one  *
+ * array per field, and the rest (the three rings the decision logic looks back  *
+ * on, the full ptDecision and the queue of waiting samples) is kept cold.       *
+ *                                                                               *
+ * Samples below both first thresholds that can't start a back search (nearly    *
+ * all of them) only touch the hot part and the newest position of the rings;    *
+ * the others go through ptDecisionStep() on the cold ptDecision, which then     *
+ * refreshes the hot copies. Streams can be stepped directly (ptPoolStep) or     *
+ * have their samples queued (ptPoolPush) for the scheduler (ptPoolRun), which   *
+ * sweeps the pool in slot order running each stream's samples back to back.     *
+ *                                                                               *
+ * Every stream gets exactly the same beats it would get from its own ptFilter + *
+ * ptDecision, as ptGolden checks. Not with PT_SAMPLE16, though: the pool keeps  *
+ * its filters on wrapping 32-bit integers and ignores it, while ptFilterStep()  *
+ * then saturates them, so the beats can differ (see README.txt).                *
+ *-------------------------------------------------------------------------------*
+ */
+
+#include "panTompkinsPool.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    Gives every hot array room for capacity slots, keeping what they hold. New slots go to the free list.
+*/
+static bool grow(ptPool *p, int capacity)
+{
+    void *grown;
+    int k;
+
+#define GROW(field) if (!(grown = realloc(p->field, capacity*sizeof(*p->field)))) return false; p->field = grown;
+    GROW(sample) GROW(lastQRS) GROW(threshold_i1) GROW(threshold_f1) GROW(rrmiss)
+    GROW(signal) GROW(highpass) GROW(sum) GROW(dcblock) GROW(lowpass) GROW(queued) GROW(next) GROW(cold)
+#undef GROW
+
+    for (k = capacity - 1; k >= p->capacity; k--)
+    {
+        p->next[k] = p->free;
+        p->free = k;
+    }
+    p->capacity = capacity;
+
+    return true;
+}
+
+/*
+    Prepares an empty pool of detectors with the given configuration, with room for capacity streams
+    (it grows as needed). Returns false if there's no memory for it.
+*/
+bool ptPoolInit(ptPool *pool, const ptConfig *config, int capacity)
+{
+    memset(pool, 0, sizeof(ptPool));
+    pool->config = *config;
+    pool->free = -1;
+
+    return grow(pool, capacity > 0 ? capacity : 1);
+}
+
+void ptPoolFree(ptPool *pool)
+{
+    free(pool->sample);
+    free(pool->lastQRS);
+    free(pool->threshold_i1);
+    free(pool->threshold_f1);
+    free(pool->rrmiss);
+    free(pool->signal);
+    free(pool->highpass);
+    free(pool->sum);
+    free(pool->dcblock);
+    free(pool->lowpass);
+    free(pool->queued);
+    free(pool->next);
+    free(pool->cold);
+    memset(pool, 0, sizeof(ptPool));
+}
+
+/*
+    Starts a new stream and returns its slot, or -1 if the pool couldn't grow. The user pointer is given
+    back along with each beat.
+*/
+int ptPoolOpen(ptPool *pool, void *user)
+{
+    ptPoolCold *cold;
+    int slot;
+
+    if (pool->free < 0 && !grow(pool, 2*pool->capacity))
+        return -1;
+    slot = pool->free;
+    pool->free = pool->next[slot];
+    pool->next[slot] = -2;
+    pool->used++;
+
+    // Zeroed rings and delay lines read as the taps panTompkins() leaves out before the first samples.
+    cold = &pool->cold[slot];
+    memset(cold->highpass, 0, sizeof(cold->highpass));
+    memset(cold->squared, 0, sizeof(cold->squared));
+    memset(cold->integral, 0, sizeof(cold->integral));
+    ptDecisionInit(&cold->decision);
+    cold->user = user;
+    memset(pool->dcblock[slot], 0, sizeof(pool->dcblock[slot]));
+    memset(pool->lowpass[slot], 0, sizeof(pool->lowpass[slot]));
+    pool->sample[slot] = pool->lastQRS[slot] = 0;
+    pool->threshold_i1[slot] = pool->threshold_f1[slot] = 0;
+    pool->rrmiss[slot] = 0;
+    pool->signal[slot] = pool->highpass[slot] = pool->sum[slot] = 0;
+    pool->queued[slot] = 0;
+
+    return slot;
+}
+
+/*
+    Ends a stream. Samples still queued are dropped; its slot will be reused.
+*/
+void ptPoolClose(ptPool *pool, int slot)
+{
+    if (slot < 0 || slot >= pool->capacity || pool->next[slot] != -2)
+        return;
+    pool->queued[slot] = 0;
+    pool->next[slot] = pool->free;
+    pool->free = slot;
+    pool->used--;
+}
+
+/*
+    Runs count samples of a stream through its filters and decision logic, reading them from x or, if
+    it's NULL, from x16. The filters are the same equations as ptFilterStep(), on short delay lines, each
+    computed in 64 bits and narrowed to dataType as it does by default; the integrator keeps a running
+    sum modulo 2^32, as on ptBatch. Most samples are below both first
+    thresholds and can't start a back search: for those, ptDecisionStep() would only count the sample,
+    so it's only called (with the full state) for the others.
+*/
+static void step(ptPool *pool, int slot, const dataType x[], const short x16[], int count, ptPoolBeat beat, void *context)
+{
+    ptPoolCold *cold = &pool->cold[slot];
+    dataType *dcblock = pool->dcblock[slot], *lowpass = pool->lowpass[slot];
+    dataType signal = pool->signal[slot], highpass1 = pool->highpass[slot], sum = pool->sum[slot];
+    dataType threshold_i1 = pool->threshold_i1[slot], threshold_f1 = pool->threshold_f1[slot];
+    long unsigned int n = pool->sample[slot], lastQRS = pool->lastQRS[slot], rrmiss = pool->rrmiss[slot];
+    long unsigned int refractory = pool->config.refractory, window = pool->config.windowSize;
+    int k;
+
+    for (k = 0; k < count; k++, n++)
+    {
+        dataType in = x ? x[k] : x16[k], dc, lp, hp, derivative, squared, integral;
+        int c = n & PT_MASK;
+
+        dc = n ? (dataType)(long long int)((long long int)in - signal + 0.995*dcblock[(n - 1) % PT_POOL_DCBLOCK]) : 0;
+        lp = (dataType)(dc + 2LL*lowpass[(n - 1) % PT_POOL_LOWPASS] - lowpass[(n - 2) % PT_POOL_LOWPASS]
+             - 2LL*dcblock[(n - 6) % PT_POOL_DCBLOCK] + dcblock[(n - 12) % PT_POOL_DCBLOCK]);
+        // lowpass[n % 32] still holds sample n - 32.
+        hp = (dataType)(-(long long int)lp - highpass1 + 32LL*lowpass[(n - 16) % PT_POOL_LOWPASS] + lowpass[n % PT_POOL_LOWPASS]);
+        derivative = (dataType)((long long int)hp - highpass1);
+        squared = (dataType)((long long int)derivative*derivative);
+        sum = (unsigned int)sum + (unsigned int)squared - (unsigned int)cold->squared[(n - window) & PT_MASK];
+        integral = sum/(dataType)(n < window ? n + 1 : window);
+
+        // Before the first 12 samples the older taps read the zeros the lines started with.
+        dcblock[n % PT_POOL_DCBLOCK] = dc;
+        lowpass[n % PT_POOL_LOWPASS] = lp;
+        cold->highpass[c] = hp;
+        cold->squared[c] = squared;
+        cold->integral[c] = integral;
+        signal = in;
+        highpass1 = hp;
+
+        // Fast path: what ptDecisionStep() does when neither threshold is reached and no back search is due.
+        if (integral < threshold_i1 && hp < threshold_f1 && !(n + 1 - lastQRS > rrmiss && n + 1 > lastQRS + refractory))
+        {
+            PT_COUNT(&cold->decision, samples);
+            continue;
+        }
+        {
+            ptDecision *d = &cold->decision;
+            ptHistory history = {cold->highpass, cold->squared, cold->integral, PT_MASK, 1};
+            long unsigned int position;
+
+            d->sample = n;
+            if (ptDecisionStep(d, &pool->config, &history, &position))
+                beat(slot, cold->user, position, n, context);
+            threshold_i1 = d->threshold_i1;
+            threshold_f1 = d->threshold_f1;
+            lastQRS = d->lastQRS;
+            rrmiss = d->rrmiss;
+        }
+    }
+
+    pool->sample[slot] = n;
+    pool->lastQRS[slot] = lastQRS;
+    pool->threshold_i1[slot] = threshold_i1;
+    pool->threshold_f1[slot] = threshold_f1;
+    pool->rrmiss[slot] = rrmiss;
+    pool->signal[slot] = signal;
+    pool->highpass[slot] = highpass1;
+    pool->sum[slot] = sum;
+}
+
+void ptPoolStep(ptPool *pool, int slot, const dataType x[], int count, ptPoolBeat beat, void *context)
+{
+    step(pool, slot, x, NULL, count, beat, context);
+}
+
+/*
+    Same as ptPoolStep(), for 16-bit samples read in place (e.g. from a shared memory ring).
+*/
+void ptPoolStepShort(ptPool *pool, int slot, const short x[], int count, ptPoolBeat beat, void *context)
+{
+    step(pool, slot, NULL, x, count, beat, context);
+}
+
+/*
+    Queues samples of a stream for the next ptPoolRun(). Returns how many fit.
+*/
+int ptPoolPush(ptPool *pool, int slot, const dataType x[], int count)
+{
+    int room = PT_POOL_QUEUE - pool->queued[slot];
+
+    if (count > room)
+        count = room;
+    memcpy(pool->cold[slot].queue + pool->queued[slot], x, count*sizeof(dataType));
+    pool->queued[slot] += count;
+
+    return count;
+}
+
+/*
+    The scheduler: goes once over the pool in slot order, advancing every stream with queued samples by
+    up to quantum of them (all of them if quantum is 0). Each stream runs its samples back to back, so
+    its delay lines and the newest part of its rings stay on L1 meanwhile, and the hot arrays are read in
+    order. Returns how many samples were run.
+*/
+long unsigned int ptPoolRun(ptPool *pool, int quantum, ptPoolBeat beat, void *context)
+{
+    long unsigned int total = 0;
+    int slot, count;
+
+    for (slot = 0; slot < pool->capacity; slot++)
+    {
+        if (!pool->queued[slot] || pool->next[slot] != -2)
+            continue;
+        count = quantum > 0 && quantum < pool->queued[slot] ? quantum : pool->queued[slot];
+        ptPoolStep(pool, slot, pool->cold[slot].queue, count, beat, context);
+        pool->queued[slot] -= count;
+        if (pool->queued[slot])
+            memmove(pool->cold[slot].queue, pool->cold[slot].queue + count, pool->queued[slot]*sizeof(dataType));
+        total += count;
+    }
+
+    return total;
+}
+
+/*
+    Copies the counters of a stream of the pool (see ptDecisionStats()).
+*/
+bool ptPoolStats(const ptPool *pool, int slot, ptStats *stats)
+{
+    return ptDecisionStats(&pool->cold[slot].decision, stats);
+}
@@ -0,0 +1,95 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsPool.h                                                       *
+ *       Header for the detector pool                                            *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ */
+
+#ifndef PAN_TOMPKINS_POOL
+#define PAN_TOMPKINS_POOL
+
+#include "panTompkinsCore.h"
+
+// Delay lines of the DC block and low pass filters, in samples: enough for their deepest taps (12 and 32).
+#define PT_POOL_DCBLOCK 16
+#define PT_POOL_LOWPASS 32
+
+// Samples a stream may have queued for ptPoolRun().
+#ifndef PT_POOL_QUEUE
+#define PT_POOL_QUEUE 512
+#endif
+
+/*
+    What a stream of the pool only touches now and then: the rings the decision logic looks back on, its
+    full state (kept up to date only when it leaves the fast path) and the queue of samples waiting for
+    the scheduler.
+*/
+typedef struct
+{
+    dataType highpass[PT_HISTORY], squared[PT_HISTORY], integral[PT_HISTORY];
+    ptDecision decision;
+    dataType queue[PT_POOL_QUEUE];
+    void *user;
+} ptPoolCold;
+
+/*
+    Detectors for many streams sharing one configuration. The values every sample reads or writes (the
+    counters, the thresholds the decision logic compares against, the last QRS and the short delay lines
+    of the filters) are kept apart from the rest, as one array per field, so a few hundred bytes per
+    stream are all that stays hot. Streams are identified by their slot.
+*/
+typedef struct
+{
+    ptConfig config;
+    int capacity, used, free;       // free: first slot of the free list, or -1.
+
+    // Hot fields, one entry per slot.
+    long unsigned int *sample, *lastQRS;
+    dataType *threshold_i1, *threshold_f1;
+    int *rrmiss;
+    dataType *signal, *highpass, *sum;                  // Previous input and high pass output, integrator sum.
+    dataType (*dcblock)[PT_POOL_DCBLOCK], (*lowpass)[PT_POOL_LOWPASS];
+    int *queued, *next;             // Samples waiting; next on the free list (or -2 if in use).
+
+    ptPoolCold *cold;
+} ptPool;
+
+// Called for each beat found: the slot, the user pointer given to ptPoolOpen(), where the R peak is and
+// the sample at which it was found.
+typedef void (*ptPoolBeat)(int slot, void *user, long unsigned int position, long unsigned int found, void *context);
+
+bool ptPoolInit(ptPool *pool, const ptConfig *config, int capacity);
+void ptPoolFree(ptPool *pool);
+int ptPoolOpen(ptPool *pool, void *user);
+void ptPoolClose(ptPool *pool, int slot);
+void ptPoolStep(ptPool *pool, int slot, const dataType x[], int count, ptPoolBeat beat, void *context);
+void ptPoolStepShort(ptPool *pool, int slot, const short x[], int count, ptPoolBeat beat, void *context);
+int ptPoolPush(ptPool *pool, int slot, const dataType x[], int count);
+long unsigned int ptPoolRun(ptPool *pool, int quantum, ptPoolBeat beat, void *context);
+bool ptPoolStats(const ptPool *pool, int slot, ptStats *stats);
+
+#endif
@@ -0,0 +1,462 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsBench.c                                                      *
+ *       Benchmark: throughput, per-sample latency and memory of the detector    *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Measures how fast the detector runs, for regression tracking. Every record    *
+ * (examples/test_input.txt, other text records at 360 Hz and synthetic records  *
+ * of any length and sampling frequency) is run in two modes:                    *
+ * - compute: the streaming engine (panTompkinsCore) over a record already in    *
+ *   memory. No I/O.                                                             *
+ * - io: text file in, text file out, both by the streaming engine and by        *
+ *   panTompkins() itself (the latter only at 360 Hz, its compiled-in FS).       *
+ *                                                                               *
+ * For each run it reports, as JSON on stdout: throughput in Msamples/s (best of *
+ * the repeats), the p50, p99 and maximum time taken by a single sample (on a    *
+ * separate pass, since timing every sample slows the run down), the beats       *
+ * found, the peak resident memory of the process so far and, on Linux, hardware *
+ * counters per sample (cycles, instructions, branch misses, L1 data and last    *
+ * level cache misses, see panTompkinsPerf), null where they aren't available.   *
+ *                                                                               *
+ * Build from the repository root:                                               *
+ * gcc -O2 -I. -Itools tools/panTompkinsBench.c tools/panTompkinsRecord.c \      *
+ *     tools/panTompkinsSynth.c tools/panTompkinsPerf.c panTompkins.c \          *
+ *     panTompkinsCore.c -lm -o ptBench                                          *
+ *-------------------------------------------------------------------------------*
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "panTompkinsRecord.h"
+#include "panTompkinsCore.h"
+#include "panTompkinsPerf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+// Per-sample latencies are kept on a histogram with 1ns buckets. Anything slower goes on the last one
+// (the exact maximum is kept apart).
+#define LATENCY_BUCKETS 65536
+
+typedef struct
+{
+    long unsigned int bucket[LATENCY_BUCKETS];
+    long unsigned int count, max;
+} latency;
+
+typedef struct
+{
+    double seconds;     // Best of the repeats.
+    latency samples;
+    long unsigned int beats;
+    bool timed;         // Whether there are per-sample latencies.
+    double counters[PT_PERF_COUNTERS];
+} result;
+
+// Hardware counters, opened once for the whole program.
+static ptPerf perf;
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+static long unsigned int nanoseconds()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long unsigned int)t.tv_sec*1000000000ul + t.tv_nsec;
+}
+
+static void addLatency(latency *l, long unsigned int ns)
+{
+    l->bucket[ns < LATENCY_BUCKETS ? ns : LATENCY_BUCKETS - 1]++;
+    l->count++;
+    if (ns > l->max)
+        l->max = ns;
+}
+
+static long unsigned int percentile(const latency *l, double p)
+{
+    long unsigned int target = (long unsigned int)(p*l->count), seen = 0;
+    int k;
+
+    for (k = 0; k < LATENCY_BUCKETS - 1; k++)
+    {
+        seen += l->bucket[k];
+        if (seen > target)
+            return k;
+    }
+
+    return l->max;
+}
+
+// How long clock_gettime() itself takes, so the latencies can be read with that in mind.
+static long unsigned int timerOverhead()
+{
+    long unsigned int best = ~0ul, a, b;
+    int k;
+
+    for (k = 0; k < 1000; k++)
+    {
+        a = nanoseconds();
+        b = nanoseconds();
+        if (b - a < best)
+            best = b - a;
+    }
+
+    return best;
+}
+
+static long unsigned int peakRSS()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;     // kB on Linux.
+}
+
+// Output sinks for the framer: in memory (only counts the beats) or text on a file.
+static void countBeat(int out, void *context)
+{
+    *(long unsigned int *)context += out;
+}
+
+typedef struct
+{
+    FILE *f;
+    long unsigned int beats;
+} textSink;
+
+static void writeText(int out, void *context)
+{
+    textSink *sink = context;
+    fprintf(sink->f, "%d\n", out);
+    sink->beats += out;
+}
+
+/*
+    The streaming engine over a record already in memory: filters, decision logic and framing only. With
+    per-sample timing, each sample's filter + decision + framer step is timed on its own.
+*/
+static double runCompute(const ptRecord *record, const ptConfig *config, latency *timing, long unsigned int *beats)
+{
+    static ptFilter filter;
+    ptDecision decision;
+    ptFramer framer;
+    ptHistory history;
+    long unsigned int i, position, a;
+    bool qrs;
+    double start;
+
+    *beats = 0;
+    ptFilterInit(&filter, config);
+    ptFilterHistory(&filter, &history);
+    ptDecisionInit(&decision);
+    ptFramerInit(&framer, config);
+    start = now();
+    for (i = 0; i < record->n; i++)
+    {
+        if (timing)
+            a = nanoseconds();
+        ptFilterStep(&filter, record->x[i]);
+        qrs = ptDecisionStep(&decision, config, &history, &position);
+        ptFramerStep(&framer, qrs, position, countBeat, beats);
+        if (timing)
+            addLatency(timing, nanoseconds() - a);
+    }
+    ptFramerFlush(&framer, countBeat, beats);
+
+    return now() - start;
+}
+
+/*
+    The streaming engine reading a text file and writing the 0/1 output as text, like panTompkins()
+    does. Per-sample timing covers parsing the sample, the detector and writing whatever it outputs.
+*/
+static double runText(const char in[], const char out[], const ptConfig *config, latency *timing, long unsigned int *beats)
+{
+    static ptFilter filter;
+    ptDecision decision;
+    ptFramer framer;
+    ptHistory history;
+    textSink sink;
+    long unsigned int position, a = 0;
+    FILE *f;
+    int x;
+    bool qrs;
+    double start = now();
+
+    f = fopen(in, "r");
+    sink.f = fopen(out, "w");
+    sink.beats = 0;
+    if (!f || !sink.f)
+    {
+        fprintf(stderr, "can't open %s or %s\n", in, out);
+        exit(1);
+    }
+    ptFilterInit(&filter, config);
+    ptFilterHistory(&filter, &history);
+    ptDecisionInit(&decision);
+    ptFramerInit(&framer, config);
+    for (;;)
+    {
+        if (timing)
+            a = nanoseconds();
+        if (fscanf(f, "%d", &x) != 1)
+            break;
+        ptFilterStep(&filter, x);
+        qrs = ptDecisionStep(&decision, config, &history, &position);
+        ptFramerStep(&framer, qrs, position, writeText, &sink);
+        if (timing)
+            addLatency(timing, nanoseconds() - a);
+    }
+    ptFramerFlush(&framer, writeText, &sink);
+    fclose(f);
+    fclose(sink.f);
+    *beats = sink.beats;
+
+    return now() - start;
+}
+
+/*
+    panTompkins() itself, file to file. It can only be timed as a whole.
+*/
+static double runReference(const char in[], const char out[], long unsigned int *beats)
+{
+    double start = now(), seconds;
+    FILE *f;
+    int x;
+
+    init(in, out);
+    panTompkins();
+    seconds = now() - start;
+
+    *beats = 0;
+    f = fopen(out, "r");
+    while (f && fscanf(f, "%d", &x) == 1)
+        *beats += x;
+    if (f)
+        fclose(f);
+
+    return seconds;
+}
+
+static void printResult(const char record[], const ptRecord *r, const char engine[], const char mode[], const result *res, bool *first)
+{
+    printf("%s\n    {\"record\": \"%s\", \"fs\": %d, \"samples\": %lu, \"engine\": \"%s\", \"mode\": \"%s\", ",
+           *first ? "" : ",", record, r->fs, r->n, engine, mode);
+    printf("\"seconds\": %.6f, \"msamples_per_s\": %.3f, \"beats\": %lu, ", res->seconds, r->n/res->seconds/1e6, res->beats);
+    if (res->timed)
+        printf("\"latency_ns\": {\"p50\": %lu, \"p99\": %lu, \"max\": %lu}, ",
+               percentile(&res->samples, 0.5), percentile(&res->samples, 0.99), res->samples.max);
+    else
+        printf("\"latency_ns\": null, ");
+    printf("\"peak_rss_kb\": %lu, \"counters_per_sample\": ", peakRSS());
+    ptPerfPrint(res->counters, r->n);
+    printf("}");
+    *first = false;
+}
+
+/*
+    Runs every engine and mode over one record. The best time out of the repeats is reported for the
+    throughput, and separate passes give the per-sample latencies and the hardware counters, so the
+    timer calls don't slow down the throughput runs nor show up on the counters.
+*/
+static void benchRecord(const char name[], const ptRecord *record, const char path[], int repeats, int modes, bool *first)
+{
+    static result res;
+    ptConfig config;
+    char out[] = "/tmp/ptBenchOutXXXXXX";
+    double t;
+    int k, fd;
+
+    ptDefaultConfig(&config, record->fs);
+    if (config.bufferSize > PT_HISTORY || config.windowSize > PT_MAXWINDOW)
+    {
+        fprintf(stderr, "%s: %d Hz needs a larger PT_HISTORY (-DPT_HISTORY=4096)\n", name, record->fs);
+        return;
+    }
+    fd = mkstemp(out);
+    if (fd < 0)
+    {
+        fprintf(stderr, "can't create a temporary file\n");
+        exit(1);
+    }
+    close(fd);
+
+    if (modes & 1)
+    {
+        memset(&res, 0, sizeof(res));
+        res.seconds = 1e30;
+        for (k = 0; k < repeats; k++)
+        {
+            t = runCompute(record, &config, NULL, &res.beats);
+            res.seconds = t < res.seconds ? t : res.seconds;
+        }
+        runCompute(record, &config, &res.samples, &res.beats);
+        res.timed = true;
+        ptPerfStart(&perf);
+        runCompute(record, &config, NULL, &res.beats);
+        ptPerfStop(&perf, res.counters);
+        printResult(name, record, "core", "compute", &res, first);
+    }
+
+    if (modes & 2)
+    {
+        memset(&res, 0, sizeof(res));
+        res.seconds = 1e30;
+        for (k = 0; k < repeats; k++)
+        {
+            t = runText(path, out, &config, NULL, &res.beats);
+            res.seconds = t < res.seconds ? t : res.seconds;
+        }
+        runText(path, out, &config, &res.samples, &res.beats);
+        res.timed = true;
+        ptPerfStart(&perf);
+        runText(path, out, &config, NULL, &res.beats);
+        ptPerfStop(&perf, res.counters);
+        printResult(name, record, "core", "io", &res, first);
+
+        // panTompkins() has its settings fixed at compile time.
+        if (record->fs == 360)
+        {
+            memset(&res, 0, sizeof(res));
+            res.seconds = 1e30;
+            for (k = 0; k < repeats; k++)
+            {
+                t = runReference(path, out, &res.beats);
+                res.seconds = t < res.seconds ? t : res.seconds;
+            }
+            res.timed = false;
+            ptPerfStart(&perf);
+            runReference(path, out, &res.beats);
+            ptPerfStop(&perf, res.counters);
+            printResult(name, record, "reference", "io", &res, first);
+        }
+    }
+
+    remove(out);
+}
+
+static void usage(const char program[])
+{
+    fprintf(stderr,
+            "usage: %s [-i record.txt] [-y samples[:fs]] [-s seed] [-r repeats] [-m compute|io|both]\n"
+            "  -i  text record at 360 Hz, one sample per line (may be repeated)\n"
+            "  -y  synthetic record of the given length and sampling frequency (may be repeated)\n"
+            "  -s  seed of the synthetic records (1)\n"
+            "  -r  how many times each run is repeated; the best one is reported (3)\n"
+            "  -m  compute: detector only, record already in memory; io: text file in, text file out\n"
+            "With no -i or -y, runs examples/test_input.txt and a synthetic record of 1000000 samples at 360 Hz.\n",
+            program);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *files[16], *synths[16];
+    int nFiles = 0, nSynths = 0, repeats = 3, modes = 3, k, opt;
+    unsigned int seed = 1;
+    bool first = true;
+
+    while ((opt = getopt(argc, argv, "i:y:s:r:m:h")) != -1)
+    {
+        if (opt == 'i' && nFiles < 16)
+            files[nFiles++] = optarg;
+        else if (opt == 'y' && nSynths < 16)
+            synths[nSynths++] = optarg;
+        else if (opt == 's')
+            seed = strtoul(optarg, NULL, 10);
+        else if (opt == 'r' && atoi(optarg) > 0)
+            repeats = atoi(optarg);
+        else if (opt == 'm' && !strcmp(optarg, "compute"))
+            modes = 1;
+        else if (opt == 'm' && !strcmp(optarg, "io"))
+            modes = 2;
+        else if (opt == 'm' && !strcmp(optarg, "both"))
+            modes = 3;
+        else
+            usage(argv[0]);
+    }
+    if (!nFiles && !nSynths)
+    {
+        files[nFiles++] = "examples/test_input.txt";
+        synths[nSynths++] = "1000000:360";
+    }
+
+    if (!ptPerfOpen(&perf))
+        fprintf(stderr, "hardware counters not available (see /proc/sys/kernel/perf_event_paranoid)\n");
+    printf("{\n  \"timer_overhead_ns\": %lu,\n  \"runs\": [", timerOverhead());
+    for (k = 0; k < nFiles; k++)
+    {
+        ptRecord record;
+        if (!ptRecordLoad(&record, files[k], 360))
+        {
+            fprintf(stderr, "can't read %s\n", files[k]);
+            return 1;
+        }
+        benchRecord(files[k], &record, files[k], repeats, modes, &first);
+        ptRecordFree(&record);
+    }
+    for (k = 0; k < nSynths; k++)
+    {
+        ptRecord record;
+        char name[64], path[] = "/tmp/ptBenchInXXXXXX";
+        long unsigned int n = strtoul(synths[k], NULL, 10);
+        const char *fs = strchr(synths[k], ':');
+        int fd;
+
+        if (!ptRecordSynth(&record, n, fs ? atoi(fs + 1) : 360, seed))
+        {
+            fprintf(stderr, "out of memory for %lu samples\n", n);
+            return 1;
+        }
+        snprintf(name, sizeof(name), "synthetic:%lu:%d:%u", record.n, record.fs, seed);
+
+        // The text modes need the record on a file.
+        fd = mkstemp(path);
+        if (fd < 0 || (close(fd), !ptRecordSave(&record, path)))
+        {
+            fprintf(stderr, "can't write %s\n", path);
+            return 1;
+        }
+        benchRecord(name, &record, path, repeats, modes, &first);
+        remove(path);
+        ptRecordFree(&record);
+    }
+    printf("\n  ]\n}\n");
+    ptPerfClose(&perf);
+
+    return 0;
+}
@@ -0,0 +1,340 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsCache.c                                                      *
+ *       Result cache for ptDetect                                               *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * On-disk cache of detection results for ptDetect. A result (the beats found on *
+ * a record) is kept under a key made of a hash of the record's content and a    *
+ * hash of every detector parameter, the signal read and PT_ENGINE_VERSION, so   *
+ * running the same record with the same parameters again only costs hashing it. *
+ * Any output format is written again from the cached beats. The cache stays     *
+ * under a given size by deleting the least recently used results, and counts    *
+ * its hits, misses, stores and evictions.                                       *
+ *-------------------------------------------------------------------------------*
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "panTompkinsCache.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PT_CACHE_VERSION 1
+
+// Hex digits of a key.
+#define PT_KEY 32
+
+void ptResultInit(ptResult *result)
+{
+    memset(result, 0, sizeof(ptResult));
+}
+
+/*
+    Adds a beat, reported at sample found, at sample position. Returns false when out of memory.
+*/
+bool ptResultAdd(ptResult *result, long unsigned int found, long unsigned int position)
+{
+    if (result->count == result->capacity)
+    {
+        long unsigned int capacity = result->capacity ? 2*result->capacity : 1024;
+        long unsigned int *f = realloc(result->found, capacity*sizeof(long unsigned int));
+        long unsigned int *p = f ? realloc(result->position, capacity*sizeof(long unsigned int)) : NULL;
+
+        if (f)
+            result->found = f;
+        if (!p)
+            return false;
+        result->position = p;
+        result->capacity = capacity;
+    }
+    result->found[result->count] = found;
+    result->position[result->count++] = position;
+
+    return true;
+}
+
+void ptResultFree(ptResult *result)
+{
+    free(result->found);
+    free(result->position);
+    ptResultInit(result);
+}
+
+/*
+    Uses dir as the cache (it's created if needed), holding up to size bytes of results.
+*/
+bool ptCacheOpen(ptCache *cache, const char dir[], long unsigned int size)
+{
+    if (strlen(dir) + sizeof(ptCacheKey) + 16 > sizeof(cache->dir))
+        return false;
+    if (mkdir(dir, 0777) && errno != EEXIST)
+        return false;
+    strcpy(cache->dir, dir);
+    cache->size = size;
+    cache->hits = cache->misses = cache->stores = cache->evictions = 0;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return true;
+}
+
+void ptCacheClose(ptCache *cache)
+{
+    pthread_mutex_destroy(&cache->lock);
+}
+
+static long unsigned int fnv(const char text[], long unsigned int hash)
+{
+    for (; *text; text++)
+        hash = (hash ^ (unsigned char)*text)*1099511628211ul;
+
+    return hash;
+}
+
+/*
+    The key of a record processed with config: its content (see ptHashRecord()) plus every parameter
+    that changes the result, the signal read, the version of the detection logic and the width of the
+    filter samples. The output format isn't part of it: any of them is written from the same result.
+*/
+bool ptCacheKeyOf(const char path[], ptInputFormat format, int channel, const ptConfig *config, ptCacheKey key)
+{
+    char parameters[256];
+    long unsigned int content;
+
+    if (!ptHashRecord(path, format, channel, &content))
+        return false;
+    snprintf(parameters, sizeof(parameters), "%d %d %d %d %d %d %a %a %a %a %d %d %d %d", config->fs,
+             config->windowSize, config->bufferSize, config->delay, config->refractory, config->slopeWindow,
+             config->signalWeight, config->noiseWeight, config->thresholdRatio, config->searchWeight, format,
+             channel, PT_ENGINE_VERSION, (int)sizeof(ptSample));
+    snprintf(key, sizeof(ptCacheKey), "%016lx%016lx", content, fnv(parameters, 14695981039346656037ul));
+
+    return true;
+}
+
+static void path(const ptCache *cache, const ptCacheKey key, char file[])
+{
+    sprintf(file, "%s/%s.beats", cache->dir, key);
+}
+
+// Results are stored as LEB128 varints: the gaps between beats and how far back each one was found.
+static unsigned char *putVarint(unsigned char *p, long unsigned int v)
+{
+    do
+    {
+        *p++ = (v & 0x7F) | (v > 0x7F ? 0x80 : 0);
+        v >>= 7;
+    }
+    while (v);
+
+    return p;
+}
+
+static const unsigned char *getVarint(const unsigned char *p, const unsigned char *end, long unsigned int *v)
+{
+    int shift = 0;
+
+    *v = 0;
+    for (; p < end && shift < 64; shift += 7)
+    {
+        *v |= (long unsigned int)(*p & 0x7F) << shift;
+        if (!(*p++ & 0x80))
+            return p;
+    }
+
+    return NULL;
+}
+
+/*
+    Looks a result up. On a hit, the file is touched so it's the last to be evicted.
+*/
+bool ptCacheGet(ptCache *cache, const ptCacheKey key, ptResult *result)
+{
+    char file[sizeof(cache->dir) + 64];
+    unsigned char *data = NULL;
+    const unsigned char *p, *end;
+    long unsigned int count = 0, found = 0, gap, back, k;
+    struct stat st;
+    bool hit = false;
+    int fd;
+
+    ptResultInit(result);
+    path(cache, key, file);
+    if ((fd = open(file, O_RDONLY)) >= 0)
+    {
+        if (!fstat(fd, &st) && st.st_size > 5 && (data = malloc(st.st_size)) && read(fd, data, st.st_size) == st.st_size)
+        {
+            p = data + 5;
+            end = data + st.st_size;
+            hit = !memcmp(data, "PTRC", 4) && data[4] == PT_CACHE_VERSION;
+            hit = hit && (p = getVarint(p, end, &result->samples)) && (p = getVarint(p, end, &count));
+            for (k = 0; hit && k < count; k++)
+            {
+                hit = (p = getVarint(p, end, &gap)) && (p = getVarint(p, end, &back));
+                found += gap;
+                hit = hit && back <= found && ptResultAdd(result, found, found - back);
+            }
+            hit = hit && p == end;
+        }
+        free(data);
+        close(fd);
+    }
+    if (hit)
+        utimensat(AT_FDCWD, file, NULL, 0);
+    else
+        ptResultFree(result);
+
+    pthread_mutex_lock(&cache->lock);
+    if (hit)
+        cache->hits++;
+    else
+        cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+    return hit;
+}
+
+typedef struct
+{
+    char name[sizeof(ptCacheKey) + 16];
+    long unsigned int size;
+    struct timespec used;
+} entry;
+
+static int older(const void *a, const void *b)
+{
+    const struct timespec *x = &((const entry *)a)->used, *y = &((const entry *)b)->used;
+
+    if (x->tv_sec != y->tv_sec)
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    return x->tv_nsec < y->tv_nsec ? -1 : (x->tv_nsec > y->tv_nsec);
+}
+
+/*
+    Deletes the least recently used results until the cache fits its size. Called with the lock held.
+*/
+static void evict(ptCache *cache)
+{
+    char file[sizeof(cache->dir) + 64];
+    entry *entries = NULL, *more;
+    long unsigned int count = 0, capacity = 0, total = 0, k;
+    struct dirent *e;
+    struct stat st;
+    DIR *dir = opendir(cache->dir);
+
+    if (!dir)
+        return;
+    while ((e = readdir(dir)))
+    {
+        size_t length = strlen(e->d_name);
+
+        if (length != PT_KEY + 6 || strcmp(e->d_name + length - 6, ".beats"))
+            continue;
+        snprintf(file, sizeof(file), "%s/%s", cache->dir, e->d_name);
+        if (stat(file, &st))
+            continue;
+        if (count == capacity)
+        {
+            capacity = capacity ? 2*capacity : 256;
+            if (!(more = realloc(entries, capacity*sizeof(entry))))
+                break;
+            entries = more;
+        }
+        strcpy(entries[count].name, e->d_name);
+        entries[count].size = st.st_size;
+        entries[count++].used = st.st_mtim;
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    if (total > cache->size)
+    {
+        qsort(entries, count, sizeof(entry), older);
+        for (k = 0; k < count && total > cache->size; k++)
+        {
+            snprintf(file, sizeof(file), "%s/%s", cache->dir, entries[k].name);
+            if (!unlink(file))
+            {
+                total -= entries[k].size;
+                cache->evictions++;
+            }
+        }
+    }
+    free(entries);
+}
+
+/*
+    Stores a result. It's written aside and renamed into place, so readers never see half a file.
+*/
+bool ptCachePut(ptCache *cache, const ptCacheKey key, const ptResult *result)
+{
+    char file[sizeof(cache->dir) + 64], temporary[sizeof(cache->dir) + 64];
+    unsigned char *data = malloc(32 + 20*result->count), *p;
+    long unsigned int k, previous = 0;
+    bool ok;
+    int fd;
+
+    if (!data)
+        return false;
+    memcpy(data, "PTRC", 4);
+    data[4] = PT_CACHE_VERSION;
+    p = putVarint(data + 5, result->samples);
+    p = putVarint(p, result->count);
+    for (k = 0; k < result->count; k++)
+    {
+        p = putVarint(p, result->found[k] - previous);
+        p = putVarint(p, result->found[k] - result->position[k]);
+        previous = result->found[k];
+    }
+
+    path(cache, key, file);
+    snprintf(temporary, sizeof(temporary), "%s/%s.XXXXXX", cache->dir, key);
+    ok = (fd = mkstemp(temporary)) >= 0 && !fchmod(fd, 0644);
+    ok = ok && write(fd, data, p - data) == p - data;
+    if (fd >= 0)
+        ok = !close(fd) && ok;
+    ok = ok && !rename(temporary, file);
+    if (!ok && fd >= 0)
+        unlink(temporary);
+    free(data);
+
+    pthread_mutex_lock(&cache->lock);
+    if (ok)
+    {
+        cache->stores++;
+        evict(cache);
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return ok;
+}
@@ -0,0 +1,75 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsCache.h                                                      *
+ *       Header for panTompkinsCache.c                                           *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ */
+
+#ifndef PAN_TOMPKINS_CACHE
+#define PAN_TOMPKINS_CACHE
+
+#include "panTompkinsIO.h"
+#include <pthread.h>
+
+/*
+    What a run of the detector found: for each beat, the sample at which the detector reported it
+    and its position (earlier, if it came from the back search). That's enough to write any output
+    format again without running the detector.
+*/
+typedef struct
+{
+    long unsigned int *found, *position;
+    long unsigned int count, capacity;
+    long unsigned int samples;      // Length of the record.
+} ptResult;
+
+/*
+    An on-disk cache of results, one file per record and parameter set, kept under size bytes by
+    evicting the least recently used files. Safe to share between threads.
+*/
+typedef struct
+{
+    char dir[4096];
+    long unsigned int size;
+    pthread_mutex_t lock;
+    long unsigned int hits, misses, stores, evictions;
+} ptCache;
+
+// Name of a result on the cache: a hash of the record's content and one of the parameters.
+typedef char ptCacheKey[40];
+
+bool ptCacheOpen(ptCache *cache, const char dir[], long unsigned int size);
+void ptCacheClose(ptCache *cache);
+bool ptCacheKeyOf(const char path[], ptInputFormat format, int channel, const ptConfig *config, ptCacheKey key);
+bool ptCacheGet(ptCache *cache, const ptCacheKey key, ptResult *result);
+bool ptCachePut(ptCache *cache, const ptCacheKey key, const ptResult *result);
+
+void ptResultInit(ptResult *result);
+bool ptResultAdd(ptResult *result, long unsigned int found, long unsigned int position);
+void ptResultFree(ptResult *result);
+
+#endif
@@ -0,0 +1,745 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsDetect.c                                                     *
+ *       Pan-Tompkins command-line driver                                        *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Command-line driver for the streaming detector (ptFilter, ptDecision) on      *
+ * records of any length: reads text, binary, WFDB or EDF records (see           *
+ * panTompkinsIO) from files or the standard input, writes the beats in one of   *
+ * several formats, takes the sampling frequency and every detector parameter    *
+ * from the command line, processes many files in parallel, only processes what  *
+ * was appended to a record since the last run (--incremental), reuses earlier   *
+ * results of the same record and parameters (--cache) and reports throughput,   *
+ * e.g.:                                                                         *
+ * ptDetect -O annotations -j 8 -s -o results/ mitdb/1*.hea                      *
+ *                                                                               *
+ * Build from the repository root:                                               *
+ * gcc -O2 -pthread -I. -Itools tools/panTompkinsDetect.c tools/panTompkinsIO.c \*
+ *     tools/panTompkinsCache.c panTompkinsCore.c panTompkinsCheckpoint.c \      *
+ *     -o ptDetect                                                               *
+ *-------------------------------------------------------------------------------*
+ */
+
+#define _GNU_SOURCE
+
+#include "panTompkinsCheckpoint.h"
+#include "panTompkinsCache.h"
+#include "panTompkinsIO.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Samples read from the input at a time.
+#define PT_BLOCK 4096
+
+/*
+    Everything the command line sets. The detector parameters stay negative unless given, so each record
+    gets the defaults for its own sampling frequency.
+*/
+typedef struct
+{
+    ptInputFormat inputFormat;
+    ptOutputFormat outputFormat;
+    bool guessFormat, stats, follow, incremental;
+    const char *output;
+    bool directory;             // output is a directory: one output file per input there.
+    int fs, channel, threads;
+    double latency;             // Output flush latency, in seconds.
+    ptConfig overrides;
+    ptCache *cache;             // Result cache, or NULL.
+
+    char **inputs;
+    int count;
+} options;
+
+/*
+    What happened to each input, for --stats.
+*/
+typedef struct
+{
+    long unsigned int samples, beats;
+    long unsigned int resumed;  // Sample an incremental run resumed from (0 if it started over).
+    double seconds;
+    int fs;
+    bool failed, cached;
+} result;
+
+/*
+    What an incremental run leaves next to its output, on <output>.state: how far into the input it
+    got, a hash of the input up to there, the size of the output before the final flush and the state
+    of the detector and the writer at that point, along with the output format and the writer's shift,
+    since the output written so far is only good for those.
+*/
+typedef struct
+{
+    long unsigned int offset, hash, outputSize, last, beats;
+    long unsigned int format, shift;
+    long unsigned int size;
+    unsigned char checkpoint[PT_CHECKPOINT_MAX];
+} resumeState;
+
+#define PT_STATE_VERSION 2
+
+// Written to on SIGINT or SIGTERM, to end follow mode cleanly.
+static int stopPipe[2] = {-1, -1};
+
+static void stop(int signal)
+{
+    ssize_t ignored = write(stopPipe[1], "", 1);
+    (void)ignored;
+    (void)signal;
+}
+
+typedef struct
+{
+    const options *options;
+    result *results;
+    pthread_mutex_t lock;
+    int next;
+} job;
+
+static double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+static const char *suffix(ptOutputFormat format)
+{
+    static const char *suffixes[] = {".out", ".beats", ".rr", ".ann"};
+    return suffixes[format];
+}
+
+/*
+    Picks where the output of an input goes: the -o file (or standard output) when there's a single
+    input, otherwise the input's name, without its extension, plus a suffix for the format, next to the
+    input or on the -o directory.
+*/
+static void outputPath(const options *o, const char input[], char path[], size_t size)
+{
+    const char *name = strrchr(input, '/'), *dot;
+    size_t length;
+
+    if (o->output && !o->directory)
+    {
+        snprintf(path, size, "%s", o->output);
+        return;
+    }
+    if (!o->output && (o->count == 1 || !strcmp(input, "-")))
+    {
+        snprintf(path, size, "-");
+        return;
+    }
+    name = name ? name + 1 : input;
+    dot = strrchr(name, '.');
+    length = dot ? (size_t)(dot - name) : strlen(name);
+    if (o->output)
+        snprintf(path, size, "%s/%.*s%s", o->output, (int)length, name, suffix(o->outputFormat));
+    else
+        snprintf(path, size, "%.*s%s", (int)(name - input + length), input, suffix(o->outputFormat));
+}
+
+/*
+    Builds the configuration of a record: the defaults for its sampling frequency with whatever the
+    command line set on top.
+*/
+static bool configure(const options *o, int fs, ptConfig *config)
+{
+    const ptConfig *set = &o->overrides;
+
+    ptDefaultConfig(config, fs);
+    if (set->windowSize > 0)
+        config->windowSize = set->windowSize;
+    if (set->bufferSize > 0)
+        config->bufferSize = set->bufferSize;
+    if (set->delay >= 0)
+        config->delay = set->delay;
+    if (set->refractory >= 0)
+        config->refractory = set->refractory;
+    if (set->slopeWindow >= 0)
+        config->slopeWindow = set->slopeWindow;
+    if (set->signalWeight >= 0)
+        config->signalWeight = set->signalWeight;
+    if (set->noiseWeight >= 0)
+        config->noiseWeight = set->noiseWeight;
+    if (set->thresholdRatio >= 0)
+        config->thresholdRatio = set->thresholdRatio;
+    if (set->searchWeight >= 0)
+        config->searchWeight = set->searchWeight;
+
+    return config->windowSize > 0 && config->windowSize <= PT_MAXWINDOW && config->bufferSize > config->delay + 1
+        && config->bufferSize <= PT_HISTORY;
+}
+
+static void putWord(FILE *f, long unsigned int v)
+{
+    int k;
+
+    for (k = 0; k < 8; k++)
+        putc((v >> 8*k) & 0xFF, f);
+}
+
+static long unsigned int getWord(FILE *f)
+{
+    long unsigned int v = 0;
+    int k, c;
+
+    for (k = 0; k < 8 && (c = getc(f)) != EOF; k++)
+        v |= (long unsigned int)c << 8*k;
+
+    return v;
+}
+
+/*
+    Writes the state file of an incremental run. It's written aside and renamed over the old one, so
+    an interrupted run never leaves a half-written state behind.
+*/
+static bool saveState(const char path[], const resumeState *state)
+{
+    char temporary[4300];
+    FILE *f;
+    bool ok;
+
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    if (!(f = fopen(temporary, "wb")))
+        return false;
+    fputs("PTRS", f);
+    putc(PT_STATE_VERSION, f);
+    putWord(f, state->offset);
+    putWord(f, state->hash);
+    putWord(f, state->outputSize);
+    putWord(f, state->last);
+    putWord(f, state->beats);
+    putWord(f, state->format);
+    putWord(f, state->shift);
+    putWord(f, state->size);
+    fwrite(state->checkpoint, 1, state->size, f);
+    ok = !ferror(f);
+    ok = !fclose(f) && ok;
+
+    return ok && !rename(temporary, path);
+}
+
+static bool loadState(const char path[], resumeState *state)
+{
+    char magic[5] = "";
+    FILE *f = fopen(path, "rb");
+    bool ok;
+
+    if (!f)
+        return false;
+    ok = fread(magic, 1, 4, f) == 4 && !strcmp(magic, "PTRS") && getc(f) == PT_STATE_VERSION;
+    state->offset = getWord(f);
+    state->hash = getWord(f);
+    state->outputSize = getWord(f);
+    state->last = getWord(f);
+    state->beats = getWord(f);
+    state->format = getWord(f);
+    state->shift = getWord(f);
+    state->size = getWord(f);
+    ok = ok && state->size <= PT_CHECKPOINT_MAX && fread(state->checkpoint, 1, state->size, f) == state->size;
+    fclose(f);
+
+    return ok;
+}
+
+/*
+    Picks up an incremental run where the last one stopped, if the input still starts with exactly what
+    was read then and neither the parameters nor the output format changed. On success, the reader is
+    past the samples already processed, the detector and the writer continue from their saved state and
+    the output is cut back to what it was before the last run's final flush.
+*/
+static bool resume(const char input[], const char statePath[], const ptConfig *config, ptReader *reader, ptFilter *filter, ptDecision *decision, ptWriter *writer)
+{
+    resumeState state;
+    ptConfig saved;
+    ptDecision d;
+    long unsigned int hash;
+
+    if (!loadState(statePath, &state) || state.format != (long unsigned int)writer->format
+        || state.shift != (long unsigned int)writer->shift || !ptHashPrefix(input, state.offset, &hash) || hash != state.hash)
+        return false;
+    if (!ptCheckpointLoad(state.checkpoint, state.size, &saved, filter, &d, &writer->framer))
+        return false;
+    if (memcmp(&saved, config, sizeof(ptConfig)) || !ptReaderSeek(reader, state.offset))
+        return false;
+    if (ftruncate(writer->fd, state.outputSize) || lseek(writer->fd, 0, SEEK_END) < 0)
+        return false;
+    *decision = d;
+    writer->last = state.last;
+    writer->beats = state.beats;
+
+    return true;
+}
+
+/*
+    Runs the detector over one input. filter is scratch space for the filter chain, too big for the stack
+    of a worker thread.
+*/
+static void detect(const options *o, const char input[], ptFilter *filter, result *r)
+{
+    dataType x[PT_BLOCK];
+    char path[4096], statePath[4200];
+    ptCacheKey key;
+    ptResult found;
+    ptReader reader;
+    ptWriter writer;
+    ptDecision decision;
+    ptHistory history;
+    ptConfig config;
+    ptInputFormat format = o->guessFormat ? ptGuessFormat(input) : o->inputFormat;
+    long unsigned int position, k;
+    long int n = 0, i;
+    int out;
+    double start = now(), idle;
+    bool qrs;
+
+    memset(r, 0, sizeof(result));
+    r->failed = true;
+    if (!ptReaderOpen(&reader, input, format, o->channel) || (o->follow && !ptReaderFollow(&reader, input, stopPipe[0])))
+    {
+        fprintf(stderr, "%s: %s\n", input, reader.error);
+        return;
+    }
+    r->fs = o->fs > 0 ? o->fs : (reader.fs > 0 ? reader.fs : 360);
+    if (!configure(o, r->fs, &config))
+    {
+        fprintf(stderr, "%s: bad parameters: the window must be up to %d samples, the buffer longer than the "
+                "delay and up to %d samples\n", input, PT_MAXWINDOW, PT_HISTORY);
+        ptReaderClose(&reader);
+        return;
+    }
+
+    outputPath(o, input, path, sizeof(path));
+    if (o->incremental && (!strcmp(path, "-") || !strcmp(input, "-") || (format != PT_TEXT && format != PT_BINARY)))
+    {
+        fprintf(stderr, "%s: incremental runs need text or binary input and output files\n", input);
+        ptReaderClose(&reader);
+        return;
+    }
+    snprintf(statePath, sizeof(statePath), "%s.state", path);
+    reader.holdLast = o->incremental;
+    if (!strcmp(path, "-"))
+        out = STDOUT_FILENO;
+    else if ((out = open(path, O_WRONLY | O_CREAT | (o->incremental ? 0 : O_TRUNC), 0666)) < 0)
+    {
+        fprintf(stderr, "%s: can't write %s\n", input, path);
+        ptReaderClose(&reader);
+        return;
+    }
+
+    ptFilterInit(filter, &config);
+    ptFilterHistory(filter, &history);
+    ptDecisionInit(&decision);
+    if (!ptWriterInit(&writer, out, o->outputFormat, &config, o->latency))
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    ptResultInit(&found);
+    if (o->cache && ptCacheKeyOf(input, format, o->channel, &config, key) && ptCacheGet(o->cache, key, &found))
+    {
+        // A hit: the beats are known, only the output has to be written.
+        for (position = k = 0; position < found.samples; position++)
+        {
+            qrs = k < found.count && found.found[k] == position;
+            ptWriterStep(&writer, qrs, qrs ? found.position[k++] : 0);
+        }
+        r->samples = found.samples;
+        r->beats = found.count;
+        r->cached = true;
+        ptResultFree(&found);
+    }
+    if (o->incremental)
+    {
+        if (resume(input, statePath, &config, &reader, filter, &decision, &writer))
+            r->resumed = decision.sample;
+        else
+        {
+            // Something changed: start over.
+            ptFilterInit(filter, &config);
+            ptDecisionInit(&decision);
+            ptFramerInit(&writer.framer, &config);
+            writer.last = writer.beats = 0;
+            ptReaderSeek(&reader, 0);
+            if (ftruncate(out, 0))
+                fprintf(stderr, "%s: can't truncate %s\n", input, path);
+        }
+        ptFilterHistory(filter, &history);
+    }
+    while (!r->cached)
+    {
+        // While the input is idle, the lines already found go out once they're due.
+        if ((idle = ptWriterIdle(&writer)) >= 0 && !ptReaderWait(&reader, idle))
+        {
+            ptWriterFlush(&writer);
+            continue;
+        }
+        if ((n = ptReaderRead(&reader, x, PT_BLOCK)) <= 0)
+            break;
+        for (i = 0; i < n; i++)
+        {
+            ptFilterStep(filter, x[i]);
+            qrs = ptDecisionStep(&decision, &config, &history, &position);
+            ptWriterStep(&writer, qrs, position);
+            if (qrs)
+            {
+                r->beats++;
+                if (o->cache && !ptResultAdd(&found, decision.sample - 1, position))
+                {
+                    fprintf(stderr, "out of memory\n");
+                    exit(1);
+                }
+            }
+        }
+        r->samples += n;
+        ptWriterPoll(&writer);
+    }
+
+    // The state is taken before the final flush, which is written again (and longer) on the next run.
+    if (o->incremental && n == 0 && ptWriterFlush(&writer))
+    {
+        resumeState state;
+        off_t size = lseek(out, 0, SEEK_CUR);
+
+        state.offset = reader.consumed;
+        state.outputSize = size;
+        state.last = writer.last;
+        state.beats = writer.beats;
+        state.format = writer.format;
+        state.shift = writer.shift;
+        state.size = ptCheckpointSave(&config, filter, &decision, &writer.framer, state.checkpoint, sizeof(state.checkpoint));
+        if (size < 0 || !ptHashPrefix(input, state.offset, &state.hash) || !saveState(statePath, &state))
+            fprintf(stderr, "%s: can't save the state on %s\n", input, statePath);
+    }
+
+    if (o->cache && !r->cached && n == 0)
+    {
+        found.samples = decision.sample;
+        ptCachePut(o->cache, key, &found);
+    }
+    ptResultFree(&found);
+
+    if (!ptWriterFinish(&writer))
+        fprintf(stderr, "%s: write error on %s\n", input, path);
+    else if (n < 0)
+        fprintf(stderr, "%s: read error\n", input);
+    else
+        r->failed = false;
+    if (out != STDOUT_FILENO)
+        close(out);
+    ptReaderClose(&reader);
+    r->seconds = now() - start;
+}
+
+/*
+    A worker of the batch mode: takes the next input nobody took yet, until there's none left.
+*/
+static void *worker(void *context)
+{
+    job *j = context;
+    ptFilter *filter = malloc(sizeof(ptFilter));
+    int k;
+
+    if (!filter)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (;;)
+    {
+        pthread_mutex_lock(&j->lock);
+        k = j->next++;
+        pthread_mutex_unlock(&j->lock);
+        if (k >= j->options->count)
+            break;
+        detect(j->options, j->options->inputs[k], filter, &j->results[k]);
+    }
+    free(filter);
+
+    return NULL;
+}
+
+static void usage(const char program[])
+{
+    fprintf(stderr,
+            "usage: %s [options] input... (- for standard input)\n"
+            "  -I, --input-format F    text, binary (16-bit little-endian), wfdb or edf; guessed from the\n"
+            "                          extension otherwise (.hea/.dat, .edf, .bin/.raw, anything else is text)\n"
+            "  -O, --output-format F   dense (0/1 per sample, as panTompkins()), sparse (beat sample numbers),\n"
+            "                          rr (intervals in ms) or annotations (rdann-like lines) (dense)\n"
+            "  -o, --output PATH       output file, - for standard output, or a directory with several inputs\n"
+            "                          (standard output for one input, otherwise next to each input)\n"
+            "  -f, --fs HZ             sampling frequency (from the header, otherwise 360)\n"
+            "  -c, --channel N         signal of a WFDB or EDF record (0)\n"
+            "  -j, --threads N         inputs processed in parallel (1)\n"
+            "  -s, --stats             prints samples, beats and throughput to stderr\n"
+            "  -F, --follow            keeps reading text or binary files as they grow, like tail -f, until\n"
+            "                          they're deleted or renamed, or on SIGINT/SIGTERM\n"
+            "  -i, --incremental       keeps the detector state next to each output (as .state) and, on the\n"
+            "                          next run, only processes what was appended to the input since\n"
+            "  --cache DIR             keeps the beats found for each record and parameter set on DIR and\n"
+            "                          reuses them when the same record is run again with the same parameters\n"
+            "  --cache-size MB         evicts the least recently used results past this size (1024)\n"
+            "  -l, --latency MS        longest a line waits before it's written, -1 for full blocks only (100)\n"
+            "  --window N              integrator window, in samples (%d max)\n"
+            "  --buffer N              back search buffer, in samples (%d max)\n"
+            "  --delay N               filter delay, in samples\n"
+            "  --refractory N          hard latency after a beat, in samples\n"
+            "  --slope-window N        soft latency where the slope is checked, in samples\n"
+            "  --signal-weight W       weight of a new signal peak (0.125)\n"
+            "  --noise-weight W        weight of a new noise peak (0.125)\n"
+            "  --threshold-ratio R     threshold position between noise and signal levels (0.25)\n"
+            "  --search-weight W       weight of a peak found by the back search (0.25)\n",
+            program, PT_MAXWINDOW, PT_HISTORY);
+    exit(1);
+}
+
+static const struct option longOptions[] =
+{
+    {"input-format", required_argument, NULL, 'I'},
+    {"output-format", required_argument, NULL, 'O'},
+    {"output", required_argument, NULL, 'o'},
+    {"fs", required_argument, NULL, 'f'},
+    {"channel", required_argument, NULL, 'c'},
+    {"threads", required_argument, NULL, 'j'},
+    {"stats", no_argument, NULL, 's'},
+    {"latency", required_argument, NULL, 'l'},
+    {"follow", no_argument, NULL, 'F'},
+    {"incremental", no_argument, NULL, 'i'},
+    {"window", required_argument, NULL, 1},
+    {"buffer", required_argument, NULL, 2},
+    {"delay", required_argument, NULL, 3},
+    {"refractory", required_argument, NULL, 4},
+    {"slope-window", required_argument, NULL, 5},
+    {"signal-weight", required_argument, NULL, 6},
+    {"noise-weight", required_argument, NULL, 7},
+    {"threshold-ratio", required_argument, NULL, 8},
+    {"search-weight", required_argument, NULL, 9},
+    {"cache", required_argument, NULL, 10},
+    {"cache-size", required_argument, NULL, 11},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
+static void parse(int argc, char *argv[], options *o)
+{
+    static const char *inputs[] = {"text", "binary", "wfdb", "edf"};
+    static const char *outputs[] = {"dense", "sparse", "rr", "annotations"};
+    ptConfig *set = &o->overrides;
+    static ptCache cache;
+    const char *cacheDir = NULL;
+    double cacheSize = 1024;
+    struct stat st;
+    int opt, k;
+
+    memset(o, 0, sizeof(options));
+    o->guessFormat = true;
+    o->outputFormat = PT_DENSE;
+    o->threads = 1;
+    o->latency = 0.1;
+    set->windowSize = set->bufferSize = 0;
+    set->delay = set->refractory = set->slopeWindow = -1;
+    set->signalWeight = set->noiseWeight = set->thresholdRatio = set->searchWeight = -1;
+
+    while ((opt = getopt_long(argc, argv, "I:O:o:f:c:j:sl:Fih", longOptions, NULL)) != -1)
+    {
+        if (opt == 'I')
+        {
+            for (k = 0; k < 4 && strcmp(optarg, inputs[k]); k++);
+            if (k == 4)
+                usage(argv[0]);
+            o->inputFormat = k;
+            o->guessFormat = false;
+        }
+        else if (opt == 'O')
+        {
+            for (k = 0; k < 4 && strcmp(optarg, outputs[k]); k++);
+            if (k == 4)
+                usage(argv[0]);
+            o->outputFormat = k;
+        }
+        else if (opt == 'o')
+            o->output = optarg;
+        else if (opt == 'f')
+            o->fs = atoi(optarg);
+        else if (opt == 'c')
+            o->channel = atoi(optarg);
+        else if (opt == 'j')
+            o->threads = atoi(optarg);
+        else if (opt == 's')
+            o->stats = true;
+        else if (opt == 'F')
+            o->follow = true;
+        else if (opt == 'i')
+            o->incremental = true;
+        else if (opt == 'l')
+            o->latency = atof(optarg) < 0 ? -1 : atof(optarg)/1000;
+        else if (opt == 1)
+            set->windowSize = atoi(optarg);
+        else if (opt == 2)
+            set->bufferSize = atoi(optarg);
+        else if (opt == 3)
+            set->delay = atoi(optarg);
+        else if (opt == 4)
+            set->refractory = atoi(optarg);
+        else if (opt == 5)
+            set->slopeWindow = atoi(optarg);
+        else if (opt == 6)
+            set->signalWeight = atof(optarg);
+        else if (opt == 7)
+            set->noiseWeight = atof(optarg);
+        else if (opt == 8)
+            set->thresholdRatio = atof(optarg);
+        else if (opt == 9)
+            set->searchWeight = atof(optarg);
+        else if (opt == 10)
+            cacheDir = optarg;
+        else if (opt == 11)
+            cacheSize = atof(optarg);
+        else
+            usage(argv[0]);
+    }
+    o->inputs = argv + optind;
+    o->count = argc - optind;
+    if (o->count < 1 || o->threads < 1 || o->channel < 0 || o->fs < 0 || (o->follow && o->incremental))
+        usage(argv[0]);
+    if (cacheDir && (o->follow || o->incremental))
+    {
+        fprintf(stderr, "the cache can't be used with --follow or --incremental\n");
+        exit(1);
+    }
+    if (cacheDir)
+    {
+        if (!ptCacheOpen(&cache, cacheDir, (long unsigned int)(cacheSize*1048576)))
+        {
+            fprintf(stderr, "can't use %s as a cache\n", cacheDir);
+            exit(1);
+        }
+        o->cache = &cache;
+    }
+    o->directory = o->output && !stat(o->output, &st) && S_ISDIR(st.st_mode);
+    if (o->count > 1 && o->output && !o->directory && strcmp(o->output, "-"))
+    {
+        fprintf(stderr, "%s is not a directory: several inputs need one output each\n", o->output);
+        exit(1);
+    }
+    if (o->count > 1 && o->output && !strcmp(o->output, "-"))
+    {
+        fprintf(stderr, "several inputs can't share the standard output\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    options o;
+    job j;
+    pthread_t *threads;
+    long unsigned int samples = 0, beats = 0;
+    double start, seconds;
+    int k, failed = 0;
+
+    parse(argc, argv, &o);
+    if (o.follow)
+    {
+        struct sigaction action;
+
+        // Every followed file needs its own thread, since none of them ends on its own.
+        o.threads = o.count;
+        if (pipe(stopPipe))
+        {
+            fprintf(stderr, "can't create a pipe\n");
+            return 1;
+        }
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = stop;
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+    }
+    if (o.threads > o.count)
+        o.threads = o.count;
+    j.options = &o;
+    j.next = 0;
+    j.results = calloc(o.count, sizeof(result));
+    threads = malloc(o.threads*sizeof(pthread_t));
+    if (!j.results || !threads)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    pthread_mutex_init(&j.lock, NULL);
+
+    start = now();
+    for (k = 1; k < o.threads; k++)
+        if (pthread_create(&threads[k], NULL, worker, &j))
+        {
+            fprintf(stderr, "can't start thread %d\n", k);
+            return 1;
+        }
+    worker(&j);
+    for (k = 1; k < o.threads; k++)
+        pthread_join(threads[k], NULL);
+    seconds = now() - start;
+
+    for (k = 0; k < o.count; k++)
+    {
+        const result *r = &j.results[k];
+
+        failed += r->failed;
+        samples += r->samples;
+        beats += r->beats;
+        if (o.stats && !r->failed)
+            fprintf(stderr, "%s: %lu samples at %d Hz%s, %lu beats, %.3f s, %.2f Msamples/s\n", o.inputs[k],
+                    r->samples, r->fs, r->resumed ? " (appended)" : (r->cached ? " (cached)" : ""), r->beats, r->seconds,
+                    r->samples/(r->seconds*1e6));
+    }
+    if (o.stats && o.count > 1)
+        fprintf(stderr, "total: %d files, %lu samples, %lu beats, %.3f s on %d threads, %.2f Msamples/s\n",
+                o.count - failed, samples, beats, seconds, o.threads, samples/(seconds*1e6));
+
+    if (o.stats && o.cache)
+        fprintf(stderr, "cache: %lu hits, %lu misses, %lu stored, %lu evicted\n", o.cache->hits, o.cache->misses,
+                o.cache->stores, o.cache->evictions);
+    if (o.cache)
+        ptCacheClose(o.cache);
+    pthread_mutex_destroy(&j.lock);
+    free(j.results);
+    free(threads);
+
+    return failed ? 1 : 0;
+}
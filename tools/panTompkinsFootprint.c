@@ -0,0 +1,377 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsFootprint.c                                                  *
+ *       Flash, RAM and stack needed by the microcontroller engine on its target *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Memory budget of the microcontroller engine, from the object file built for   *
+ * the target (or a firmware linked with it). It reports, as JSON: the size of   *
+ * every section that takes flash or RAM, the symbols the code needs from        *
+ * elsewhere (such as memset, or the compiler's division helpers on cores        *
+ * without a divider), the stack of every function from the .su file written by  *
+ * -fstack-usage, and the size of ptMcu as recorded on the object by ptMcuSize,  *
+ * so it matches the flags the object was built with.                            *
+ *                                                                               *
+ * The stack is bounded by adding every frame, since there's no recursion. Exits *
+ * with 1 if the RAM needed (static data, ptMcu and stack) is over the budget.   *
+ *-------------------------------------------------------------------------------*
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "panTompkinsMcu.h"
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The parts of a section and a symbol that matter here, whichever the ELF class.
+typedef struct
+{
+    const char *name;
+    long unsigned int type, flags, address, offset, size, link, entrySize;
+} section;
+
+typedef struct
+{
+    const char *name;
+    long unsigned int value;
+    unsigned int index;
+} symbol;
+
+typedef struct
+{
+    unsigned char *data;
+    long unsigned int size, sections, names;
+    bool wide, relocatable;
+    unsigned int machine;
+} object;
+
+// The stack usage of a function, from a .su file.
+typedef struct
+{
+    char name[128];
+    long unsigned int bytes;
+    bool bounded;
+} frame;
+
+static bool load(object *o, const char path[])
+{
+    FILE *f = fopen(path, "rb");
+    const unsigned char *id;
+
+    memset(o, 0, sizeof(object));
+    if (!f)
+        return false;
+    fseek(f, 0, SEEK_END);
+    o->size = ftell(f);
+    rewind(f);
+    o->data = malloc(o->size + 1);
+    if (!o->data || fread(o->data, 1, o->size, f) != o->size || o->size < sizeof(Elf32_Ehdr))
+    {
+        fclose(f);
+        return false;
+    }
+    fclose(f);
+
+    id = o->data;
+    if (memcmp(id, ELFMAG, SELFMAG) || id[EI_DATA] != ELFDATA2LSB || (id[EI_CLASS] != ELFCLASS32 && id[EI_CLASS] != ELFCLASS64))
+        return false;
+    o->wide = id[EI_CLASS] == ELFCLASS64;
+    if (o->wide)
+    {
+        Elf64_Ehdr h;
+
+        memcpy(&h, o->data, sizeof(h));
+        o->machine = h.e_machine;
+        o->relocatable = h.e_type == ET_REL;
+        o->sections = h.e_shnum;
+        o->names = h.e_shstrndx;
+        o->size = h.e_shoff + (long unsigned int)h.e_shnum*sizeof(Elf64_Shdr) <= o->size ? o->size : 0;
+    }
+    else
+    {
+        Elf32_Ehdr h;
+
+        memcpy(&h, o->data, sizeof(h));
+        o->machine = h.e_machine;
+        o->relocatable = h.e_type == ET_REL;
+        o->sections = h.e_shnum;
+        o->names = h.e_shstrndx;
+        o->size = h.e_shoff + (long unsigned int)h.e_shnum*sizeof(Elf32_Shdr) <= o->size ? o->size : 0;
+    }
+
+    return o->size != 0;
+}
+
+static section sectionAt(const object *o, long unsigned int k)
+{
+    section s;
+    long unsigned int nameOffset;
+
+    if (o->wide)
+    {
+        Elf64_Ehdr h;
+        Elf64_Shdr sh;
+
+        memcpy(&h, o->data, sizeof(h));
+        memcpy(&sh, o->data + h.e_shoff + k*sizeof(sh), sizeof(sh));
+        s.type = sh.sh_type;
+        s.flags = sh.sh_flags;
+        s.address = sh.sh_addr;
+        s.offset = sh.sh_offset;
+        s.size = sh.sh_size;
+        s.link = sh.sh_link;
+        s.entrySize = sh.sh_entsize;
+        nameOffset = sh.sh_name;
+    }
+    else
+    {
+        Elf32_Ehdr h;
+        Elf32_Shdr sh;
+
+        memcpy(&h, o->data, sizeof(h));
+        memcpy(&sh, o->data + h.e_shoff + k*sizeof(sh), sizeof(sh));
+        s.type = sh.sh_type;
+        s.flags = sh.sh_flags;
+        s.address = sh.sh_addr;
+        s.offset = sh.sh_offset;
+        s.size = sh.sh_size;
+        s.link = sh.sh_link;
+        s.entrySize = sh.sh_entsize;
+        nameOffset = sh.sh_name;
+    }
+    s.name = "";
+    if (k != o->names && o->names < o->sections)
+    {
+        section names = sectionAt(o, o->names);
+
+        if (names.offset + nameOffset < o->size)
+            s.name = (const char *)o->data + names.offset + nameOffset;
+    }
+
+    return s;
+}
+
+static symbol symbolAt(const object *o, const section *table, long unsigned int k)
+{
+    section strings = sectionAt(o, table->link);
+    long unsigned int nameOffset;
+    symbol y;
+
+    if (o->wide)
+    {
+        Elf64_Sym sym;
+
+        memcpy(&sym, o->data + table->offset + k*sizeof(sym), sizeof(sym));
+        nameOffset = sym.st_name;
+        y.value = sym.st_value;
+        y.index = sym.st_shndx;
+    }
+    else
+    {
+        Elf32_Sym sym;
+
+        memcpy(&sym, o->data + table->offset + k*sizeof(sym), sizeof(sym));
+        nameOffset = sym.st_name;
+        y.value = sym.st_value;
+        y.index = sym.st_shndx;
+    }
+    y.name = strings.offset + nameOffset < o->size ? (const char *)o->data + strings.offset + nameOffset : "";
+
+    return y;
+}
+
+static const char *machineName(unsigned int machine)
+{
+    switch (machine)
+    {
+        case EM_ARM: return "arm";
+        case EM_AARCH64: return "aarch64";
+        case EM_RISCV: return "riscv";
+        case EM_AVR: return "avr";
+        case EM_XTENSA: return "xtensa";
+        case EM_MSP430: return "msp430";
+        case EM_386: return "x86";
+        case EM_X86_64: return "x86-64";
+        default: return "other";
+    }
+}
+
+/*
+    Reads the frames of a .su file written by -fstack-usage: "file:line:column:function<TAB>bytes<TAB>
+    static|dynamic|dynamic,bounded". Returns how many were read.
+*/
+static int readFrames(const char path[], frame frames[], int capacity)
+{
+    FILE *f = fopen(path, "r");
+    char line[512], *name, *tab, qualifier[32];
+    int count = 0;
+
+    if (!f)
+        return -1;
+    while (count < capacity && fgets(line, sizeof(line), f))
+    {
+        if (!(tab = strchr(line, '\t')))
+            continue;
+        *tab = '\0';
+        name = strrchr(line, ':');
+        name = name ? name + 1 : line;
+        snprintf(frames[count].name, sizeof(frames[count].name), "%.127s", name);
+        if (sscanf(tab + 1, "%lu %31s", &frames[count].bytes, qualifier) != 2)
+            continue;
+        frames[count].bounded = strcmp(qualifier, "dynamic") != 0;
+        count++;
+    }
+    fclose(f);
+
+    return count;
+}
+
+static void usage(const char program[])
+{
+    fprintf(stderr,
+            "usage: %s [-b bytes] [-s stack.su] object.o\n"
+            "  -b  RAM budget: exits with 1 if the detector needs more (%d)\n"
+            "  -s  stack usage written by -fstack-usage (the object's name with .su by default)\n"
+            "The object is panTompkinsMcu.c built for the target, or a firmware linked with it.\n",
+            program, PT_MCU_RAM_BUDGET);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    static frame frames[256];
+    const char *path = NULL, *stackPath = NULL;
+    char suPath[512], *dot;
+    long unsigned int k, j, rom = 0, ram = 0, state = 0, stack = 0, budget = PT_MCU_RAM_BUDGET;
+    int count, f, opt, undefined = 0;
+    bool first = true, bounded = true;
+    object o;
+
+    while ((opt = getopt(argc, argv, "b:s:h")) != -1)
+    {
+        if (opt == 'b')
+            budget = strtoul(optarg, NULL, 10);
+        else if (opt == 's')
+            stackPath = optarg;
+        else
+            usage(argv[0]);
+    }
+    if (optind != argc - 1)
+        usage(argv[0]);
+    path = argv[optind];
+    if (!load(&o, path))
+    {
+        fprintf(stderr, "%s isn't a little endian ELF file\n", path);
+        return 1;
+    }
+
+    printf("{\n  \"object\": \"%s\",\n  \"machine\": \"%s\",\n  \"sections\": {", path, machineName(o.machine));
+    for (k = 1; k < o.sections; k++)
+    {
+        section s = sectionAt(&o, k);
+
+        if (!(s.flags & SHF_ALLOC) || !s.size)
+            continue;
+        // Code, constants and the initial values of variables are stored in flash; variables take RAM.
+        if (s.type != SHT_NOBITS)
+            rom += s.size;
+        if (s.flags & SHF_WRITE)
+            ram += s.size;
+        printf("%s\n    \"%s\": {\"bytes\": %lu, \"rom\": %s, \"ram\": %s}", first ? "" : ",", s.name, s.size,
+               s.type != SHT_NOBITS ? "true" : "false", s.flags & SHF_WRITE ? "true" : "false");
+        first = false;
+    }
+    printf("\n  },\n  \"undefined\": [");
+
+    // What the code needs from elsewhere (the C library, the compiler runtime), and the size of the
+    // state as ptMcuSize recorded it for the flags the object was built with.
+    for (k = 1; k < o.sections; k++)
+    {
+        section table = sectionAt(&o, k);
+
+        if (table.type != SHT_SYMTAB || !table.entrySize)
+            continue;
+        for (j = 1; j < table.size/table.entrySize; j++)
+        {
+            symbol y = symbolAt(&o, &table, j);
+
+            if (y.index == SHN_UNDEF && y.name[0])
+                printf("%s\"%s\"", undefined++ ? ", " : "", y.name);
+            else if (!strcmp(y.name, "ptMcuSize") && y.index < o.sections)
+            {
+                section s = sectionAt(&o, y.index);
+                long unsigned int at = s.offset + (o.relocatable ? y.value : y.value - s.address);
+                uint32_t size;
+
+                if (s.type != SHT_NOBITS && at + 4 <= o.size)
+                {
+                    memcpy(&size, o.data + at, 4);
+                    state = size;
+                }
+            }
+        }
+    }
+    printf("],\n  \"stack\": {");
+
+    // The call tree isn't known, so the stack is bounded by every frame at once (there's no recursion).
+    if (!stackPath)
+    {
+        snprintf(suPath, sizeof(suPath), "%s", path);
+        dot = strrchr(suPath, '.');
+        if (dot && !strchr(dot, '/'))
+            *dot = '\0';
+        strncat(suPath, ".su", sizeof(suPath) - strlen(suPath) - 1);
+        stackPath = suPath;
+    }
+    count = readFrames(stackPath, frames, 256);
+    for (f = 0; f < count; f++)
+    {
+        printf("%s\n    \"%s\": %lu", f ? "," : "", frames[f].name, frames[f].bytes);
+        stack += frames[f].bytes;
+        bounded = bounded && frames[f].bounded;
+    }
+    printf("%s},\n", count > 0 ? "\n  " : "");
+
+    printf("  \"rom_bytes\": %lu,\n  \"static_ram_bytes\": %lu,\n  \"state_bytes\": ", rom, ram);
+    if (state)
+        printf("%lu,\n", state);
+    else
+        printf("null,\n");
+    if (count >= 0 && bounded)
+        printf("  \"stack_bytes\": %lu,\n", stack);
+    else
+        printf("  \"stack_bytes\": null,\n");
+    printf("  \"ram_bytes\": %lu,\n  \"budget_bytes\": %lu,\n  \"fits\": %s\n}\n", ram + state + stack, budget,
+           state && ram + state + stack <= budget ? "true" : "false");
+    free(o.data);
+
+    return state && ram + state + stack <= budget ? 0 : 1;
+}
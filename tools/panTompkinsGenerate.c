@@ -0,0 +1,187 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsGenerate.c                                                   *
+ *       Writes synthetic ECG records of any length and sampling frequency       *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Writes a synthetic ECG record (see panTompkinsSynth) as text, one sample per  *
+ * line like examples/test_input.txt, or as 16-bit little-endian binary, and     *
+ * optionally the sample number of every R peak. Samples go straight to the      *
+ * output, so 24-72 hour records at up to 2000 Hz take no memory, e.g.:          *
+ * ptGenerate -f 1000 -d 24h -e 0.01 -m 0.05 -M 50 -b -o day.bin -a day.ann      *
+ *                                                                               *
+ * Build from the repository root:                                               *
+ * gcc -O2 -I. -Itools tools/panTompkinsGenerate.c tools/panTompkinsSynth.c -lm \*
+ *     -o ptGenerate                                                             *
+ *-------------------------------------------------------------------------------*
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "panTompkinsSynth.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+    Reads a duration such as 3600, 3600s, 90m or 24h, in seconds.
+*/
+static double duration(const char text[])
+{
+    char *end;
+    double value = strtod(text, &end);
+
+    if (*end == 'h')
+        return 3600*value;
+    if (*end == 'm')
+        return 60*value;
+    return value;
+}
+
+static void usage(const char program[])
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -f fs         sampling frequency (360)\n"
+            "  -d duration   length, e.g. 3600, 90m or 24h (30m)\n"
+            "  -n samples    length in samples instead\n"
+            "  -s seed       random seed (1)\n"
+            "  -r bpm        mean heart rate (72)\n"
+            "  -v bpm        heart rate standard deviation (3)\n"
+            "  -e p          probability of a premature ventricular beat (0)\n"
+            "  -w mV         baseline wander amplitude (0.1)\n"
+            "  -m mV         mains hum amplitude (0)\n"
+            "  -M Hz         mains frequency (60)\n"
+            "  -E mV         muscle noise standard deviation (0.01)\n"
+            "  -b            binary output: 16-bit little-endian signed samples instead of text\n"
+            "  -o file       output (stdout)\n"
+            "  -a file       writes the sample number of every R peak, one per line\n",
+            program);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    ptSynthOptions options;
+    ptSynth synth;
+    const char *output = NULL, *annotations = NULL;
+    double seconds = 1800;
+    long unsigned int n = 0, i, beats = 0;
+    bool binary = false, rPeak;
+    FILE *out = stdout, *ann = NULL;
+    int opt;
+
+    ptSynthDefaults(&options);
+    while ((opt = getopt(argc, argv, "f:d:n:s:r:v:e:w:m:M:E:bo:a:h")) != -1)
+    {
+        if (opt == 'f')
+            options.fs = atoi(optarg);
+        else if (opt == 'd')
+            seconds = duration(optarg);
+        else if (opt == 'n')
+            n = strtoul(optarg, NULL, 10);
+        else if (opt == 's')
+            options.seed = strtoul(optarg, NULL, 10);
+        else if (opt == 'r')
+            options.hrMean = atof(optarg);
+        else if (opt == 'v')
+            options.hrStd = atof(optarg);
+        else if (opt == 'e')
+            options.ectopic = atof(optarg);
+        else if (opt == 'w')
+            options.wander = atof(optarg);
+        else if (opt == 'm')
+            options.mains = atof(optarg);
+        else if (opt == 'M')
+            options.mainsFrequency = atof(optarg);
+        else if (opt == 'E')
+            options.emg = atof(optarg);
+        else if (opt == 'b')
+            binary = true;
+        else if (opt == 'o')
+            output = optarg;
+        else if (opt == 'a')
+            annotations = optarg;
+        else
+            usage(argv[0]);
+    }
+    if (options.fs <= 0 || options.hrMean <= 0)
+        usage(argv[0]);
+    if (!n)
+        n = (long unsigned int)(seconds*options.fs + 0.5);
+
+    if (output && !(out = fopen(output, binary ? "wb" : "w")))
+    {
+        fprintf(stderr, "can't write %s\n", output);
+        return 1;
+    }
+    if (annotations && !(ann = fopen(annotations, "w")))
+    {
+        fprintf(stderr, "can't write %s\n", annotations);
+        return 1;
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    // One sample at a time, straight to the output: nothing grows with the length of the record.
+    ptSynthInit(&synth, &options);
+    for (i = 0; i < n; i++)
+    {
+        dataType x = ptSynthNext(&synth, &rPeak);
+
+        if (binary)
+        {
+            unsigned char bytes[2];
+            x = x < -32768 ? -32768 : (x > 32767 ? 32767 : x);
+            bytes[0] = x & 0xFF;
+            bytes[1] = (x >> 8) & 0xFF;
+            fwrite(bytes, 1, 2, out);
+        }
+        else
+            fprintf(out, "%d\n", x);
+        if (rPeak)
+        {
+            beats++;
+            if (ann)
+                fprintf(ann, "%lu\n", i);
+        }
+    }
+
+    if (fflush(out) || ferror(out) || (ann && (fflush(ann) || ferror(ann))))
+    {
+        fprintf(stderr, "write error\n");
+        return 1;
+    }
+    if (output)
+        fclose(out);
+    if (ann)
+        fclose(ann);
+    fprintf(stderr, "%lu samples at %d Hz, %lu R peaks\n", n, options.fs, beats);
+
+    return 0;
+}
@@ -0,0 +1,832 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsGolden.c                                                     *
+ *       Golden-output equivalence harness for every engine                      *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Checks that every engine detects exactly what panTompkins() does. The golden  *
+ * outputs are panTompkins()'s own: examples/test_output.txt for the MIT-BIH     *
+ * test record (written by "-g") and, for a set of synthetic records, a run of   *
+ * panTompkins() made on the spot.                                               *
+ *                                                                               *
+ * Every engine (the streaming core, the offline multi-configuration engine, the *
+ * multi-stream batch, the last two on each SIMD kernel the CPU supports, the    *
+ * server's pool of interleaved streams and the microcontroller engine) runs     *
+ * every record, and its 0/1 output is compared with the golden one. It's either *
+ * bit-exact, or the beats are paired within a tolerance window (-t, in samples) *
+ * and the matched, missed and extra beats are reported. The synthetic records'  *
+ * R peaks are checked to be as tall as asked for at two heart rates and, with   *
+ * -d, ptDetect's incremental runs are checked against single runs, switching    *
+ * the output format between the two halves of a record. Exits with 1 if any     *
+ * engine misses or adds a beat, or a check fails. Built with PT_SAMPLE16, the   *
+ * engines built on ptFilter are checked against the synthetic records' known R  *
+ * peaks instead (see checkSample16()).                                          *
+ *                                                                               *
+ * New engines are added to the engines table.                                   *
+ *                                                                               *
+ * Build from the repository root:                                               *
+ * gcc -O2 -I. -Itools tools/panTompkinsGolden.c tools/panTompkinsRecord.c \     *
+ *     tools/panTompkinsSynth.c panTompkins.c panTompkinsCore.c \                *
+ *     panTompkinsLanes.c panTompkinsMulti.c panTompkinsBatch.c \                *
+ *     panTompkinsDispatch.c panTompkinsMcu.c panTompkinsPool.c -lm -o ptGolden  *
+ *-------------------------------------------------------------------------------*
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "panTompkinsRecord.h"
+#include "panTompkinsSynth.h"
+#include "panTompkinsCore.h"
+#include "panTompkinsMulti.h"
+#include "panTompkinsBatch.h"
+#include "panTompkinsMcu.h"
+#include "panTompkinsPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// How many records can be checked at once.
+#define MAX_RECORDS 16
+
+/*
+    The dense 0/1 output of a detector for one record, one value per line as panTompkins() writes it.
+*/
+typedef struct
+{
+    unsigned char *value;
+    long unsigned int n, capacity;
+} output;
+
+/*
+    A record to check, with its golden output from panTompkins(). A synthetic record also has its known
+    R peaks, marked on the first sample at or past each one.
+*/
+typedef struct
+{
+    char name[64];
+    ptRecord record;
+    output golden, known;
+} testCase;
+
+/*
+    An engine runs every record and writes one output per record. isa is the SIMD kernel to force, or
+    PT_AUTO when the engine doesn't have any. sample16 tells whether its filters follow PT_SAMPLE16,
+    which only those built on ptFilter do.
+*/
+typedef struct
+{
+    const char *name;
+    void (*run)(const testCase tests[], int count, output outputs[]);
+    ptIsa isa;
+    bool sample16;
+} engine;
+
+static void append(int out, void *context)
+{
+    output *o = context;
+
+    if (o->n == o->capacity)
+    {
+        o->capacity = o->capacity ? 2*o->capacity : 1 << 16;
+        o->value = realloc(o->value, o->capacity);
+        if (!o->value)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    o->value[o->n++] = out;
+}
+
+static bool readOutput(output *o, const char path[])
+{
+    FILE *f = fopen(path, "r");
+    int x;
+
+    memset(o, 0, sizeof(output));
+    if (!f)
+        return false;
+    while (fscanf(f, "%d", &x) == 1)
+        append(x, o);
+    fclose(f);
+
+    return true;
+}
+
+/*
+    Runs panTompkins() over a record kept in memory, through temporary files, and reads back what it
+    wrote. If path is given, the output is written there instead.
+*/
+static void runReference(const ptRecord *record, output *o, const char path[])
+{
+    char in[] = "/tmp/ptGoldenInXXXXXX", out[] = "/tmp/ptGoldenOutXXXXXX";
+    int fdIn = mkstemp(in), fdOut = path ? -1 : mkstemp(out);
+
+    if (fdIn < 0 || (!path && fdOut < 0))
+    {
+        fprintf(stderr, "can't create temporary files\n");
+        exit(1);
+    }
+    close(fdIn);
+    if (fdOut >= 0)
+        close(fdOut);
+    if (!ptRecordSave(record, in))
+    {
+        fprintf(stderr, "can't write %s\n", in);
+        exit(1);
+    }
+    init(in, path ? path : out);
+    panTompkins();
+    readOutput(o, path ? path : out);
+    remove(in);
+    if (!path)
+        remove(out);
+}
+
+/*
+    Makes a synthetic record the way ptRecordSynth() does, keeping its known R peaks.
+*/
+static bool synthesize(testCase *t, long unsigned int n, int fs, unsigned int seed)
+{
+    ptSynthOptions options;
+    ptSynth synth;
+    long unsigned int i;
+    bool rPeak;
+
+    memset(&t->known, 0, sizeof(output));
+    t->record.n = n;
+    t->record.fs = fs;
+    if (!(t->record.x = malloc((n ? n : 1)*sizeof(dataType))))
+        return false;
+    ptSynthDefaults(&options);
+    options.fs = fs;
+    options.seed = seed;
+    ptSynthInit(&synth, &options);
+    for (i = 0; i < n; i++)
+    {
+        t->record.x[i] = ptSynthNext(&synth, &rPeak);
+        append(rPeak, &t->known);
+    }
+
+    return true;
+}
+
+/*
+    The streaming engine: ptFilter, ptDecision and ptFramer, one sample at a time.
+*/
+static void runCore(const testCase tests[], int count, output outputs[])
+{
+    static ptFilter filter;
+    ptDecision decision;
+    ptFramer framer;
+    ptHistory history;
+    ptConfig config;
+    long unsigned int i, position;
+    bool qrs;
+    int t;
+
+    ptDefaultConfig(&config, 360);
+    for (t = 0; t < count; t++)
+    {
+        const ptRecord *r = &tests[t].record;
+
+        ptFilterInit(&filter, &config);
+        ptFilterHistory(&filter, &history);
+        ptDecisionInit(&decision);
+        ptFramerInit(&framer, &config);
+        for (i = 0; i < r->n; i++)
+        {
+            ptFilterStep(&filter, r->x[i]);
+            qrs = ptDecisionStep(&decision, &config, &history, &position);
+            ptFramerStep(&framer, qrs, position, append, &outputs[t]);
+        }
+        ptFramerFlush(&framer, append, &outputs[t]);
+    }
+}
+
+/*
+    The beats the streaming engine finds on a record with a given configuration, by position.
+*/
+static void coreBeats(const ptRecord *r, const ptConfig *config, ptBeatList *beats)
+{
+    static ptFilter filter;
+    ptDecision decision;
+    ptHistory history;
+    long unsigned int i, position;
+
+    ptFilterInit(&filter, config);
+    ptFilterHistory(&filter, &history);
+    ptDecisionInit(&decision);
+    beats->count = 0;
+    for (i = 0; i < r->n; i++)
+    {
+        ptFilterStep(&filter, r->x[i]);
+        if (ptDecisionStep(&decision, config, &history, &position) && beats->count < beats->capacity)
+            beats->position[beats->count++] = position;
+    }
+}
+
+/*
+    Frames beats already known by their position, for the engines that don't step sample by sample.
+*/
+static void frameBeats(const ptRecord *r, const ptConfig *config, const ptBeatList *beats, output *o)
+{
+    ptFramer framer;
+    long unsigned int i, j;
+
+    ptFramerInit(&framer, config);
+    for (i = 0, j = 0; i < r->n; i++)
+    {
+        bool qrs = j < beats->count && beats->position[j] == i;
+        j += qrs;
+        ptFramerStep(&framer, qrs, i, append, o);
+    }
+    ptFramerFlush(&framer, append, o);
+}
+
+/*
+    Offline engine: the whole record filtered at once (ptFilterSignal()), then the decision logic on
+    the lanes of ptMultiDetect(). Lane 0 gets the default configuration and gives the output; the beats
+    are framed by their position, since they're all known by then. The other lanes get a threshold
+    ratio, refractory period and back search weight of their own, and each must find the same beats as
+    the streaming engine run with its configuration.
+*/
+static void runMulti(const testCase tests[], int count, output outputs[])
+{
+    ptConfig config[PT_LANES];
+    ptBeatList beats[PT_LANES], expected;
+    dataType *highpass, *squared, *integral;
+    int t, k;
+
+    for (t = 0; t < count; t++)
+    {
+        const ptRecord *r = &tests[t].record;
+
+        highpass = malloc(r->n*sizeof(dataType));
+        squared = malloc(r->n*sizeof(dataType));
+        integral = malloc(r->n*sizeof(dataType));
+        expected.capacity = r->n;
+        expected.position = malloc(r->n*sizeof(long unsigned int));
+        for (k = 0; k < PT_LANES; k++)
+        {
+            ptDefaultConfig(&config[k], 360);
+            if (k)
+            {
+                config[k].thresholdRatio = 0.25 + 0.05*(k - 4);
+                config[k].refractory += 9*(k % 3) - 9;
+                config[k].searchWeight = 0.125*(1 + k % 4);
+            }
+            beats[k].capacity = r->n;
+            beats[k].position = malloc(r->n*sizeof(long unsigned int));
+        }
+        if (!highpass || !squared || !integral || !expected.position || !beats[PT_LANES - 1].position)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        ptFilterSignal(r->x, r->n, &config[0], highpass, squared, integral);
+        ptMultiDetect(highpass, squared, integral, r->n, config, PT_LANES, beats);
+
+        frameBeats(r, &config[0], &beats[0], &outputs[t]);
+
+        // A lane that disagrees with the streaming engine spoils the output, so the mismatch shows up.
+        for (k = 1; k < PT_LANES; k++)
+        {
+            coreBeats(r, &config[k], &expected);
+            if (beats[k].count != expected.count || memcmp(beats[k].position, expected.position, expected.count*sizeof(long unsigned int)))
+            {
+                fprintf(stderr, "%s: lane %d (ratio %g, refractory %d, search weight %g) found %lu beats, the core %lu\n",
+                        tests[t].name, k, config[k].thresholdRatio, config[k].refractory, config[k].searchWeight,
+                        beats[k].count, expected.count);
+                outputs[t].n = 0;
+            }
+        }
+
+        for (k = 0; k < PT_LANES; k++)
+            free(beats[k].position);
+        free(expected.position);
+        free(highpass);
+        free(squared);
+        free(integral);
+    }
+}
+
+/*
+    Multi-stream engine: stream k of a ptBatch runs record k % count, so neighbouring lanes see
+    different signals. A stream that reached the end of its record is flushed and then fed zeros.
+*/
+static void runBatch(const testCase tests[], int count, output outputs[])
+{
+    static ptBatch batch;
+    static ptFramer framer[PT_BATCH];
+    ptConfig config;
+    dataType x[PT_BATCH];
+    bool beat[PT_BATCH];
+    long unsigned int position[PT_BATCH], i, longest = 0;
+    output scratch[PT_BATCH];
+    int k, streams = PT_BATCH;    // Every stream is used, even when there are fewer records.
+
+    memset(scratch, 0, sizeof(scratch));
+    ptDefaultConfig(&config, 360);
+    ptBatchInit(&batch, &config, streams);
+    for (k = 0; k < streams; k++)
+    {
+        ptFramerInit(&framer[k], &config);
+        if (tests[k % count].record.n > longest)
+            longest = tests[k % count].record.n;
+    }
+
+    for (i = 0; i < longest; i++)
+    {
+        for (k = 0; k < streams; k++)
+        {
+            const ptRecord *r = &tests[k % count].record;
+            x[k] = i < r->n ? r->x[i] : 0;
+        }
+        ptBatchStep(&batch, x, beat, position);
+        for (k = 0; k < streams; k++)
+        {
+            const ptRecord *r = &tests[k % count].record;
+            output *o = k < count ? &outputs[k] : &scratch[k];
+
+            if (i < r->n)
+                ptFramerStep(&framer[k], beat[k], position[k], append, o);
+            if (i + 1 == r->n)
+                ptFramerFlush(&framer[k], append, o);
+        }
+    }
+
+    // The extra streams must give the same output as the first stream with that record.
+    for (k = count; k < streams; k++)
+    {
+        output *o = &outputs[k % count];
+        if (scratch[k].n != o->n || memcmp(scratch[k].value, o->value, o->n))
+            o->n = 0;
+        free(scratch[k].value);
+    }
+}
+
+static void onPoolBeat(int slot, void *user, long unsigned int position, long unsigned int found, void *context)
+{
+    ptBeatList *beats = user;
+
+    (void)slot;
+    (void)found;
+    (void)context;
+    if (beats->count < beats->capacity)
+        beats->position[beats->count] = position;
+    beats->count++;
+}
+
+/*
+    Server engine: a ptPool with two slots per record, slot k running record k % count, so the slots of
+    a record are apart. Each round queues a block of a different length on every slot with ptPoolPush()
+    and runs a quantum of each with ptPoolRun(), so the streams are interleaved on the pool the way a
+    ptServer worker interleaves its connections. The second slot of a record must find the same beats
+    as the first.
+*/
+static void runPool(const testCase tests[], int count, output outputs[])
+{
+    static ptPool pool;
+    ptConfig config;
+    ptBeatList beats[2*MAX_RECORDS];
+    long unsigned int sent[2*MAX_RECORDS], pending;
+    int k, slots = 2*count, block;
+
+    ptDefaultConfig(&config, 360);
+    if (!ptPoolInit(&pool, &config, 4))
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (k = 0; k < slots; k++)
+    {
+        beats[k].count = sent[k] = 0;
+        beats[k].capacity = tests[k % count].record.n;
+        beats[k].position = malloc(beats[k].capacity*sizeof(long unsigned int));
+        if (!beats[k].position || ptPoolOpen(&pool, &beats[k]) != k)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+
+    do
+    {
+        for (k = 0, pending = 0; k < slots; k++)
+        {
+            const ptRecord *r = &tests[k % count].record;
+
+            block = 37 + 61*k;
+            if (sent[k] + block > r->n)
+                block = r->n - sent[k];
+            sent[k] += ptPoolPush(&pool, k, r->x + sent[k], block);
+            pending += r->n - sent[k];
+        }
+    }
+    while (ptPoolRun(&pool, 100, onPoolBeat, NULL) || pending);
+
+    for (k = 0; k < slots; k++)
+    {
+        if (k < count)
+            frameBeats(&tests[k].record, &config, &beats[k], &outputs[k]);
+        else if (beats[k].count != beats[k - count].count || memcmp(beats[k].position, beats[k - count].position, beats[k].count*sizeof(long unsigned int)))
+            outputs[k - count].n = 0;
+    }
+    for (k = 0; k < slots; k++)
+        free(beats[k].position);
+    ptPoolFree(&pool);
+}
+
+/*
+    Microcontroller engine: ptMcu, with its integer-only decision logic, built for 360 Hz. The records
+    are 11 bit, so they fit its 16 bit input.
+*/
+static void runMcu(const testCase tests[], int count, output outputs[])
+{
+    static ptMcu mcu;
+    ptFramer framer;
+    ptConfig config;
+    long unsigned int i;
+    uint32_t position = 0;
+    bool qrs;
+    int t;
+
+    ptDefaultConfig(&config, PT_MCU_FS);
+    for (t = 0; t < count; t++)
+    {
+        const ptRecord *r = &tests[t].record;
+
+        ptMcuInit(&mcu);
+        ptFramerInit(&framer, &config);
+        for (i = 0; i < r->n; i++)
+        {
+            qrs = ptMcuStep(&mcu, (int16_t)r->x[i], &position);
+            ptFramerStep(&framer, qrs, position, append, &outputs[t]);
+        }
+        ptFramerFlush(&framer, append, &outputs[t]);
+    }
+}
+
+static const engine engines[] =
+{
+    {"core", runCore, PT_AUTO, true},
+    {"multi:scalar", runMulti, PT_SCALAR, true},
+    {"multi:avx2", runMulti, PT_AVX2, true},
+    {"batch:scalar", runBatch, PT_SCALAR, false},
+    {"batch:sse4.2", runBatch, PT_SSE42, false},
+    {"batch:avx2", runBatch, PT_AVX2, false},
+    {"batch:avx512", runBatch, PT_AVX512, false},
+    {"pool", runPool, PT_AUTO, false},
+    {"mcu", runMcu, PT_AUTO, false},
+};
+
+#define ENGINES (sizeof(engines)/sizeof(engines[0]))
+
+/*
+    Compares an output with the golden one. Returns 0 if they're identical, 1 if every beat is within
+    tolerance samples of a golden beat and vice versa, and 2 otherwise. The beat counts are written on
+    matched, missed (golden beats not found) and extra (beats not on the golden output).
+*/
+static int compare(const output *golden, const output *o, long unsigned int tolerance, long unsigned int *matched, long unsigned int *missed, long unsigned int *extra)
+{
+    long unsigned int i = 0, j = 0;
+
+    *matched = *missed = *extra = 0;
+    if (golden->n == o->n && !memcmp(golden->value, o->value, o->n))
+    {
+        for (i = 0; i < o->n; i++)
+            *matched += o->value[i];
+        return 0;
+    }
+
+    // Walk both beat lists in order, pairing beats closer than the tolerance.
+    for (;;)
+    {
+        while (i < golden->n && !golden->value[i])
+            i++;
+        while (j < o->n && !o->value[j])
+            j++;
+        if (i >= golden->n || j >= o->n)
+            break;
+        if (i + tolerance < j)
+        {
+            (*missed)++;
+            i++;
+        }
+        else if (j + tolerance < i)
+        {
+            (*extra)++;
+            j++;
+        }
+        else
+        {
+            (*matched)++;
+            i++;
+            j++;
+        }
+    }
+    for (; i < golden->n; i++)
+        *missed += golden->value[i];
+    for (; j < o->n; j++)
+        *extra += o->value[j];
+
+    return (*missed || *extra || !o->n) ? 2 : 1;
+}
+
+#ifdef PT_SAMPLE16
+// How far PT_SAMPLE16 may move a beat of the test record from panTompkins()' (9 samples, 25ms, is seen).
+#define PT_SAMPLE16_SHIFT 10
+
+/*
+    With PT_SAMPLE16 the engines built on ptFilter saturate their filters and sum the integrator on 64
+    bits, so they can't match panTompkins(), whose integrator overflows on these records. They're checked
+    against what should be found instead. On a synthetic record that's its known R peaks, paired within
+    150ms as on beat by beat comparisons (ANSI/AAMI EC57): the engine must miss and add no more of them
+    than panTompkins() does, learning period included. The test record has no annotations here, so its
+    beats must be panTompkins()' own, each moved by up to PT_SAMPLE16_SHIFT samples (or -t). Returns
+    whether the engine passes.
+*/
+static bool checkSample16(const char name[], const testCase *t, const output *o, long unsigned int tolerance)
+{
+    long unsigned int matched, missed, extra, referenceMatched, referenceMissed, referenceExtra;
+    long unsigned int window = 0.15*t->record.fs;
+    bool ok;
+
+    if (!t->known.n)
+    {
+        tolerance = tolerance > PT_SAMPLE16_SHIFT ? tolerance : PT_SAMPLE16_SHIFT;
+        ok = compare(&t->golden, o, tolerance, &matched, &missed, &extra) < 2;
+        printf("%-14s %-26s PT_SAMPLE16 %s: %lu beats matched, %lu missed, %lu extra (tolerance %lu samples)\n",
+               name, t->name, ok ? "within tolerance" : "MISMATCH", matched, missed, extra, tolerance);
+        return ok;
+    }
+    compare(&t->known, &t->golden, window, &referenceMatched, &referenceMissed, &referenceExtra);
+    compare(&t->known, o, window, &matched, &missed, &extra);
+    ok = o->n == t->golden.n && missed + extra <= referenceMissed + referenceExtra;
+    printf("%-14s %-26s PT_SAMPLE16 %s: %lu R peaks found, %lu missed, %lu extra (panTompkins(): %lu, %lu, %lu)\n",
+           name, t->name, ok ? "as good as panTompkins()" : "MISMATCH", matched, missed, extra,
+           referenceMatched, referenceMissed, referenceExtra);
+
+    return ok;
+}
+#endif
+
+/*
+    Whether two files have the same contents.
+*/
+static bool sameFile(const char a[], const char b[])
+{
+    FILE *f = fopen(a, "rb"), *g = fopen(b, "rb");
+    int c = 0, d = 0;
+
+    while (f && g && c == d && c != EOF)
+    {
+        c = getc(f);
+        d = getc(g);
+    }
+    if (f)
+        fclose(f);
+    if (g)
+        fclose(g);
+
+    return f && g && c == d;
+}
+
+/*
+    Checks ptDetect's incremental runs (--incremental), with the ptDetect at program: each pair of
+    output formats is run on the first half of a record, then, with -O switched to the second format,
+    on the whole record. Resuming a run written in another format must start over, so the output has to
+    be the same as one run of the second format over the whole record. Returns whether all of them are.
+*/
+static bool checkIncremental(const char program[], const ptRecord *record)
+{
+    static const char *formats[][2] = {{"dense", "dense"}, {"dense", "sparse"}, {"sparse", "dense"}, {"rr", "annotations"}};
+    char directory[] = "/tmp/ptGoldenDetectXXXXXX", input[64], output[64], state[80], reference[64], command[512];
+    ptRecord half = *record;
+    bool ok = true, good;
+    unsigned int k;
+
+    if (!mkdtemp(directory))
+    {
+        fprintf(stderr, "can't create a temporary directory\n");
+        exit(1);
+    }
+    snprintf(input, sizeof(input), "%s/record.txt", directory);
+    snprintf(output, sizeof(output), "%s/output", directory);
+    snprintf(state, sizeof(state), "%s.state", output);
+    snprintf(reference, sizeof(reference), "%s/reference", directory);
+    half.n = record->n/2;
+    for (k = 0; k < sizeof(formats)/sizeof(formats[0]); k++)
+    {
+        remove(output);
+        remove(state);
+        good = ptRecordSave(&half, input);
+        snprintf(command, sizeof(command), "'%s' -i -O %s -o %s %s", program, formats[k][0], output, input);
+        good = good && !system(command) && ptRecordSave(record, input);
+        snprintf(command, sizeof(command), "'%s' -i -O %s -o %s %s", program, formats[k][1], output, input);
+        good = good && !system(command);
+        snprintf(command, sizeof(command), "'%s' -O %s -o %s %s", program, formats[k][1], reference, input);
+        good = good && !system(command) && sameFile(output, reference);
+        printf("%-14s %-26s %s then %s: %s\n", "incremental", "second half appended", formats[k][0], formats[k][1],
+               good ? "same as one run" : "MISMATCH");
+        ok = ok && good;
+    }
+    remove(input);
+    remove(output);
+    remove(state);
+    remove(reference);
+    rmdir(directory);
+
+    return ok;
+}
+
+/*
+    The synthetic records are only as good as their known R peaks: checks that a clean record at each
+    of these heart rates has R peaks as tall as options.rAmplitude, within 2%. rPeak flags the first
+    sample past the top, so the taller of that sample and the one before is taken. Returns whether all
+    of them are.
+*/
+static bool checkSynth(void)
+{
+    static const double rates[] = {60, 150};
+    ptSynthOptions options;
+    ptSynth synth;
+    dataType x, previous = 0, height, low, high;
+    long unsigned int i, peaks;
+    bool rPeak, ok = true, good;
+    unsigned int k;
+
+    for (k = 0; k < sizeof(rates)/sizeof(rates[0]); k++)
+    {
+        ptSynthDefaults(&options);
+        options.hrMean = rates[k];
+        options.hrStd = 0;
+        options.wander = 0;
+        options.emg = 0;
+        ptSynthInit(&synth, &options);
+        low = high = (dataType)(options.gain*options.rAmplitude + 0.5);
+        for (i = 0, peaks = 0; i < 30UL*options.fs; i++, previous = x)
+        {
+            x = ptSynthNext(&synth, &rPeak) - options.baseline;
+            if (!rPeak || !i)
+                continue;
+            height = x > previous ? x : previous;
+            low = height < low ? height : low;
+            high = height > high ? height : high;
+            peaks++;
+        }
+        good = peaks && low >= 0.98*options.gain*options.rAmplitude && high <= 1.02*options.gain*options.rAmplitude;
+        printf("%-14s %3.0f bpm R peaks from %d to %d high, %.0f expected: %s\n", "synth", rates[k], low, high,
+               options.gain*options.rAmplitude, good ? "ok" : "MISMATCH");
+        ok = ok && good;
+    }
+
+    return ok;
+}
+
+static void usage(const char program[])
+{
+    fprintf(stderr,
+            "usage: %s [-g] [-t tolerance] [-i record.txt -o golden.txt] [-d ptDetect]\n"
+            "  -g  writes the golden output of the test record with panTompkins() and exits\n"
+            "  -t  beats up to this many samples away from the golden ones count as matched (0)\n"
+            "  -i  test record (examples/test_input.txt), -o its golden output (examples/test_output.txt)\n"
+            "  -d  also checks the incremental runs of this ptDetect on the test record\n"
+            "Checks every engine against panTompkins() on the test record and on synthetic records.\n",
+            program);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    // Synthetic records: length and seed. 1000 samples is just over the buffer, the shortest length
+    // where panTompkins() writes a well defined output.
+    static const long unsigned int synthetic[][2] = {{1000, 1}, {100003, 2}, {650000, 3}, {1800000, 4}};
+    static testCase tests[MAX_RECORDS];
+    const char *input = "examples/test_input.txt", *golden = "examples/test_output.txt", *detect = NULL;
+    long unsigned int tolerance = 0, matched, missed, extra;
+    int count = 0, opt, t, failures = 0, result;
+    bool generate = false;
+    unsigned int e;
+
+    while ((opt = getopt(argc, argv, "gt:i:o:d:h")) != -1)
+    {
+        if (opt == 'g')
+            generate = true;
+        else if (opt == 't')
+            tolerance = strtoul(optarg, NULL, 10);
+        else if (opt == 'i')
+            input = optarg;
+        else if (opt == 'o')
+            golden = optarg;
+        else if (opt == 'd')
+            detect = optarg;
+        else
+            usage(argv[0]);
+    }
+
+    if (!ptRecordLoad(&tests[0].record, input, 360))
+    {
+        fprintf(stderr, "can't read %s\n", input);
+        return 1;
+    }
+    snprintf(tests[0].name, sizeof(tests[0].name), "%s", input);
+    if (generate)
+    {
+        runReference(&tests[0].record, &tests[0].golden, golden);
+        printf("%s: %lu samples written by panTompkins()\n", golden, tests[0].golden.n);
+        return 0;
+    }
+    if (!readOutput(&tests[0].golden, golden) || !tests[0].golden.n)
+    {
+        fprintf(stderr, "%s is missing or empty, run with -g first\n", golden);
+        return 1;
+    }
+    count = 1;
+    failures += !checkSynth();
+    if (detect)
+        failures += !checkIncremental(detect, &tests[0].record);
+
+    // The golden outputs of the synthetic records come from running panTompkins() now.
+    for (t = 0; t < (int)(sizeof(synthetic)/sizeof(synthetic[0])); t++, count++)
+    {
+        if (!synthesize(&tests[count], synthetic[t][0], 360, synthetic[t][1]))
+        {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        snprintf(tests[count].name, sizeof(tests[count].name), "synthetic:%lu:360:%lu", synthetic[t][0], synthetic[t][1]);
+        runReference(&tests[count].record, &tests[count].golden, NULL);
+    }
+
+    for (e = 0; e < ENGINES; e++)
+    {
+        output outputs[MAX_RECORDS];
+
+        if (engines[e].isa != PT_AUTO && engines[e].isa > ptBestIsa())
+        {
+            printf("%-14s skipped, the CPU doesn't support it\n", engines[e].name);
+            continue;
+        }
+        ptForceIsa(engines[e].isa);
+        memset(outputs, 0, sizeof(outputs));
+        engines[e].run(tests, count, outputs);
+
+        for (t = 0; t < count; t++)
+        {
+#ifdef PT_SAMPLE16
+            if (engines[e].sample16)
+            {
+                failures += !checkSample16(engines[e].name, &tests[t], &outputs[t], tolerance);
+                free(outputs[t].value);
+                continue;
+            }
+#endif
+            result = compare(&tests[t].golden, &outputs[t], tolerance, &matched, &missed, &extra);
+            if (result == 0)
+                printf("%-14s %-26s bit-exact (%lu beats)\n", engines[e].name, tests[t].name, matched);
+            else
+                printf("%-14s %-26s %s: %lu beats matched, %lu missed, %lu extra (tolerance %lu samples)\n",
+                       engines[e].name, tests[t].name, result == 1 ? "within tolerance" : "MISMATCH",
+                       matched, missed, extra, tolerance);
+            failures += result == 2;
+            free(outputs[t].value);
+        }
+    }
+    ptForceIsa(PT_AUTO);
+
+#ifdef PT_SAMPLE16
+    printf(failures ? "%d mismatches\n" : "all engines match panTompkins(), or do as well with PT_SAMPLE16\n", failures);
+#else
+    printf(failures ? "%d mismatches\n" : "all engines match panTompkins()\n", failures);
+#endif
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,861 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsIO.c                                                         *
+ *       Record readers and beat writers                                         *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Readers and writers for ptDetect. Records come as text (one sample per line,  *
+ * like examples/test_input.txt), 16-bit little-endian binary, WFDB (format 16,  *
+ * 212 or 80, all signals on one file, e.g. the MIT-BIH records) or EDF, of      *
+ * which one signal is read. The detected beats go out as the dense 0/1 output   *
+ * of panTompkins(), the sample number of each beat, RR intervals or rdann-like  *
+ * annotations.                                                                  *
+ *                                                                               *
+ * Text and binary records, and every output, go through read() and write() in 1 *
+ * MB blocks instead of stdio, which also makes them work on pipes: samples are  *
+ * parsed as blocks arrive, wherever they were cut, and the output is written    *
+ * once a block fills up or its oldest line reaches the flush latency.           *
+ *                                                                               *
+ * In follow mode (ptReaderFollow) a file that keeps growing is read like tail   *
+ * -f does: at its end the reader sleeps on inotify and picks up where it        *
+ * stopped once more is appended, even halfway through a line.                   *
+ *-------------------------------------------------------------------------------*
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "panTompkinsIO.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Longest path or header line handled.
+#define PT_LINE 1024
+
+ptInputFormat ptGuessFormat(const char path[])
+{
+    const char *dot = strrchr(path, '.');
+
+    if (dot && (!strcmp(dot, ".hea") || !strcmp(dot, ".dat")))
+        return PT_WFDB;
+    if (dot && (!strcmp(dot, ".edf") || !strcmp(dot, ".EDF")))
+        return PT_EDF;
+    if (dot && (!strcmp(dot, ".bin") || !strcmp(dot, ".raw")))
+        return PT_BINARY;
+    return PT_TEXT;
+}
+
+static double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+static bool fail(ptReader *r, const char error[])
+{
+    r->error = error;
+    ptReaderClose(r);
+    return false;
+}
+
+/*
+    The header of a WFDB record, out of the header, the signal file or the record name.
+*/
+static bool headerPath(const char path[], char header[PT_LINE])
+{
+    const char *dot = strrchr(path, '.'), *slash = strrchr(path, '/');
+    size_t base = (dot && (!slash || dot > slash)) ? (size_t)(dot - path) : strlen(path);
+
+    if (base + 5 > PT_LINE)
+        return false;
+    memcpy(header, path, base);
+    strcpy(header + base, ".hea");
+
+    return true;
+}
+
+/*
+    Opens the signal file of a WFDB record. path may be the header, the signal file or the record name
+    without extension. Every signal must be on the same file with the same format, as on the MIT-BIH
+    records.
+*/
+static bool openWfdb(ptReader *r, const char path[])
+{
+    char header[PT_LINE], line[PT_LINE], file[PT_LINE], first[PT_LINE], data[2*PT_LINE];
+    const char *slash = strrchr(path, '/');
+    size_t directory = slash ? (size_t)(slash - path + 1) : 0;
+    long int skip = 0;
+    int k = -1, format;
+    FILE *h;
+
+    if (!headerPath(path, header))
+        return fail(r, "path too long");
+    if (!(h = fopen(header, "r")))
+        return fail(r, "can't open the WFDB header");
+
+    // Record line: name, number of signals, sampling frequency. Then one line per signal.
+    while (fgets(line, sizeof(line), h))
+    {
+        char *p = line;
+
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || !*p)
+            continue;
+        if (k < 0)
+        {
+            double fs = 0;
+            if (sscanf(p, "%*s %d %lf", &r->signals, &fs) < 1 || r->signals <= 0)
+                break;
+            r->fs = fs > 0 ? (int)(fs + 0.5) : 0;
+        }
+        else
+        {
+            char *plus, *end;
+            if (sscanf(p, "%1023s %d", file, &format) != 2)
+                break;
+            if (k == 0)
+            {
+                strcpy(first, file);
+                r->wfdbFormat = format;
+                // The first signal's format may carry a byte offset: 212+512.
+                p += strcspn(p, " \t");
+                p += strspn(p, " \t");
+                end = p + strcspn(p, " \t\r\n");
+                plus = strchr(p, '+');
+                if (plus && plus < end)
+                    skip = atol(plus + 1);
+            }
+            else if (strcmp(file, first) || format != r->wfdbFormat)
+            {
+                fclose(h);
+                return fail(r, "WFDB signals on different files or formats aren't supported");
+            }
+        }
+        if (++k > r->signals)
+            break;
+    }
+    fclose(h);
+
+    if (k < r->signals || r->signals <= 0)
+        return fail(r, "bad WFDB header");
+    if (r->channel >= r->signals)
+        return fail(r, "no such signal on the record");
+    if (r->wfdbFormat != 16 && r->wfdbFormat != 212 && r->wfdbFormat != 80)
+        return fail(r, "only WFDB formats 16, 212 and 80 are supported");
+
+    snprintf(data, sizeof(data), "%.*s%s", (int)directory, path, first);
+    if (!(r->f = fopen(data, "rb")))
+        return fail(r, "can't open the WFDB signal file");
+    if (skip > 0 && fseek(r->f, skip, SEEK_SET))
+        return fail(r, "bad WFDB byte offset");
+
+    return true;
+}
+
+/*
+    The next sample of the interleaved WFDB stream, whichever signal it belongs to.
+*/
+static bool nextWfdb(ptReader *r, int *x)
+{
+    unsigned char b[3];
+
+    if (r->wfdbFormat == 16)
+    {
+        if (fread(b, 1, 2, r->f) != 2)
+            return false;
+        *x = (short)(b[0] | (b[1] << 8));
+    }
+    else if (r->wfdbFormat == 80)
+    {
+        int c = getc(r->f);
+        if (c == EOF)
+            return false;
+        *x = c - 128;
+    }
+    // Format 212: two 12-bit samples on 3 bytes.
+    else if (r->position & 1)
+        *x = r->pending;
+    else
+    {
+        if (fread(b, 1, 3, r->f) != 3)
+            return false;
+        *x = b[0] | ((b[1] & 0x0F) << 8);
+        r->pending = b[2] | ((b[1] & 0xF0) << 4);
+        if (*x > 2047)
+            *x -= 4096;
+        if (r->pending > 2047)
+            r->pending -= 4096;
+    }
+    r->position++;
+
+    return true;
+}
+
+// An EDF header field: ASCII, space padded.
+static long int field(FILE *f, int size)
+{
+    char text[128];
+
+    if (size >= (int)sizeof(text) || fread(text, 1, size, f) != (size_t)size)
+        return -1;
+    text[size] = 0;
+
+    return atol(text);
+}
+
+static double fieldDouble(FILE *f, int size)
+{
+    char text[128];
+
+    if (size >= (int)sizeof(text) || fread(text, 1, size, f) != (size_t)size)
+        return -1;
+    text[size] = 0;
+
+    return atof(text);
+}
+
+/*
+    Reads the EDF header: 256 bytes for the record, then 256 bytes per signal, field by field for every
+    signal. Only the number of samples per data record and its duration matter here.
+*/
+static bool openEdf(ptReader *r, const char path[])
+{
+    double duration;
+    int k;
+
+    if (!(r->f = fopen(path, "rb")))
+        return fail(r, "can't open the EDF file");
+    // The duration of a data record and the number of signals close the first 256 bytes.
+    if (fseek(r->f, 244, SEEK_SET) || (duration = fieldDouble(r->f, 8)) <= 0)
+        return fail(r, "bad EDF header");
+    if ((r->signals = field(r->f, 4)) <= 0)
+        return fail(r, "bad EDF header");
+    if (r->channel >= r->signals)
+        return fail(r, "no such signal on the record");
+
+    // Label, transducer, dimension, physical and digital ranges, prefiltering: 216 bytes per signal.
+    if (fseek(r->f, 256 + 216L*r->signals, SEEK_SET))
+        return fail(r, "bad EDF header");
+    r->recordSize = 0;
+    for (k = 0; k < r->signals; k++)
+    {
+        long int n = field(r->f, 8);
+        if (n <= 0)
+            return fail(r, "bad EDF header");
+        if (k == r->channel)
+        {
+            r->offset = r->recordSize;
+            r->count = n;
+            r->fs = (int)(n/duration + 0.5);
+        }
+        r->recordSize += n;
+    }
+    if (fseek(r->f, 256 + 256L*r->signals, SEEK_SET))
+        return fail(r, "bad EDF header");
+    if (!(r->record = malloc(r->recordSize*sizeof(short))))
+        return fail(r, "out of memory");
+    r->next = r->count;
+
+    return true;
+}
+
+/*
+    Opens a record. "-" reads the standard input (text or binary only). channel picks the signal on
+    WFDB and EDF records. Returns false, with the reason on reader->error, if it can't be read.
+*/
+bool ptReaderOpen(ptReader *r, const char path[], ptInputFormat format, int channel)
+{
+    memset(r, 0, sizeof(ptReader));
+    r->fd = r->watch = r->stop = -1;
+    r->format = format;
+    r->channel = channel;
+    r->signals = 1;
+
+    if (format == PT_WFDB)
+        return openWfdb(r, path);
+    if (format == PT_EDF)
+        return openEdf(r, path);
+    if (channel != 0)
+        return fail(r, "text and binary records have a single signal");
+    if (!(r->block = malloc(PT_IO_BLOCK)))
+        return fail(r, "out of memory");
+    if (!strcmp(path, "-"))
+        r->fd = STDIN_FILENO;
+    else if ((r->fd = open(path, O_RDONLY)) < 0)
+        return fail(r, "can't open the input");
+
+    return true;
+}
+
+/*
+    Turns follow mode on, like tail -f: once the end of the file is reached, the reader sleeps until
+    inotify says it changed, and carries on from where it stopped, even in the middle of a line. It
+    ends when the file is deleted or renamed, or when stop (a pipe or an eventfd) becomes readable.
+    Only text and binary files can be followed.
+*/
+bool ptReaderFollow(ptReader *r, const char path[], int stop)
+{
+    if (r->fd <= STDIN_FILENO)
+        return fail(r, "only text and binary files can be followed");
+    if ((r->watch = inotify_init1(IN_CLOEXEC)) < 0)
+        return fail(r, "can't start inotify");
+    if (inotify_add_watch(r->watch, path, IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF) < 0)
+        return fail(r, "can't watch the input");
+    r->follow = true;
+    r->stop = stop;
+
+    return true;
+}
+
+/*
+    Sleeps until the followed file changes, for up to timeout milliseconds (-1: no limit). Returns
+    false on a timeout. Stopping, or the file going away, are changes too: the next read that finds
+    nothing new ends the record.
+*/
+static bool watch(ptReader *r, int timeout)
+{
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd p[2];
+    struct stat st;
+    ssize_t n;
+    int ready;
+    char *e;
+
+    p[0].fd = r->watch;
+    p[1].fd = r->stop;
+    p[0].events = p[1].events = POLLIN;
+    ready = poll(p, r->stop >= 0 ? 2 : 1, timeout);
+    if (ready < 0 && errno == EINTR)
+        return true;
+    if (ready <= 0)
+        return ready < 0;
+    if (r->stop >= 0 && (p[1].revents & POLLIN))
+        r->gone = true;
+    if (p[0].revents & POLLIN)
+    {
+        n = read(r->watch, events, sizeof(events));
+        for (e = events; n > 0 && e < events + n; e += sizeof(struct inotify_event) + ((struct inotify_event *)e)->len)
+            if (((struct inotify_event *)e)->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+                r->gone = true;
+        // A deleted file that's still open only says its link count changed.
+        if (!fstat(r->fd, &st) && st.st_nlink == 0)
+            r->gone = true;
+    }
+
+    return true;
+}
+
+/*
+    Reads whatever the file has past what was already read, without waiting. On a regular file that's
+    0 bytes at the (current) end of the file; on a pipe it blocks until something comes.
+*/
+static ssize_t readBlock(ptReader *r)
+{
+    ssize_t n;
+
+    do
+        n = read(r->fd, r->block, PT_IO_BLOCK);
+    while (n < 0 && errno == EINTR);
+    if (n > 0)
+    {
+        r->blockStart += r->end;
+        r->start = 0;
+        r->end = n;
+    }
+
+    return n;
+}
+
+/*
+    Reads the next block of a text or binary record, if the last one was all parsed. A pipe gives
+    whatever was written to it so far, so blocks may be of any size and cut samples anywhere. A followed
+    file is waited on once it's over, until it grows again.
+*/
+static bool fill(ptReader *r)
+{
+    ssize_t n;
+
+    if (r->start < r->end)
+        return true;
+    if (r->eof)
+        return false;
+    while ((n = readBlock(r)) == 0 && r->follow && !r->gone)
+        watch(r, -1);
+    if (n <= 0)
+    {
+        r->eof = true;
+        if (n < 0)
+            r->error = "read error";
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    Parses integers the way fscanf("%d") does: blanks are skipped, a sign may come before the digits and
+    anything else ends the record. A number cut at the end of a block carries on with the next one.
+*/
+static long int parseText(ptReader *r, dataType x[], long int max)
+{
+    long int n = 0;
+
+    if (r->start < r->end)
+    {
+        const char *p = r->block + r->start, *end = r->block + r->end;
+
+        for (; p < end && n < max; p++)
+        {
+            char c = *p;
+
+            if (c >= '0' && c <= '9')
+            {
+                r->value = 10*r->value + (c - '0');
+                r->state = 2;
+            }
+            else if (r->state == 2)
+            {
+                x[n++] = r->negative ? -r->value : r->value;
+                r->state = r->value = 0;
+                r->negative = false;
+                r->consumed = r->blockStart + (p - r->block);
+                p--;
+            }
+            else if (r->state == 0 && (c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f'))
+                continue;
+            else if (r->state == 0 && (c == '-' || c == '+'))
+            {
+                r->negative = c == '-';
+                r->state = 1;
+            }
+            else
+            {
+                // Not a number: the record ends here, as it would for fscanf().
+                r->eof = true;
+                r->start = r->end = 0;
+                return n;
+            }
+        }
+        r->start = p - r->block;
+    }
+    if (n < max && r->eof && r->state == 2 && !r->holdLast)
+    {
+        x[n++] = r->negative ? -r->value : r->value;
+        r->state = r->value = 0;
+        r->consumed = r->blockStart + r->end;
+    }
+
+    return n;
+}
+
+/*
+    16-bit little-endian samples; a sample cut between two blocks waits for its high byte.
+*/
+static long int parseBinary(ptReader *r, dataType x[], long int max)
+{
+    long int n = 0;
+
+    if (r->start < r->end)
+    {
+        const unsigned char *p = (const unsigned char *)r->block + r->start, *end = (const unsigned char *)r->block + r->end;
+
+        if (r->state)
+        {
+            x[n++] = (short)(r->value | (*p++ << 8));
+            r->state = 0;
+        }
+        for (; p + 1 < end && n < max; p += 2)
+            x[n++] = (short)(p[0] | (p[1] << 8));
+        if (p + 1 == end && n < max)
+        {
+            r->value = *p++;
+            r->state = 1;
+        }
+        r->start = p - (const unsigned char *)r->block;
+        r->consumed = r->blockStart + r->start - r->state;
+    }
+
+    return n;
+}
+
+/*
+    Reads up to max samples. Text and binary records read at most one block per call and return what
+    it had, which may be fewer than max samples on a pipe. Returns how many were read: 0 at the end of the record, -1
+    on a read error.
+*/
+long int ptReaderRead(ptReader *r, dataType x[], long int max)
+{
+    long int n = 0;
+    int v = 0, k;
+
+    if (r->format == PT_TEXT || r->format == PT_BINARY)
+    {
+        // Parse what's left on the block, or read a new one: a sample may take more than one.
+        do
+        {
+            fill(r);
+            n = r->format == PT_TEXT ? parseText(r, x, max) : parseBinary(r, x, max);
+        }
+        while (n == 0 && !r->eof);
+        return (n == 0 && r->error) ? -1 : n;
+    }
+
+    while (n < max)
+    {
+        if (r->format == PT_WFDB)
+        {
+            // Keep only the wanted signal of each frame.
+            for (k = 0; k < r->signals; k++)
+            {
+                int s;
+                if (!nextWfdb(r, &s))
+                    return ferror(r->f) ? -1 : n;
+                if (k == r->channel)
+                    v = s;
+            }
+            x[n++] = v;
+        }
+        else
+        {
+            if (r->next == r->count)
+            {
+                int i;
+                if (fread(r->record, 2, r->recordSize, r->f) != (size_t)r->recordSize)
+                    break;
+                // EDF samples are little-endian whatever the machine.
+                for (i = 0; i < r->recordSize; i++)
+                {
+                    unsigned char *p = (unsigned char *)&r->record[i];
+                    r->record[i] = (short)(p[0] | (p[1] << 8));
+                }
+                r->next = 0;
+            }
+            x[n++] = r->record[r->offset + r->next++];
+        }
+    }
+
+    return (n == 0 && ferror(r->f)) ? -1 : n;
+}
+
+/*
+    Skips to a byte offset of a text or binary file, which must be where a sample starts (or a blank
+    before it), as given by reader->consumed on an earlier run.
+*/
+bool ptReaderSeek(ptReader *r, long unsigned int offset)
+{
+    if (r->fd <= STDIN_FILENO || lseek(r->fd, offset, SEEK_SET) < 0)
+        return false;
+    r->blockStart = r->consumed = offset;
+    r->start = r->end = 0;
+    r->state = r->value = 0;
+    r->negative = r->eof = false;
+
+    return true;
+}
+
+/*
+    Adds up to size bytes of a file, from its start, to a 64-bit FNV-1a hash. Returns how many bytes
+    were hashed, or -1 on an error.
+*/
+static long int hashFile(int fd, long unsigned int size, long unsigned int *hash)
+{
+    unsigned char *block = malloc(PT_IO_BLOCK);
+    long unsigned int h = *hash, done = 0;
+    ssize_t n = 1, i;
+
+    if (!block)
+        return -1;
+    while (done < size && n > 0)
+    {
+        long unsigned int want = size - done < PT_IO_BLOCK ? size - done : PT_IO_BLOCK;
+
+        if ((n = pread(fd, block, want, done)) < 0 && errno == EINTR)
+        {
+            n = 1;
+            continue;
+        }
+        for (i = 0; i < n; i++)
+            h = (h ^ block[i])*1099511628211ul;
+        done += n > 0 ? n : 0;
+    }
+    free(block);
+    *hash = h;
+
+    return n < 0 ? -1 : (long int)done;
+}
+
+/*
+    Hashes the first size bytes of a file (64-bit FNV-1a). Returns false if it can't be read or is
+    shorter than that.
+*/
+bool ptHashPrefix(const char path[], long unsigned int size, long unsigned int *hash)
+{
+    int fd = open(path, O_RDONLY);
+    long int done;
+
+    if (fd < 0)
+        return false;
+    *hash = 14695981039346656037ul;
+    done = hashFile(fd, size, hash);
+    close(fd);
+
+    return done >= 0 && (long unsigned int)done == size;
+}
+
+/*
+    Hashes everything a record is read from: the file itself or, for WFDB, the header and the signal
+    file. Same record, same hash, wherever the files are. Returns false if it can't be read (or is the
+    standard input).
+*/
+bool ptHashRecord(const char path[], ptInputFormat format, int channel, long unsigned int *hash)
+{
+    ptReader r;
+    bool ok;
+
+    if (!strcmp(path, "-") || !ptReaderOpen(&r, path, format, channel))
+        return false;
+    *hash = 14695981039346656037ul;
+    ok = hashFile(r.f ? fileno(r.f) : r.fd, -1, hash) >= 0;
+    if (ok && format == PT_WFDB)
+    {
+        char header[PT_LINE];
+        int fd;
+
+        headerPath(path, header);
+        ok = (fd = open(header, O_RDONLY)) >= 0 && hashFile(fd, -1, hash) >= 0;
+        if (fd >= 0)
+            close(fd);
+    }
+    ptReaderClose(&r);
+
+    return ok;
+}
+
+/*
+    Waits up to seconds for more input. Returns false if there's nothing to read yet, true if there is
+    (or the record ended, or it isn't a pipe, a terminal or a followed file).
+*/
+bool ptReaderWait(ptReader *r, double seconds)
+{
+    struct pollfd p;
+    double deadline = now() + seconds;
+    ssize_t n;
+    int ready;
+
+    if (r->fd < 0 || r->start < r->end || r->eof)
+        return true;
+    if (r->follow)
+    {
+        // A regular file always polls as readable: try it, then sleep on inotify until the deadline.
+        while ((n = readBlock(r)) == 0 && !r->gone)
+        {
+            double left = deadline - now();
+            if (left <= 0 || !watch(r, (int)(left*1000 + 0.999)))
+                return false;
+        }
+        return true;
+    }
+    p.fd = r->fd;
+    p.events = POLLIN;
+    do
+        ready = poll(&p, 1, (int)(seconds*1000 + 0.999));
+    while (ready < 0 && errno == EINTR);
+
+    return ready != 0;
+}
+
+void ptReaderClose(ptReader *r)
+{
+    if (r->f)
+        fclose(r->f);
+    if (r->fd > STDIN_FILENO)
+        close(r->fd);
+    if (r->watch >= 0)
+        close(r->watch);
+    free(r->record);
+    free(r->block);
+    r->f = NULL;
+    r->fd = r->watch = -1;
+    r->record = NULL;
+    r->block = NULL;
+}
+
+/*
+    Makes room for a line on the block. The first line on an empty block starts the latency clock.
+*/
+static char *reserve(ptWriter *w, size_t size)
+{
+    if (w->used + size > PT_IO_BLOCK)
+        ptWriterFlush(w);
+    if (!w->used && w->latency >= 0)
+        w->due = now() + w->latency;
+
+    return w->block + w->used;
+}
+
+static void writeDense(int out, void *context)
+{
+    ptWriter *w = context;
+    char *p = reserve(w, 2);
+
+    p[0] = out ? '1' : '0';
+    p[1] = '\n';
+    w->used += 2;
+}
+
+/*
+    Sets up a writer on an open file descriptor. config is the detector's, for the framing and the
+    sampling rate. latency is how long, in seconds, a line may wait before it's written; a negative one
+    waits for a full block. Returns false if there's no memory for the block.
+*/
+bool ptWriterInit(ptWriter *w, int fd, ptOutputFormat format, const ptConfig *config, double latency)
+{
+    w->fd = fd;
+    w->format = format;
+    w->fs = config->fs;
+    w->shift = config->delay + 1;
+    w->last = w->beats = 0;
+    w->used = 0;
+    w->latency = latency;
+    w->due = 0;
+    w->failed = false;
+    ptFramerInit(&w->framer, config);
+
+    return (w->block = malloc(PT_IO_BLOCK)) != NULL;
+}
+
+/*
+    Takes the detector's result for the newest sample. The dense output trails the input by the size
+    of the buffer, like panTompkins(); the others are written as soon as a beat is found.
+*/
+void ptWriterStep(ptWriter *w, bool beat, long unsigned int position)
+{
+    long unsigned int at;
+
+    if (w->format == PT_DENSE)
+    {
+        ptFramerStep(&w->framer, beat, position, writeDense, w);
+        return;
+    }
+    // Beats before the first dense output line can't be placed on its timeline.
+    if (!beat || position < (long unsigned int)w->shift)
+        return;
+    at = position - w->shift;
+
+    if (w->format == PT_SPARSE)
+        w->used += sprintf(reserve(w, 32), "%lu\n", at);
+    else if (w->format == PT_RR)
+    {
+        if (w->beats)
+            w->used += sprintf(reserve(w, 32), "%.1f\n", 1000.0*(at - w->last)/w->fs);
+    }
+    else
+    {
+        long unsigned int ms = (long unsigned int)(1000.0*at/w->fs + 0.5);
+        char time[32];
+
+        if (ms >= 3600000ul)
+            snprintf(time, sizeof(time), "%lu:%02lu:%02lu.%03lu", ms/3600000, ms/60000 % 60, ms/1000 % 60, ms % 1000);
+        else
+            snprintf(time, sizeof(time), "%lu:%02lu.%03lu", ms/60000, ms/1000 % 60, ms % 1000);
+        w->used += sprintf(reserve(w, 96), "%12s %8lu     N    0    0    0\n", time, at);
+    }
+    w->last = at;
+    w->beats++;
+}
+
+/*
+    How long, in seconds, until the lines on the block must be written. Negative if there's nothing to
+    write or no latency was set.
+*/
+double ptWriterIdle(const ptWriter *w)
+{
+    double left;
+
+    if (!w->used || w->latency < 0)
+        return -1;
+    left = w->due - now();
+
+    return left > 0 ? left : 0;
+}
+
+/*
+    Writes the block if it's due. Meant to be called after every block of input, so the clock is read
+    once per block instead of once per sample.
+*/
+void ptWriterPoll(ptWriter *w)
+{
+    if (w->used && w->latency >= 0 && now() >= w->due)
+        ptWriterFlush(w);
+}
+
+/*
+    Writes everything on the block. Returns false if a write failed, now or before.
+*/
+bool ptWriterFlush(ptWriter *w)
+{
+    size_t done = 0;
+
+    while (done < w->used && !w->failed)
+    {
+        ssize_t n = write(w->fd, w->block + done, w->used - done);
+        if (n < 0 && errno != EINTR)
+            w->failed = true;
+        else if (n > 0)
+            done += n;
+    }
+    w->used = 0;
+
+    return !w->failed;
+}
+
+/*
+    Ends the output: the dense output writes what's left on the buffer, as panTompkins() does. Frees
+    the block; the file descriptor is left open. Returns false if a write failed.
+*/
+bool ptWriterFinish(ptWriter *w)
+{
+    bool ok;
+
+    if (w->format == PT_DENSE)
+        ptFramerFlush(&w->framer, writeDense, w);
+    ok = ptWriterFlush(w);
+    free(w->block);
+    w->block = NULL;
+
+    return ok;
+}
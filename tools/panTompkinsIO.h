@@ -0,0 +1,131 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsIO.h                                                         *
+ *       Header for panTompkinsIO.c                                              *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ */
+
+#ifndef PAN_TOMPKINS_IO
+#define PAN_TOMPKINS_IO
+
+#include "panTompkinsCore.h"
+#include <stdio.h>
+#include <stddef.h>
+
+// Size of the blocks read from and written to files, pipes and terminals.
+#define PT_IO_BLOCK (1 << 20)
+
+typedef enum {PT_TEXT, PT_BINARY, PT_WFDB, PT_EDF} ptInputFormat;
+typedef enum {PT_DENSE, PT_SPARSE, PT_RR, PT_ANNOTATIONS} ptOutputFormat;
+
+/*
+    Reads the samples of one signal out of a record:
+    - text: one integer per line, as panTompkins() reads.
+    - binary: 16-bit little-endian signed integers.
+    - WFDB: a .hea header and its signal file, on format 16, 212 or 80.
+    - EDF: the digital values of one signal of an EDF file.
+    The sampling frequency is taken from the header, when there's one (0 otherwise). Text and binary
+    records are read a block at a time straight from the file descriptor and parsed as they come, so a
+    sample split between two blocks (or two writes on a pipe) is put back together.
+*/
+typedef struct
+{
+    FILE *f;                    // WFDB and EDF records.
+    int fd;                     // Text and binary records.
+    ptInputFormat format;
+    int fs;
+    int channel, signals;       // Which signal is read, out of how many.
+    const char *error;          // Why the last call failed.
+
+    // Text and binary: bytes from start to end on block weren't parsed yet.
+    char *block;
+    size_t start, end;
+    long unsigned int blockStart;   // Offset of block[0] on the file.
+    long unsigned int consumed;     // Offset right past the last sample returned.
+    bool eof;
+    int state;                  // Text: 0 between numbers, 1 after a sign, 2 inside one. Binary: 1 after a low byte.
+    int value;                  // The number being parsed, or the low byte already read.
+    bool negative;
+    bool holdLast;              // Text: a number ending the file without a line break may still grow; leave it out.
+
+    // Follow mode: at the end of the file, wait for more to be appended instead of stopping.
+    bool follow, gone;          // gone: the file was deleted or renamed, it won't grow anymore.
+    int watch;                  // inotify descriptor watching the file.
+    int stop;                   // Readable once following must stop (-1 if there's no such thing).
+
+    // WFDB: samples of every signal come interleaved, frame after frame.
+    int wfdbFormat;
+    long unsigned int position; // Position on the interleaved sample stream.
+    int pending;                // Second sample of a 212 pair, already decoded.
+
+    // EDF: each data record holds perRecord[k] samples of signal k, one signal after the other.
+    short *record;
+    int recordSize, offset, count, next;
+} ptReader;
+
+/*
+    Writes what the detector finds:
+    - dense: a 0 or 1 for each sample, exactly what panTompkins() writes.
+    - sparse: the sample number of each beat, on the same timeline as the dense output.
+    - RR: the interval since the previous beat, in milliseconds, one per beat after the first.
+    - annotations: one line per beat like rdann prints them: time, sample number and type (N).
+    Lines pile up on a block that goes out with a single write() once it's full, or once its oldest line
+    is older than the flush latency, so a live pipeline doesn't stall waiting for a full block.
+*/
+typedef struct
+{
+    int fd;
+    ptOutputFormat format;
+    ptFramer framer;
+    int fs, shift;              // Beats are moved shift samples back, to line up with the dense output.
+    long unsigned int last, beats;
+
+    char *block;
+    size_t used;
+    double latency;             // Seconds a line may wait on the block. Negative: until it's full.
+    double due;                 // When the block must go out (CLOCK_MONOTONIC seconds).
+    bool failed;                // A write failed.
+} ptWriter;
+
+bool ptReaderOpen(ptReader *reader, const char path[], ptInputFormat format, int channel);
+long int ptReaderRead(ptReader *reader, dataType x[], long int max);
+void ptReaderClose(ptReader *reader);
+bool ptReaderFollow(ptReader *reader, const char path[], int stop);
+bool ptReaderSeek(ptReader *reader, long unsigned int offset);
+bool ptReaderWait(ptReader *reader, double seconds);
+ptInputFormat ptGuessFormat(const char path[]);
+bool ptHashPrefix(const char path[], long unsigned int size, long unsigned int *hash);
+bool ptHashRecord(const char path[], ptInputFormat format, int channel, long unsigned int *hash);
+
+bool ptWriterInit(ptWriter *writer, int fd, ptOutputFormat format, const ptConfig *config, double latency);
+void ptWriterStep(ptWriter *writer, bool beat, long unsigned int position);
+double ptWriterIdle(const ptWriter *writer);
+void ptWriterPoll(ptWriter *writer);
+bool ptWriterFlush(ptWriter *writer);
+bool ptWriterFinish(ptWriter *writer);
+
+#endif
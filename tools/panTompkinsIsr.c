@@ -0,0 +1,341 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsIsr.c                                                        *
+ *       Interrupt and DMA driven acquisition harness for the microcontroller    *
+ *       engine                                                                  *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Linux harness for the interrupt and DMA driven APIs of the microcontroller    *
+ * engine. A record is replayed as an ADC would deliver it: every sampling       *
+ * period an "interrupt" pushes the next sample with ptMcuPush(), while the main *
+ * loop drains the queue with ptMcuDrain(), optionally busy with other work for  *
+ * a while after each drain, and sleeps on a semaphore until the next interrupt, *
+ * the way a firmware would wait for one. With -d the "interrupt" is a simulated *
+ * DMA instead: it writes each sample on a ping-pong buffer, whether the main    *
+ * loop holds that half or not, and calls ptMcuDmaComplete() when a half is      *
+ * full; the main loop runs ptMcuDmaRun().                                       *
+ *                                                                               *
+ * The interrupt is either a SIGALRM handler, from a POSIX timer, that preempts  *
+ * the main loop at any point like a real interrupt would, or a thread on an     *
+ * absolute schedule that runs alongside it on another core, which exercises the *
+ * ordering between the two sides. Conversions a late interrupt missed are       *
+ * pushed when it runs, so no sample is lost to the timer.                       *
+ *                                                                               *
+ * It reports, as JSON: samples pushed and dropped (queue full, or halves lost), *
+ * DMA overruns, late interrupts, the cost of each push, the most samples        *
+ * pending at a drain, and whether the beats found match the detector stepped    *
+ * directly over the same samples. Exits with 1 if samples were dropped, a half  *
+ * was overrun or the beats differ.                                              *
+ *-------------------------------------------------------------------------------*
+ */
+
+#define _GNU_SOURCE
+
+#include "panTompkinsRecord.h"
+#include "panTompkinsMcu.h"
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Beats found by ptMcuDrain() or by the reference run.
+typedef struct
+{
+    uint32_t *position;
+    long unsigned int n, capacity;
+} beats;
+
+// The detector and the simulated ADC, shared by the "interrupt" (a signal handler or the timer thread)
+// and the main loop like they would be on the device.
+static ptMcu mcu;
+static ptMcuDma dma;
+static int16_t *buffer;
+static const dataType *samples;
+static long unsigned int total;
+static volatile long unsigned int produced;
+static volatile sig_atomic_t done;
+static sem_t wake;
+static timer_t timer;
+static long long period;
+
+// Kept by the interrupt only, read once it's over.
+static long long pushTotal, pushMax;
+static long unsigned int late;
+
+static long long now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+/*
+    What the ADC interrupt does for each conversion: pushes the sample, timing ptMcuPush(), and wakes
+    the main loop. ticks is more than 1 when the interrupt came late and conversions piled up. With a
+    ping-pong transfer the sample is written on the buffer instead, whoever holds that half, like a DMA
+    would, and the main loop is only woken when a half is complete.
+*/
+static void convert(long unsigned int ticks)
+{
+    long long start, cost;
+    bool complete = false;
+
+    late += ticks - 1;
+    while (ticks-- && produced < total)
+    {
+        start = now();
+        if (buffer)
+        {
+            buffer[produced % (2*dma.length)] = (int16_t)samples[produced];
+            if ((produced + 1) % dma.length == 0)
+            {
+                ptMcuDmaComplete(&dma);
+                complete = true;
+            }
+        }
+        else
+            ptMcuPush(&mcu, (int16_t)samples[produced]);
+        cost = now() - start;
+        pushTotal += cost;
+        if (cost > pushMax)
+            pushMax = cost;
+        produced = produced + 1;
+    }
+    if (produced == total)
+        done = 1;
+    if (!buffer || complete || done)
+        sem_post(&wake);
+}
+
+static void onTimer(int signal)
+{
+    int saved = errno, overrun = timer_getoverrun(timer);
+
+    (void)signal;
+    convert(1 + (overrun > 0 ? overrun : 0));
+    errno = saved;
+}
+
+/*
+    The interrupt as a thread, running alongside the main loop (on another core if there's one): it
+    sleeps until each conversion is due on an absolute schedule.
+*/
+static void *timerThread(void *unused)
+{
+    struct timespec deadline;
+    long long due = now(), t;
+
+    (void)unused;
+    while (!done)
+    {
+        due += period;
+        deadline.tv_sec = due/1000000000LL;
+        deadline.tv_nsec = due%1000000000LL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+            ;
+        t = now();
+        convert(1 + (t > due ? (t - due)/period : 0));
+        due += (t > due ? (t - due)/period : 0)*period;
+    }
+
+    return NULL;
+}
+
+static void onBeat(uint32_t position, void *context)
+{
+    beats *b = context;
+
+    if (b->n < b->capacity)
+        b->position[b->n] = position;
+    b->n++;
+}
+
+static void usage(const char program[])
+{
+    fprintf(stderr,
+            "usage: %s [-m signal|thread] [-a speed] [-w microseconds] [-n samples] [-d length] [input.txt]\n"
+            "  -m  how the ADC interrupt is simulated: a SIGALRM handler from a POSIX timer interrupting the\n"
+            "      main loop, or a thread on an absolute schedule (signal)\n"
+            "  -a  interrupts this many times faster than %d Hz (1)\n"
+            "  -w  busy work the main loop does after each drain, as other firmware tasks would (0)\n"
+            "  -n  samples of the record to replay (all)\n"
+            "  -d  acquire through a ping-pong DMA buffer with halves of length samples, processed as blocks\n"
+            "      by ptMcuDmaRun(), instead of ptMcuPush() and ptMcuDrain()\n"
+            "The record is examples/test_input.txt by default, sampled at %d Hz.\n",
+            program, PT_MCU_FS, PT_MCU_FS);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    static ptMcu reference;
+    const char *path = "examples/test_input.txt", *mode = "signal";
+    long unsigned int i, limit = 0, length = 0, drains = 0, pending, maxPending = 0, dropped;
+    long long work = 0, start, elapsed, until;
+    double speed = 1;
+    bool matches, finished;
+    uint32_t position;
+    struct sigaction action;
+    struct sigevent event;
+    struct itimerspec interval;
+    pthread_t thread;
+    ptRecord record;
+    beats expected, found;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:a:w:n:d:h")) != -1)
+    {
+        if (opt == 'm')
+            mode = optarg;
+        else if (opt == 'a')
+            speed = atof(optarg);
+        else if (opt == 'w')
+            work = atoll(optarg)*1000;
+        else if (opt == 'n')
+            limit = strtoul(optarg, NULL, 10);
+        else if (opt == 'd')
+            length = strtoul(optarg, NULL, 10);
+        else
+            usage(argv[0]);
+    }
+    if (optind < argc - 1 || speed <= 0 || (strcmp(mode, "signal") && strcmp(mode, "thread")))
+        usage(argv[0]);
+    if (optind == argc - 1)
+        path = argv[optind];
+    if (!ptRecordLoad(&record, path, PT_MCU_FS))
+    {
+        fprintf(stderr, "Couldn't read %s\n", path);
+        return 1;
+    }
+    samples = record.x;
+    total = limit && limit < record.n ? limit : record.n;
+    // The DMA only interrupts on full halves, so a last partial one would never be processed.
+    if (length)
+        total -= total % length;
+    period = (long long)(1e9/(PT_MCU_FS*speed));
+    if (period < 1000)
+        period = 1000;
+
+    // What the detector finds when every sample gets to it, stepped directly.
+    expected.capacity = found.capacity = total/PT_MCU_REFRACTORY + 2;
+    expected.position = malloc(expected.capacity*sizeof(uint32_t));
+    found.position = malloc(found.capacity*sizeof(uint32_t));
+    expected.n = found.n = 0;
+    ptMcuInit(&reference);
+    for (i = 0; i < total; i++)
+        if (ptMcuStep(&reference, (int16_t)samples[i], &position))
+            onBeat(position, &expected);
+
+    ptMcuInit(&mcu);
+    if (length)
+    {
+        buffer = calloc(2*length, sizeof(int16_t));
+        ptMcuDmaInit(&dma, buffer, length);
+    }
+    sem_init(&wake, 0, 0);
+    start = now();
+    if (!strcmp(mode, "signal"))
+    {
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = onTimer;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGALRM, &action, NULL);
+        memset(&event, 0, sizeof(event));
+        event.sigev_notify = SIGEV_SIGNAL;
+        event.sigev_signo = SIGALRM;
+        if (timer_create(CLOCK_MONOTONIC, &event, &timer))
+        {
+            perror("timer_create");
+            return 1;
+        }
+        interval.it_value.tv_sec = interval.it_interval.tv_sec = period/1000000000LL;
+        interval.it_value.tv_nsec = interval.it_interval.tv_nsec = period%1000000000LL;
+        timer_settime(timer, 0, &interval, NULL);
+    }
+    else if (pthread_create(&thread, NULL, timerThread, NULL))
+    {
+        perror("pthread_create");
+        return 1;
+    }
+
+    // The main loop: drain whatever is pending, do the other work, sleep until the next interrupt.
+    for (;;)
+    {
+        finished = done;
+        pending = buffer ? (dma.filled - dma.released)*length : mcu.head - mcu.tail;
+        if (pending > maxPending)
+            maxPending = pending;
+        if (buffer)
+            ptMcuDmaRun(&mcu, &dma, onBeat, &found);
+        else
+            ptMcuDrain(&mcu, onBeat, &found);
+        drains++;
+        if (finished)
+            break;
+        for (until = now() + work; work && now() < until; )
+            ;
+        while (sem_wait(&wake) && errno == EINTR)
+            ;
+    }
+    elapsed = now() - start;
+    if (!strcmp(mode, "signal"))
+        timer_delete(timer);
+    else
+        pthread_join(thread, NULL);
+
+    matches = found.n == expected.n && !memcmp(found.position, expected.position, (found.n < found.capacity ? found.n : found.capacity)*sizeof(uint32_t));
+    printf("{\n  \"record\": \"%s\",\n  \"mode\": \"%s\",\n  \"fs\": %d,\n  \"speed\": %g,\n", path, mode, PT_MCU_FS, speed);
+    printf("  \"period_us\": %.1f,\n  \"work_us\": %lld,\n", period/1e3, work/1000);
+    if (buffer)
+        printf("  \"dma_half\": %lu,\n  \"lost_halves\": %lu,\n  \"overruns\": %lu,\n", length,
+               (long unsigned int)dma.lost, (long unsigned int)dma.overruns);
+    else
+        printf("  \"queue\": %d,\n", PT_MCU_QUEUE);
+    dropped = buffer ? (long unsigned int)dma.lost*length : (long unsigned int)mcu.dropped;
+    printf("  \"seconds\": %.3f,\n  \"samples\": %lu,\n  \"pushed\": %lu,\n  \"dropped\": %lu,\n",
+           elapsed/1e9, total, total - dropped, dropped);
+    printf("  \"late_interrupts\": %lu,\n", late);
+    printf("  \"push_ns\": {\"mean\": %.1f, \"max\": %lld},\n", total ? (double)pushTotal/total : 0.0, pushMax);
+    printf("  \"drains\": %lu,\n  \"max_pending\": %lu,\n", drains, maxPending);
+    printf("  \"beats\": %lu,\n  \"reference_beats\": %lu,\n  \"matches_reference\": %s\n}\n",
+           found.n, expected.n, matches ? "true" : "false");
+
+    free(expected.position);
+    free(found.position);
+    free(buffer);
+    ptRecordFree(&record);
+
+    return matches && !dropped && !(buffer && dma.overruns) ? 0 : 1;
+}
@@ -0,0 +1,874 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsLoad.c                                                       *
+ *       Load generator for ptServer                                             *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Load generator and capacity benchmark for ptServer. Opens a growing number of *
+ * connections, each replaying a record (examples/test_input.txt resampled to    *
+ * the rate being tested, or a synthetic one) in blocks of samples, on a         *
+ * real-time schedule or a given number of times faster. Every beat event is     *
+ * timed from the moment the block holding the sample it was found at was        *
+ * queued, and the beats each stream got back are checked against a local run of *
+ * the detector over the samples it sent. Each step reports the latency          *
+ * percentiles, samples sent against the schedule, missing beats, errors and the *
+ * CPU used by the server and by the generator, as JSON. The stream count        *
+ * doubles until a step fails (samples late, beats missing, errors or the 99th   *
+ * percentile latency over the limit) and is then bisected, so the saturation    *
+ * point is found for each sampling frequency. With -m shm the streams go        *
+ * through shared memory rings instead of the socket. Run it on cores the server *
+ * doesn't use, or its own CPU use shows up as server latency.                   *
+ *-------------------------------------------------------------------------------*
+ */
+
+#define _GNU_SOURCE
+
+#include "panTompkinsRecord.h"
+#include "panTompkinsCore.h"
+#include "panTompkinsProtocol.h"
+#include "panTompkinsShm.h"
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Send times kept per stream, one per block of samples. A beat found on an older block than that has
+// no latency measured (it's counted as stale).
+#define PT_SENT 512
+#define PT_SENT_MASK (PT_SENT - 1)
+
+// Bytes a stream may have waiting to be sent when the server doesn't keep up.
+#define PT_QUEUE 4096
+
+// Latencies are kept on a histogram with 10us buckets. Anything slower goes on the last one (the exact
+// maximum is kept apart).
+#define LATENCY_BUCKETS (1 << 17)
+
+typedef struct
+{
+    long unsigned int bucket[LATENCY_BUCKETS];
+    long unsigned int count, max, stale;
+} latency;
+
+/*
+    One simulated patient: a connection replaying the record from its start, one block at a time.
+*/
+typedef struct
+{
+    int fd;
+    unsigned int id;
+    double phase;                   // Offset of its sending schedule, so the streams don't send at once.
+    long unsigned int sent;         // Samples queued so far.
+    long unsigned int beats;
+    double sentAt[PT_SENT];         // When each of the last blocks was queued.
+    unsigned char queue[PT_QUEUE], input[PT_BEAT_SIZE];
+    size_t pending, received;
+    ptShm shm;                      // With -m shm: the rings the samples and beats go through.
+    bool failed, done;
+} stream;
+
+/*
+    What every client thread needs to know about the current step.
+*/
+typedef struct
+{
+    const short *x;                 // Record to replay, looped.
+    long unsigned int n;
+    int fs, block;                  // Sampling frequency and samples per message.
+    double rate, seconds, start;    // Samples per second per stream (fs times the acceleration).
+    const char *socket;
+    bool shared;                    // Streams on shared memory rather than on the socket.
+    pthread_barrier_t ready;
+} step;
+
+/*
+    A client thread and the streams it drives.
+*/
+typedef struct
+{
+    pthread_t thread;
+    step *step;
+    stream *streams;
+    int count, epoll;
+    int wake;                       // eventfd the server signals when it writes beats (-m shm).
+    latency *latency;
+    int errors, connectErrors, lastError;
+} client;
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+static void addLatency(latency *l, double seconds)
+{
+    long unsigned int us = seconds > 0 ? (long unsigned int)(seconds*1e6) : 0;
+
+    l->bucket[us/10 < LATENCY_BUCKETS ? us/10 : LATENCY_BUCKETS - 1]++;
+    l->count++;
+    if (us > l->max)
+        l->max = us;
+}
+
+static long unsigned int percentile(const latency *l, double p)
+{
+    long unsigned int target = (long unsigned int)(p*l->count), seen = 0;
+    int k;
+
+    for (k = 0; k < LATENCY_BUCKETS - 1; k++)
+    {
+        seen += l->bucket[k];
+        if (seen > target)
+            return 10*k;
+    }
+
+    return l->max;
+}
+
+// CPU time used so far by a process, in seconds. Negative if it can't be read.
+static double processCpu(int pid)
+{
+    char path[64];
+    unsigned long utime, stime;
+    FILE *f;
+    int read;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if (pid <= 0 || !(f = fopen(path, "r")))
+        return -1;
+    // The command name may have spaces: skip up to its closing parenthesis.
+    read = fscanf(f, "%*[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    fclose(f);
+
+    return read == 2 ? (double)(utime + stime)/sysconf(_SC_CLK_TCK) : -1;
+}
+
+static double selfCpu()
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)*1e-6;
+}
+
+/*
+    Resamples a record from 360 Hz to fs with linear interpolation, clipped to 16 bits.
+*/
+static short *resample(const ptRecord *record, int fs, long unsigned int *n)
+{
+    long unsigned int k;
+    short *x;
+
+    *n = (record->n - 1)*fs/record->fs + 1;
+    if (!(x = malloc(*n*sizeof(short))))
+        return NULL;
+    for (k = 0; k < *n; k++)
+    {
+        double t = (double)k*record->fs/fs, v;
+        long unsigned int i = (long unsigned int)t;
+
+        v = i + 1 < record->n ? record->x[i] + (t - i)*(record->x[i + 1] - record->x[i]) : record->x[i];
+        x[k] = v > 32767 ? 32767 : v < -32768 ? -32768 : (short)lround(v);
+    }
+
+    return x;
+}
+
+/*
+    Runs the detector locally over the first n samples of the looped record and keeps the sample at
+    which each beat is found: a stream that sent s samples must get back every beat found before s.
+*/
+static long unsigned int *expectedBeats(const short x[], long unsigned int length, int fs, long unsigned int n, long unsigned int *count)
+{
+    static ptFilter filter;
+    ptDecision decision;
+    ptHistory history;
+    ptConfig config;
+    long unsigned int k, position, capacity = 1024, *found = malloc(capacity*sizeof(long unsigned int));
+
+    ptDefaultConfig(&config, fs);
+    ptFilterInit(&filter, &config);
+    ptFilterHistory(&filter, &history);
+    ptDecisionInit(&decision);
+    *count = 0;
+    for (k = 0; found && k < n; k++)
+    {
+        ptFilterStep(&filter, x[k % length]);
+        if (ptDecisionStep(&decision, &config, &history, &position))
+        {
+            if (*count == capacity)
+            {
+                long unsigned int *grown = realloc(found, 2*capacity*sizeof(long unsigned int));
+                if (!grown)
+                {
+                    free(found);
+                    return NULL;
+                }
+                found = grown;
+                capacity *= 2;
+            }
+            found[(*count)++] = k;
+        }
+    }
+
+    return found;
+}
+
+// How many of the (sorted) expected beats were found before sample n.
+static long unsigned int countBefore(const long unsigned int found[], long unsigned int count, long unsigned int n)
+{
+    long unsigned int low = 0, high = count;
+
+    while (low < high)
+    {
+        long unsigned int middle = (low + high)/2;
+        if (found[middle] < n)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+/*
+    Creates the shared memory segment of a stream and hands it to the server, along with the eventfd of
+    this thread. The rings hold a quarter of a second of samples, or more with acceleration.
+*/
+static bool attachStream(client *c, stream *s)
+{
+    const step *st = c->step;
+    char control[CMSG_SPACE(2*sizeof(int))];
+    unsigned char message = PT_MSG_ATTACH;
+    unsigned int samples = 1024;
+    struct iovec data = {&message, PT_ATTACH_SIZE};
+    struct msghdr m;
+    struct cmsghdr *cmsg;
+    int fds[2];
+    bool ok;
+
+    while (samples < st->rate/4 || samples < 4u*st->block)
+        samples *= 2;
+    if (!ptShmCreate(&s->shm, s->id, st->fs, samples, 256))
+        return false;
+    fds[0] = s->shm.fd;
+    fds[1] = c->wake;
+
+    memset(&m, 0, sizeof(m));
+    m.msg_iov = &data;
+    m.msg_iovlen = 1;
+    m.msg_control = control;
+    m.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&m);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2*sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, 2*sizeof(int));
+    ok = sendmsg(s->fd, &m, MSG_NOSIGNAL) == PT_ATTACH_SIZE;
+
+    // The reply brings the doorbell of the worker that got the stream.
+    m.msg_controllen = sizeof(control);
+    ok = ok && recvmsg(s->fd, &m, MSG_CMSG_CLOEXEC) == 1 && message == PT_MSG_ATTACHED;
+    cmsg = CMSG_FIRSTHDR(&m);
+    if (ok && cmsg && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&s->shm.wake, CMSG_DATA(cmsg), sizeof(int));
+    // The server has it mapped by now, or never will.
+    close(s->shm.fd);
+    s->shm.fd = -1;
+    if (!ok)
+        ptShmClose(&s->shm);
+
+    return ok;
+}
+
+static bool connectStream(client *c, stream *s)
+{
+    const step *st = c->step;
+    struct sockaddr_un address;
+    struct epoll_event e;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, st->socket, sizeof(address.sun_path) - 1);
+    if ((s->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 || connect(s->fd, (struct sockaddr *)&address, sizeof(address)))
+    {
+        if (s->fd >= 0)
+            close(s->fd);
+        s->fd = -1;
+        s->failed = true;
+        return false;
+    }
+    if (st->shared && !attachStream(c, s))
+    {
+        close(s->fd);
+        s->fd = -1;
+        s->failed = true;
+        return false;
+    }
+    if (!st->shared)
+    {
+        s->queue[0] = PT_MSG_OPEN;
+        ptPut32(s->queue + 1, s->id);
+        ptPut32(s->queue + 5, st->fs);
+        s->pending = PT_OPEN_SIZE;
+    }
+
+    e.events = EPOLLIN;
+    e.data.ptr = s;
+    epoll_ctl(c->epoll, EPOLL_CTL_ADD, s->fd, &e);
+
+    return true;
+}
+
+static void flush(stream *s)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < s->pending && (n = send(s->fd, s->queue + done, s->pending - done, MSG_NOSIGNAL | MSG_DONTWAIT)) > 0)
+        done += n;
+    memmove(s->queue, s->queue + done, s->pending - done);
+    s->pending -= done;
+}
+
+/*
+    Queues every block that is due by time t. Returns when the next one will be.
+*/
+static double feed(client *c, stream *s, double t)
+{
+    const step *st = c->step;
+    size_t size = PT_SAMPLES_HEADER + 2*st->block;
+    double due = (t - st->start - s->phase)*st->rate;
+    int k;
+
+    // Samples go straight into the ring, wrapping around if needed.
+    while (st->shared && s->sent + st->block <= due && ptShmSpace(&s->shm) >= (unsigned int)st->block)
+    {
+        unsigned int count, done;
+
+        s->sentAt[(s->sent/st->block) & PT_SENT_MASK] = t;
+        for (done = 0; done < (unsigned int)st->block; done += count)
+        {
+            short *p = ptShmReserve(&s->shm, &count);
+
+            if (count > st->block - done)
+                count = st->block - done;
+            for (k = 0; k < (int)count; k++)
+                p[k] = st->x[(s->sent + done + k) % st->n];
+            ptShmCommit(&s->shm, count);
+        }
+        s->sent += st->block;
+    }
+
+    while (!st->shared && s->sent + st->block <= due && s->pending + size <= PT_QUEUE)
+    {
+        unsigned char *p = s->queue + s->pending;
+
+        p[0] = PT_MSG_SAMPLES;
+        p[1] = st->block & 0xFF;
+        p[2] = st->block >> 8;
+        for (k = 0; k < st->block; k++)
+        {
+            short v = st->x[(s->sent + k) % st->n];
+            p[PT_SAMPLES_HEADER + 2*k] = v & 0xFF;
+            p[PT_SAMPLES_HEADER + 2*k + 1] = (v >> 8) & 0xFF;
+        }
+        s->sentAt[(s->sent/st->block) & PT_SENT_MASK] = t;
+        s->sent += st->block;
+        s->pending += size;
+    }
+    if (s->pending)
+        flush(s);
+
+    return st->start + s->phase + (s->sent + st->block)/st->rate;
+}
+
+static void beatArrived(client *c, stream *s, long unsigned int found, double t)
+{
+    long unsigned int block = found/c->step->block;
+
+    if (s->sent/c->step->block - block <= PT_SENT)
+        addLatency(c->latency, t - s->sentAt[block & PT_SENT_MASK]);
+    else
+        c->latency->stale++;
+    s->beats++;
+}
+
+/*
+    Reads the beats on the event rings of every stream of a thread. Unless arm is false, marks each ring
+    as waiting once it's empty; returns false if one got a beat meanwhile.
+*/
+static bool readRings(client *c, double t, bool arm)
+{
+    const ptShmBeat *b;
+    unsigned int count, k;
+    bool idle = true;
+    int j;
+
+    for (j = 0; j < c->count; j++)
+    {
+        stream *s = &c->streams[j];
+
+        if (!s->shm.header)
+            continue;
+        while ((b = ptShmBeats(&s->shm, &count)), count > 0)
+        {
+            for (k = 0; k < count; k++)
+                beatArrived(c, s, b[k].found, t);
+            ptShmBeatsDone(&s->shm, count);
+        }
+        if (arm && !ptShmClientSleep(&s->shm))
+            idle = false;
+    }
+
+    return idle;
+}
+
+/*
+    Reads the events of a stream, timing each beat from the moment the block holding the sample it was
+    found at was queued. Returns false once the server closed the connection.
+*/
+static bool receive(client *c, stream *s, double t)
+{
+    unsigned char buffer[4096];
+    ssize_t n = recv(s->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    ssize_t k;
+
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+        return false;
+    for (k = 0; k < n; k++)
+    {
+        s->input[s->received++] = buffer[k];
+        if (s->input[0] == PT_MSG_ERROR && s->received == PT_ERROR_SIZE)
+        {
+            c->errors++;
+            c->lastError = s->input[1];
+            s->failed = true;
+            s->received = 0;
+        }
+        else if (s->input[0] == PT_MSG_BEAT && s->received == PT_BEAT_SIZE)
+        {
+            beatArrived(c, s, ptGet64(s->input + 13), t);
+            s->received = 0;
+        }
+        else if (s->input[0] != PT_MSG_ERROR && s->input[0] != PT_MSG_BEAT)
+        {
+            c->errors++;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void *run(void *context)
+{
+    client *c = context;
+    step *st = c->step;
+    struct epoll_event events[256];
+    double t, next, end, deadline;
+    int k, n, open;
+
+    c->epoll = epoll_create1(EPOLL_CLOEXEC);
+    c->wake = -1;
+    if (st->shared)
+    {
+        struct epoll_event e = {EPOLLIN, {NULL}};
+
+        c->wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        epoll_ctl(c->epoll, EPOLL_CTL_ADD, c->wake, &e);
+    }
+    for (k = 0; k < c->count; k++)
+        if (!connectStream(c, &c->streams[k]))
+            c->connectErrors++;
+    pthread_barrier_wait(&st->ready);   // Every stream connected.
+    pthread_barrier_wait(&st->ready);   // The start time was set.
+
+    // Sends on schedule and reads the beats in between.
+    end = st->start + st->seconds;
+    while ((t = now()) < end)
+    {
+        next = end;
+        for (k = 0; k < c->count; k++)
+            if (!c->streams[k].failed)
+            {
+                double due = feed(c, &c->streams[k], t);
+                if (due < next)
+                    next = due;
+            }
+        t = now();
+        if (st->shared && !readRings(c, t, true))
+            next = t;
+        n = epoll_wait(c->epoll, events, 256, next > t ? (int)ceil((next - t)*1000) : 0);
+        t = now();
+        for (k = 0; k < n; k++)
+        {
+            stream *s = events[k].data.ptr;
+            if (!s)
+            {
+                eventfd_t ignored;
+                eventfd_read(c->wake, &ignored);
+            }
+            else if (!s->done && !receive(c, s, t))
+            {
+                s->done = true;
+                s->failed = true;
+                epoll_ctl(c->epoll, EPOLL_CTL_DEL, s->fd, NULL);
+            }
+        }
+    }
+
+    // Delivers what is still queued, then tells the server the stream ended and waits for the last
+    // beats until it closes the connection.
+    deadline = now() + 10;
+    for (k = 0; k < c->count; k++)
+    {
+        stream *s = &c->streams[k];
+        while (s->fd >= 0 && !s->done && s->pending && now() < deadline)
+        {
+            struct pollfd p = {s->fd, POLLOUT, 0};
+            poll(&p, 1, 100);
+            flush(s);
+        }
+        if (s->fd >= 0)
+            shutdown(s->fd, SHUT_WR);
+    }
+    for (open = 0, k = 0; k < c->count; k++)
+        open += c->streams[k].fd >= 0 && !c->streams[k].done;
+    while (open > 0 && (t = now()) < deadline)
+    {
+        n = epoll_wait(c->epoll, events, 256, 100);
+        t = now();
+        for (k = 0; k < n; k++)
+        {
+            stream *s = events[k].data.ptr;
+            if (s && !s->done && !receive(c, s, t))
+            {
+                s->done = true;
+                open--;
+                epoll_ctl(c->epoll, EPOLL_CTL_DEL, s->fd, NULL);
+            }
+        }
+    }
+    // The server publishes the last beats of a shared memory stream before closing its socket.
+    if (st->shared)
+        readRings(c, now(), false);
+    for (k = 0; k < c->count; k++)
+    {
+        stream *s = &c->streams[k];
+
+        if (s->fd >= 0)
+            close(s->fd);
+        if (s->shm.header)
+        {
+            if (s->shm.wake >= 0)
+                close(s->shm.wake);
+            ptShmClose(&s->shm);
+        }
+    }
+    if (c->wake >= 0)
+        close(c->wake);
+    close(c->epoll);
+
+    return NULL;
+}
+
+/*
+    Runs a given number of streams for a while and prints what was measured as a JSON object. Returns
+    whether the server sustained them: every sample sent on time, every beat back, no errors and the
+    99th percentile of the latency under the limit.
+*/
+static bool runStep(const char socketPath[], bool shared, const short x[], long unsigned int n, int fs, double acceleration, int streams,
+                    int threads, double seconds, double blockTime, double limit, int *serverPid, bool *first, double *cores)
+{
+    static unsigned int nextId = 1;
+    static latency total;
+    step st;
+    client *clients = calloc(threads, sizeof(client));
+    stream *all = calloc(streams, sizeof(stream));
+    long unsigned int *found, nFound, sent = 0, target = 0, beats = 0, expected = 0, k;
+    double serverBefore, serverAfter, selfBefore, wall;
+    int errors = 0, connectErrors = 0, lastError = 0, j;
+    bool sustained;
+
+    st.x = x;
+    st.n = n;
+    st.fs = fs;
+    st.rate = fs*acceleration;
+    st.block = (int)(fs*blockTime + 0.5) > 0 ? (int)(fs*blockTime + 0.5) : 1;
+    st.seconds = seconds;
+    st.socket = socketPath;
+    st.shared = shared;
+    found = expectedBeats(x, n, fs, (long unsigned int)(st.rate*seconds) + st.block, &nFound);
+    if (!clients || !all || !found)
+    {
+        fprintf(stderr, "out of memory for %d streams\n", streams);
+        exit(1);
+    }
+
+    memset(&total, 0, sizeof(total));
+    for (k = 0; k < (long unsigned int)streams; k++)
+    {
+        all[k].id = nextId++;
+        all[k].phase = (double)k/streams*st.block/st.rate;
+        all[k].fd = -1;
+    }
+    pthread_barrier_init(&st.ready, NULL, threads + 1);
+    for (j = 0; j < threads; j++)
+    {
+        clients[j].step = &st;
+        clients[j].streams = all + (long unsigned int)streams*j/threads;
+        clients[j].count = (long unsigned int)streams*(j + 1)/threads - (long unsigned int)streams*j/threads;
+        clients[j].latency = calloc(1, sizeof(latency));
+        pthread_create(&clients[j].thread, NULL, run, &clients[j]);
+    }
+    pthread_barrier_wait(&st.ready);
+
+    // The server's pid comes from the peer credentials of a connection, unless given.
+    if (*serverPid <= 0 && streams > 0 && all[0].fd >= 0)
+    {
+        struct ucred peer;
+        socklen_t size = sizeof(peer);
+        if (!getsockopt(all[0].fd, SOL_SOCKET, SO_PEERCRED, &peer, &size))
+            *serverPid = peer.pid;
+    }
+    serverBefore = processCpu(*serverPid);
+    selfBefore = selfCpu();
+    st.start = now() + 0.01;
+    pthread_barrier_wait(&st.ready);
+    for (j = 0; j < threads; j++)
+    {
+        int b;
+
+        pthread_join(clients[j].thread, NULL);
+        for (b = 0; b < LATENCY_BUCKETS; b++)
+            total.bucket[b] += clients[j].latency->bucket[b];
+        total.count += clients[j].latency->count;
+        total.stale += clients[j].latency->stale;
+        if (clients[j].latency->max > total.max)
+            total.max = clients[j].latency->max;
+        errors += clients[j].errors;
+        connectErrors += clients[j].connectErrors;
+        if (clients[j].lastError)
+            lastError = clients[j].lastError;
+        free(clients[j].latency);
+    }
+    wall = now() - st.start;
+    serverAfter = processCpu(*serverPid);
+    pthread_barrier_destroy(&st.ready);
+
+    // Each stream should have sent every whole block due by the end of its schedule.
+    for (k = 0; k < (long unsigned int)streams; k++)
+    {
+        target += (long unsigned int)((seconds - all[k].phase)*st.rate/st.block)*st.block;
+        sent += all[k].sent;
+        beats += all[k].beats;
+        expected += countBefore(found, nFound, all[k].sent);
+    }
+    *cores = serverBefore >= 0 && serverAfter >= 0 ? (serverAfter - serverBefore)/wall : -1;
+    sustained = !errors && !connectErrors && sent >= 0.99*target && beats >= expected
+                && percentile(&total, 0.99) <= limit*1000 && !total.stale;
+
+    printf("%s\n    {\"fs\": %d, \"streams\": %d, \"acceleration\": %g, \"realtime_streams\": %.0f, \"seconds\": %.3f, ",
+           *first ? "" : ",", fs, streams, acceleration, streams*acceleration, wall);
+    printf("\"samples\": %lu, \"sent_ratio\": %.4f, \"beats\": %lu, \"missing_beats\": %lu, \"errors\": %d, \"refused\": %d, ",
+           sent, target ? (double)sent/target : 0, beats, expected > beats ? expected - beats : 0, errors,
+           connectErrors);
+    if (lastError)
+        printf("\"last_error\": %d, ", lastError);
+    printf("\"latency_us\": {\"p50\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu, \"stale\": %lu}, ",
+           percentile(&total, 0.5), percentile(&total, 0.99), percentile(&total, 0.999), total.max, total.stale);
+    if (*cores >= 0)
+        printf("\"server_cpu\": %.3f, ", *cores);
+    else
+        printf("\"server_cpu\": null, ");
+    printf("\"client_cpu\": %.3f, \"sustained\": %s}", (selfCpu() - selfBefore)/wall, sustained ? "true" : "false");
+    fflush(stdout);
+    *first = false;
+
+    free(found);
+    free(all);
+    free(clients);
+
+    return sustained;
+}
+
+static void usage(const char program[])
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -S path       server socket (" PT_SOCKET ")\n"
+            "  -m transport  socket: samples and beats on the socket; shm: on shared memory rings (socket)\n"
+            "  -f rates      sampling frequencies to test, comma separated (360)\n"
+            "  -i record     text record at 360 Hz, resampled to each rate (examples/test_input.txt)\n"
+            "  -y seconds    replays a synthetic record of that length instead\n"
+            "  -a factor     sends that many times faster than real time (1)\n"
+            "  -n streams    first stream count; it doubles on each step (100)\n"
+            "  -N streams    highest stream count tried (100000)\n"
+            "  -t seconds    length of each step (10)\n"
+            "  -b ms         samples per message, in milliseconds of signal (20)\n"
+            "  -L ms         highest 99th percentile latency still taken as sustained (100)\n"
+            "  -j threads    client threads (2)\n"
+            "  -p pid        server process, for its CPU use (found from the socket)\n",
+            program);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *socketPath = PT_SOCKET, *input = "examples/test_input.txt", *rates = "360", *r;
+    double acceleration = 1, seconds = 10, blockTime = 0.02, limit = 100, synthetic = 0;
+    int start = 100, highest = 100000, threads = 2, serverPid = 0, opt;
+    struct rlimit files;
+    ptRecord record;
+    char summary[4096] = "";
+    bool first = true, shared = false;
+
+    while ((opt = getopt(argc, argv, "S:m:f:i:y:a:n:N:t:b:L:j:p:h")) != -1)
+    {
+        if (opt == 'S')
+            socketPath = optarg;
+        else if (opt == 'm' && (!strcmp(optarg, "socket") || !strcmp(optarg, "shm")))
+            shared = !strcmp(optarg, "shm");
+        else if (opt == 'f')
+            rates = optarg;
+        else if (opt == 'i')
+            input = optarg;
+        else if (opt == 'y')
+            synthetic = atof(optarg);
+        else if (opt == 'a' && atof(optarg) > 0)
+            acceleration = atof(optarg);
+        else if (opt == 'n' && atoi(optarg) > 0)
+            start = atoi(optarg);
+        else if (opt == 'N' && atoi(optarg) > 0)
+            highest = atoi(optarg);
+        else if (opt == 't' && atof(optarg) > 0)
+            seconds = atof(optarg);
+        else if (opt == 'b' && atof(optarg) > 0)
+            blockTime = atof(optarg)/1000;
+        else if (opt == 'L' && atof(optarg) > 0)
+            limit = atof(optarg);
+        else if (opt == 'j' && atoi(optarg) > 0)
+            threads = atoi(optarg);
+        else if (opt == 'p')
+            serverPid = atoi(optarg);
+        else
+            usage(argv[0]);
+    }
+    if (blockTime*1000 > 65535)
+        usage(argv[0]);
+
+    // Every stream is a file descriptor: allow as many as the hard limit does.
+    getrlimit(RLIMIT_NOFILE, &files);
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+
+    if (!synthetic && !ptRecordLoad(&record, input, 360))
+    {
+        fprintf(stderr, "can't read %s\n", input);
+        return 1;
+    }
+
+    printf("{\n  \"socket\": \"%s\",\n  \"transport\": \"%s\",\n  \"record\": \"%s\",\n  \"steps\": [", socketPath,
+           shared ? "shm" : "socket", synthetic ? "synthetic" : input);
+    for (r = rates; *r; r = strchr(r, ',') ? strchr(r, ',') + 1 : r + strlen(r))
+    {
+        int fs = atoi(r), streams, passed = 0, failed = 0;
+        double cores, passedCores = -1;
+        long unsigned int n;
+        short *x;
+
+        if (fs <= 0)
+            usage(argv[0]);
+        if (synthetic)
+        {
+            ptRecord generated;
+            long unsigned int k;
+
+            if (!ptRecordSynth(&generated, (long unsigned int)(synthetic*fs), fs, 1))
+                return 1;
+            n = generated.n;
+            x = malloc(n*sizeof(short));
+            for (k = 0; x && k < n; k++)
+                x[k] = generated.x[k];
+            ptRecordFree(&generated);
+        }
+        else
+            x = resample(&record, fs, &n);
+        if (!x || !n)
+            return 1;
+
+        // Doubles the streams until the server can't take them, then bisects down to a 10% step.
+        for (streams = start; streams <= highest && !failed; streams *= 2)
+            if (runStep(socketPath, shared, x, n, fs, acceleration, streams, threads, seconds, blockTime, limit, &serverPid, &first, &cores))
+            {
+                passed = streams;
+                passedCores = cores;
+            }
+            else
+                failed = streams;
+        while (failed && passed && failed > passed*1.1 + 1)
+        {
+            streams = (passed + failed)/2;
+            if (runStep(socketPath, shared, x, n, fs, acceleration, streams, threads, seconds, blockTime, limit, &serverPid, &first, &cores))
+            {
+                passed = streams;
+                passedCores = cores;
+            }
+            else
+                failed = streams;
+        }
+
+        snprintf(summary + strlen(summary), sizeof(summary) - strlen(summary),
+                 "%s\n    {\"fs\": %d, \"sustained\": %d, \"failed\": %d, \"realtime_streams_per_core\": ",
+                 *summary ? "," : "", fs, passed, failed);
+        if (passed && passedCores > 0)
+            snprintf(summary + strlen(summary), sizeof(summary) - strlen(summary), "%.0f}", passed*acceleration/passedCores);
+        else
+            snprintf(summary + strlen(summary), sizeof(summary) - strlen(summary), "null}");
+        free(x);
+    }
+    printf("\n  ],\n  \"saturation\": [%s\n  ]\n}\n", summary);
+    if (!synthetic)
+        ptRecordFree(&record);
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsPerf.c                                                       *
+ *       Hardware performance counters through perf_event_open                   *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Reads hardware performance counters through perf_event_open(2), with no       *
+ * library needed: core cycles, instructions, branch misses, L1 data cache read  *
+ * misses and last level cache misses, counted on this process in user space     *
+ * only. Used by panTompkinsBench and panTompkinsStages to give the counters per *
+ * run and per stage.                                                            *
+ *                                                                               *
+ * The counters need /proc/sys/kernel/perf_event_paranoid at 2 or lower for user *
+ * space counting, and a CPU (or virtual machine) that exposes them. Whatever    *
+ * isn't available reads as -1 and is printed as null. On other systems every    *
+ * counter is unavailable.                                                       *
+ *-------------------------------------------------------------------------------*
+ */
+
+#define _GNU_SOURCE
+
+#include "panTompkinsPerf.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+static const char *names[PT_PERF_COUNTERS] = {"cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses"};
+
+const char *ptPerfName(ptPerfCounter counter)
+{
+    return names[counter];
+}
+
+#ifdef __linux__
+
+/*
+    Opens every counter on its own rather than as a group, so one the machine lacks doesn't take the
+    others with it. Counts only this process, in user space. Returns false if no counter could be
+    opened (perf_event_paranoid too high, or no PMU, as on many virtual machines).
+*/
+bool ptPerfOpen(ptPerf *perf)
+{
+    static const struct {unsigned int type; long long unsigned int config;} events[PT_PERF_COUNTERS] =
+    {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    };
+    struct perf_event_attr attr;
+    bool any = false;
+    int k;
+
+    for (k = 0; k < PT_PERF_COUNTERS; k++)
+    {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[k].type;
+        attr.config = events[k].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        perf->fd[k] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        any = any || perf->fd[k] >= 0;
+    }
+
+    return any;
+}
+
+void ptPerfStart(ptPerf *perf)
+{
+    int k;
+    for (k = 0; k < PT_PERF_COUNTERS; k++)
+        if (perf->fd[k] >= 0)
+        {
+            ioctl(perf->fd[k], PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf->fd[k], PERF_EVENT_IOC_ENABLE, 0);
+        }
+}
+
+/*
+    Stops the counters and reads them. When the kernel had to share the PMU between more counters than
+    it has, a counter only ran part of the time; its value is scaled up to the whole run. Counters that
+    aren't available read as -1.
+*/
+void ptPerfStop(ptPerf *perf, double value[])
+{
+    long long unsigned int data[3];
+    int k;
+
+    for (k = 0; k < PT_PERF_COUNTERS; k++)
+    {
+        value[k] = -1;
+        if (perf->fd[k] < 0)
+            continue;
+        ioctl(perf->fd[k], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(perf->fd[k], data, sizeof(data)) == sizeof(data) && data[2] > 0)
+            value[k] = (double)data[0]*data[1]/data[2];
+    }
+}
+
+void ptPerfClose(ptPerf *perf)
+{
+    int k;
+    for (k = 0; k < PT_PERF_COUNTERS; k++)
+        if (perf->fd[k] >= 0)
+            close(perf->fd[k]);
+}
+
+#else
+
+bool ptPerfOpen(ptPerf *perf)
+{
+    int k;
+    for (k = 0; k < PT_PERF_COUNTERS; k++)
+        perf->fd[k] = -1;
+    return false;
+}
+
+void ptPerfStart(ptPerf *perf)
+{
+    (void)perf;
+}
+
+void ptPerfStop(ptPerf *perf, double value[])
+{
+    int k;
+    (void)perf;
+    for (k = 0; k < PT_PERF_COUNTERS; k++)
+        value[k] = -1;
+}
+
+void ptPerfClose(ptPerf *perf)
+{
+    (void)perf;
+}
+
+#endif
+
+/*
+    Prints the counters divided by the number of samples as a JSON object, with null for the ones that
+    aren't available.
+*/
+void ptPerfPrint(const double value[], double samples)
+{
+    int k;
+
+    printf("{");
+    for (k = 0; k < PT_PERF_COUNTERS; k++)
+    {
+        printf("%s\"%s\": ", k ? ", " : "", names[k]);
+        if (value[k] < 0)
+            printf("null");
+        else
+            printf("%.4f", value[k]/samples);
+    }
+    printf("}");
+}
@@ -0,0 +1,56 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsPerf.h                                                       *
+ *       Header for the hardware counters used by the tools                      *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ */
+
+#ifndef PAN_TOMPKINS_PERF
+#define PAN_TOMPKINS_PERF
+
+#include "panTompkins.h"
+
+// Hardware counters read around each measured run.
+typedef enum {PT_CYCLES, PT_INSTRUCTIONS, PT_BRANCH_MISSES, PT_L1D_MISSES, PT_LLC_MISSES, PT_PERF_COUNTERS} ptPerfCounter;
+
+/*
+    One file descriptor per counter, -1 where the counter isn't available (not Linux, no permission,
+    or not supported by the CPU or the virtual machine).
+*/
+typedef struct
+{
+    int fd[PT_PERF_COUNTERS];
+} ptPerf;
+
+bool ptPerfOpen(ptPerf *perf);
+void ptPerfStart(ptPerf *perf);
+void ptPerfStop(ptPerf *perf, double value[]);
+void ptPerfClose(ptPerf *perf);
+const char *ptPerfName(ptPerfCounter counter);
+void ptPerfPrint(const double value[], double samples);
+
+#endif
@@ -0,0 +1,97 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsProtocol.h                                                   *
+ *       Messages exchanged with ptServer                                        *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ */
+
+#ifndef PAN_TOMPKINS_PROTOCOL
+#define PAN_TOMPKINS_PROTOCOL
+
+/*
+    Messages between ptServer and its clients, over a UNIX stream socket. Each message is a type byte
+    followed by little-endian fields:
+    - PT_MSG_OPEN (client): u32 stream id, u32 sampling frequency. Must come first, once (or
+      PT_MSG_ATTACH instead).
+    - PT_MSG_SAMPLES (client): u16 count, then count signed 16-bit samples.
+    - PT_MSG_BEAT (server): u32 stream id, u64 position of the R peak, u64 sample at which it was found
+      (the newest sample the detector had read then; later than position after a back search).
+    - PT_MSG_ERROR (server): u8 code. The server closes the connection right after it.
+    - PT_MSG_ATTACH (client): no fields. Passes along (SCM_RIGHTS) the memfd of a shared memory segment
+      made with ptShmCreate(), which carries the stream instead of this socket (see panTompkinsShm.h),
+      and may pass after it an eventfd to be signalled when beats are written to an idle ring. The
+      memfd must be sealed against shrinking and growing.
+    - PT_MSG_ATTACHED (server): no fields. Passes along the eventfd to signal when samples are written
+      to an idle ring. The socket then only carries errors, and its end ends the stream.
+*/
+#define PT_MSG_OPEN 1
+#define PT_MSG_SAMPLES 2
+#define PT_MSG_BEAT 3
+#define PT_MSG_ERROR 4
+#define PT_MSG_ATTACH 5
+#define PT_MSG_ATTACHED 6
+
+#define PT_OPEN_SIZE 9
+#define PT_ATTACH_SIZE 1
+#define PT_SAMPLES_HEADER 3
+#define PT_BEAT_SIZE 21
+#define PT_ERROR_SIZE 2
+
+// Error codes.
+#define PT_ERROR_PROTOCOL 1     // Unknown message, or samples before PT_MSG_OPEN.
+#define PT_ERROR_STREAM 2       // The stream id is already in use.
+#define PT_ERROR_RATE 3         // The sampling frequency is 0 or doesn't fit PT_HISTORY (614 Hz by default).
+#define PT_ERROR_FULL 4         // No memory for another stream.
+#define PT_ERROR_SHARED 5       // No segment was passed, or it isn't sealed, can't be mapped or isn't valid.
+
+#define PT_SOCKET "/tmp/ptServer.sock"
+
+static inline unsigned int ptGet32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static inline void ptPut32(unsigned char *p, unsigned int v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static inline void ptPut64(unsigned char *p, long unsigned int v)
+{
+    ptPut32(p, v & 0xFFFFFFFFu);
+    ptPut32(p + 4, (v >> 32) & 0xFFFFFFFFu);
+}
+
+static inline long unsigned int ptGet64(const unsigned char *p)
+{
+    return ptGet32(p) | ((long unsigned int)ptGet32(p + 4) << 32);
+}
+
+#endif
@@ -0,0 +1,130 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsRecord.c                                                     *
+ *       Record helpers used by the tools: loading, saving and synthetic records *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Helpers shared by the programs on tools/: loading a text record into memory,  *
+ * writing one back and making synthetic ECG records of any length and sampling  *
+ * frequency (with panTompkinsSynth).                                            *
+ *-------------------------------------------------------------------------------*
+ */
+
+#include "panTompkinsRecord.h"
+#include "panTompkinsSynth.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+    Reads a text record with one sample per line, the same format panTompkins() reads. Returns false if
+    the file can't be opened or memory runs out.
+*/
+bool ptRecordLoad(ptRecord *record, const char path[], int fs)
+{
+    FILE *f = fopen(path, "r");
+    long unsigned int capacity = 1 << 16;
+    int x;
+
+    record->n = 0;
+    record->fs = fs;
+    record->x = NULL;
+    if (!f)
+        return false;
+    record->x = malloc(capacity*sizeof(dataType));
+    while (record->x && fscanf(f, "%d", &x) == 1)
+    {
+        if (record->n == capacity)
+        {
+            dataType *grown = realloc(record->x, 2*capacity*sizeof(dataType));
+            if (!grown)
+            {
+                free(record->x);
+                record->x = NULL;
+                break;
+            }
+            record->x = grown;
+            capacity *= 2;
+        }
+        record->x[record->n++] = x;
+    }
+    fclose(f);
+
+    return record->x != NULL;
+}
+
+/*
+    Fills a record with n samples of a synthetic ECG at fs Hz (see panTompkinsSynth), with the default
+    heart rate and noise. Good enough to time the detector on any length and sampling frequency.
+*/
+bool ptRecordSynth(ptRecord *record, long unsigned int n, int fs, unsigned int seed)
+{
+    ptSynthOptions options;
+    ptSynth synth;
+    long unsigned int i;
+    bool rPeak;
+
+    record->n = n;
+    record->fs = fs;
+    record->x = malloc((n ? n : 1)*sizeof(dataType));
+    if (!record->x)
+        return false;
+
+    ptSynthDefaults(&options);
+    options.fs = fs;
+    options.seed = seed;
+    ptSynthInit(&synth, &options);
+    for (i = 0; i < n; i++)
+        record->x[i] = ptSynthNext(&synth, &rPeak);
+
+    return true;
+}
+
+/*
+    Writes a record as text, one sample per line.
+*/
+bool ptRecordSave(const ptRecord *record, const char path[])
+{
+    FILE *f = fopen(path, "w");
+    long unsigned int i;
+    bool ok;
+
+    if (!f)
+        return false;
+    for (i = 0; i < record->n; i++)
+        fprintf(f, "%d\n", record->x[i]);
+    ok = !ferror(f);
+
+    return (fclose(f) == 0) && ok;
+}
+
+void ptRecordFree(ptRecord *record)
+{
+    free(record->x);
+    record->x = NULL;
+    record->n = 0;
+}
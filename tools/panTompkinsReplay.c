@@ -0,0 +1,277 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsReplay.c                                                     *
+ *       Real-time paced replay for detection latency                            *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Real-time replay of a record through the streaming engine (panTompkinsCore),  *
+ * to measure detection latency under the timing of a live acquisition rather    *
+ * than offline throughput. Sample i is due at a fixed offset i/(fs*speed) from  *
+ * the start, held with clock_nanosleep() on absolute deadlines, so a late       *
+ * wake-up doesn't delay the samples after it; speed 1 is the true sampling      *
+ * rate.                                                                         *
+ *                                                                               *
+ * Each sample is timestamped when it arrives (the wake-up) and when the         *
+ * detector is done with it, and each beat when it's emitted. It reports, as     *
+ * JSON: the distribution of the wake-up lateness, of the time taken by each     *
+ * sample and of the beat latency, from the arrival of the R peak (the sample    *
+ * panTompkins() marks) to the emission, which includes the delay of the filters *
+ * and of the decision logic; and the deadline misses, samples still being       *
+ * processed when the next one was due, with the worst overrun. Exits with 1 if  *
+ * a deadline was missed. With -p it runs with SCHED_FIFO and its memory locked, *
+ * as a real-time acquisition would.                                             *
+ *-------------------------------------------------------------------------------*
+ */
+
+#define _GNU_SOURCE
+
+#include "panTompkinsRecord.h"
+#include "panTompkinsCore.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+// Latencies are kept on a histogram of LATENCY_BUCKETS buckets of width ns each. Anything slower goes
+// on the last one (the exact maximum is kept apart).
+#define LATENCY_BUCKETS 65536
+
+typedef struct
+{
+    long unsigned int bucket[LATENCY_BUCKETS];
+    long unsigned int count, max, width;
+    double sum;
+} latency;
+
+static long long nanoseconds()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+static void addLatency(latency *l, long long ns)
+{
+    long unsigned int k;
+
+    if (ns < 0)
+        ns = 0;
+    k = ns/l->width;
+    l->bucket[k < LATENCY_BUCKETS ? k : LATENCY_BUCKETS - 1]++;
+    l->count++;
+    l->sum += ns;
+    if ((long unsigned int)ns > l->max)
+        l->max = ns;
+}
+
+// In ns, to the width of a bucket.
+static long unsigned int percentile(const latency *l, double p)
+{
+    long unsigned int target = (long unsigned int)(p*l->count), seen = 0;
+    int k;
+
+    for (k = 0; k < LATENCY_BUCKETS - 1; k++)
+    {
+        seen += l->bucket[k];
+        if (seen > target)
+            return k*l->width;
+    }
+
+    return l->max;
+}
+
+// Prints a distribution as JSON, in the given unit (1000 for us, 1000000 for ms).
+static void printLatency(const char name[], const latency *l, double unit)
+{
+    printf("  \"%s\": {\"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f},\n",
+           name, l->count ? l->sum/l->count/unit : 0.0, percentile(l, 0.5)/unit, percentile(l, 0.9)/unit,
+           percentile(l, 0.99)/unit, percentile(l, 0.999)/unit, l->max/unit);
+}
+
+static void usage(const char program[])
+{
+    fprintf(stderr,
+            "usage: %s [-f fs] [-a speed] [-n samples] [-p priority] [-l] [input.txt]\n"
+            "  -f  sampling frequency of the record (360)\n"
+            "  -a  feeds the samples this many times faster than real time (1)\n"
+            "  -n  samples of the record to replay (all)\n"
+            "  -p  runs with SCHED_FIFO at this priority and the memory locked (needs CAP_SYS_NICE)\n"
+            "  -l  lists every beat with its latency\n"
+            "The record is examples/test_input.txt by default.\n",
+            program);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    static ptFilter filter;
+    static latency wakeup, processing, detection;
+    const char *path = "examples/test_input.txt";
+    long unsigned int i, limit = 0, total, position, peak, beats = 0, capacity, misses = 0, *beatAt;
+    long long start, due, next, done, worst = 0, *arrival, *beatLatency;
+    double speed = 1, period;
+    int fs = 360, priority = 0, opt;
+    bool list = false, qrs;
+    struct timespec deadline;
+    struct sched_param param;
+    ptDecision decision;
+    ptHistory history;
+    ptConfig config;
+    ptRecord record;
+
+    while ((opt = getopt(argc, argv, "f:a:n:p:lh")) != -1)
+    {
+        if (opt == 'f')
+            fs = atoi(optarg);
+        else if (opt == 'a')
+            speed = atof(optarg);
+        else if (opt == 'n')
+            limit = strtoul(optarg, NULL, 10);
+        else if (opt == 'p')
+            priority = atoi(optarg);
+        else if (opt == 'l')
+            list = true;
+        else
+            usage(argv[0]);
+    }
+    if (optind < argc - 1 || fs <= 0 || speed <= 0)
+        usage(argv[0]);
+    if (optind == argc - 1)
+        path = argv[optind];
+    if (!ptRecordLoad(&record, path, fs))
+    {
+        fprintf(stderr, "Couldn't read %s\n", path);
+        return 1;
+    }
+    ptDefaultConfig(&config, fs);
+    if (config.bufferSize > PT_HISTORY || config.windowSize > PT_MAXWINDOW)
+    {
+        fprintf(stderr, "%d Hz needs a larger PT_HISTORY (-DPT_HISTORY=4096)\n", fs);
+        return 1;
+    }
+    total = limit && limit < record.n ? limit : record.n;
+    period = 1e9/(fs*speed);
+
+    // Everything the loop touches is allocated and written now, so no page fault lands on a deadline.
+    capacity = total/(fs/5 > 0 ? fs/5 : 1) + 2;
+    arrival = calloc(total + 1, sizeof(long long));
+    beatAt = calloc(capacity, sizeof(long unsigned int));
+    beatLatency = calloc(capacity, sizeof(long long));
+    if (!arrival || !beatAt || !beatLatency)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    memset(arrival, 0, (total + 1)*sizeof(long long));
+    wakeup.width = 100;             // 100ns, up to 6.5ms.
+    processing.width = 1;           // 1ns, up to 65us.
+    detection.width = 100000;       // 100us, up to 6.5s.
+    // The default 50us of timer slack would show up on every wake-up.
+    prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+    if (priority)
+    {
+        param.sched_priority = priority;
+        if (sched_setscheduler(0, SCHED_FIFO, &param) || mlockall(MCL_CURRENT | MCL_FUTURE))
+            fprintf(stderr, "Couldn't run with real-time priority: %s\n", strerror(errno));
+    }
+
+    ptFilterInit(&filter, &config);
+    ptFilterHistory(&filter, &history);
+    ptDecisionInit(&decision);
+
+    // Sample i is due at start + i*period, an absolute deadline: a late wake-up doesn't push the ones
+    // after it. A sample is a deadline miss when it's still being processed when the next one is due.
+    start = nanoseconds() + 1000000;
+    for (i = 0; i < total; i++)
+    {
+        due = start + (long long)(i*period);
+        deadline.tv_sec = due/1000000000LL;
+        deadline.tv_nsec = due%1000000000LL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+            ;
+        arrival[i] = nanoseconds();
+        addLatency(&wakeup, arrival[i] - due);
+
+        ptFilterStep(&filter, record.x[i]);
+        qrs = ptDecisionStep(&decision, &config, &history, &position);
+        done = nanoseconds();
+        addLatency(&processing, done - arrival[i]);
+
+        // The beat is emitted now. Its latency counts from the arrival of the R peak, the sample it's
+        // marked on by panTompkins(): position is on the filtered signal, delay + 1 samples later.
+        if (qrs)
+        {
+            peak = position > (long unsigned int)config.delay ? position - config.delay - 1 : 0;
+            addLatency(&detection, done - arrival[peak]);
+            if (beats < capacity)
+            {
+                beatAt[beats] = peak;
+                beatLatency[beats] = done - arrival[peak];
+            }
+            beats++;
+        }
+
+        next = start + (long long)((i + 1)*period);
+        if (done > next)
+        {
+            misses++;
+            if (done - next > worst)
+                worst = done - next;
+        }
+    }
+    done = nanoseconds();
+
+    printf("{\n  \"record\": \"%s\",\n  \"fs\": %d,\n  \"speed\": %g,\n  \"samples\": %lu,\n", path, fs, speed, total);
+    printf("  \"period_us\": %.3f,\n  \"realtime_priority\": %d,\n", period/1e3, priority);
+    printf("  \"seconds\": %.3f,\n  \"scheduled_seconds\": %.3f,\n", (done - start)/1e9, total*period/1e9);
+    printLatency("wakeup_late_us", &wakeup, 1e3);
+    printLatency("processing_ns", &processing, 1);
+    printf("  \"deadline_misses\": %lu,\n  \"worst_overrun_us\": %.3f,\n", misses, worst/1e3);
+    printLatency("beat_latency_ms", &detection, 1e6);
+    printf("  \"beats\": %lu", beats);
+    if (list)
+    {
+        printf(",\n  \"beat_list\": [");
+        for (i = 0; i < beats && i < capacity; i++)
+            printf("%s\n    {\"position\": %lu, \"latency_ms\": %.3f}", i ? "," : "", beatAt[i], beatLatency[i]/1e6);
+        printf("\n  ]");
+    }
+    printf("\n}\n");
+
+    free(arrival);
+    free(beatAt);
+    free(beatLatency);
+    ptRecordFree(&record);
+
+    return misses ? 1 : 0;
+}
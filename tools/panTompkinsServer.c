@@ -0,0 +1,745 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsServer.c                                                     *
+ *       Streaming detector daemon                                               *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Streaming detector daemon. Clients connect to a UNIX stream socket, name the  *
+ * stream they carry and its sampling frequency, then send blocks of 16-bit      *
+ * samples; every R peak found is sent back as soon as the decision logic finds  *
+ * it (see panTompkinsProtocol.h). The connections are spread over a few worker  *
+ * threads, each waiting on its own epoll set, so a stream is always handled by  *
+ * the same thread and its detector needs no locking. A client that doesn't read *
+ * its events loses the new ones instead of making the server buffer without     *
+ * limit; those are counted. At 360 Hz a stream costs the server a few tens of   *
+ * microseconds of CPU per second, so a thousand streams take a small part of a  *
+ * single core. Each worker keeps the detectors of its streams on pools (see     *
+ * panTompkinsPool.c), one per sampling frequency, and runs the samples queued   *
+ * by all its connections in one sweep per wake up. Clients on the same machine  *
+ * may pass the samples and beats through shared memory rings instead (see       *
+ * panTompkinsShm.c). Rates over about 600 Hz need the bigger rings of           *
+ * -DPT_HISTORY=2048.                                                            *
+ *-------------------------------------------------------------------------------*
+ */
+
+#define _GNU_SOURCE
+
+#include "panTompkinsPool.h"
+#include "panTompkinsProtocol.h"
+#include "panTompkinsShm.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Bytes a connection buffers each way. An incoming message never takes more than PT_INPUT.
+#define PT_INPUT (PT_SAMPLES_HEADER + 2*65535)
+#define PT_OUTPUT (1 << 16)
+
+// Buckets of the stream id table.
+#define PT_STREAMS 4096
+
+// Counters with a single writer (a worker) read by the statistics thread. connections has two writers,
+// the accepting thread and the worker, so it's updated with __atomic_fetch_add/sub instead.
+#define ADD(counter, n) __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+#define READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+/*
+    One client: its socket, what was received but not parsed yet, the beat events not sent yet and,
+    once it said which stream it carries, the detector of that stream.
+*/
+typedef struct connection
+{
+    int fd;
+    unsigned int stream;
+    bool open;              // PT_MSG_OPEN received: stream and the detector are set.
+    bool writing;           // Waiting for the socket to take more output (EPOLLOUT).
+    bool shared;            // PT_MSG_ATTACH received: samples and beats go through shm.
+    ptShm shm;
+    int peerSegment;        // Shared memory segment passed by the client, until it's mapped.
+    int peerWake;           // eventfd passed by the client, signalled when it waits for beats.
+    ptPool *pool;           // Detectors of the worker for this sampling frequency.
+    int slot;
+    unsigned char *input, *output;
+    size_t received, pending;
+    struct connection *next;    // Next on the same bucket of the stream table.
+    struct connection *nextShared;
+} connection;
+
+/*
+    The detectors of a worker for one sampling frequency.
+*/
+typedef struct ratePool
+{
+    ptPool detectors;
+    struct ratePool *next;
+} ratePool;
+
+/*
+    A worker thread: its own epoll instance and the connections on it. Each connection belongs to a
+    single worker, so detectors need no locking.
+*/
+typedef struct
+{
+    pthread_t thread;
+    int epoll;
+    int doorbell;               // eventfd the shared memory clients of this worker signal.
+    connection *shared;         // Connections on shared memory, checked on every wake up.
+    ratePool *pools;
+    long unsigned int connections, samples, beats, dropped, errors;
+} worker;
+
+static connection *streams[PT_STREAMS];
+static pthread_mutex_t streamsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static volatile sig_atomic_t stopping = 0;
+static int wake = -1;           // eventfd on every epoll set, signalled to stop the workers.
+static int batch = 0;           // If set, shared memory rings are read every so many ms instead.
+
+static void stop(int signal)
+{
+    (void)signal;
+    stopping = 1;
+}
+
+/*
+    Registers the stream id of a connection. Returns false if another connection has it already.
+*/
+static bool claim(connection *c)
+{
+    connection **bucket = &streams[c->stream % PT_STREAMS], *other;
+    bool unused = true;
+
+    pthread_mutex_lock(&streamsLock);
+    for (other = *bucket; other; other = other->next)
+        if (other->stream == c->stream)
+            unused = false;
+    if (unused)
+    {
+        c->next = *bucket;
+        *bucket = c;
+    }
+    pthread_mutex_unlock(&streamsLock);
+
+    return unused;
+}
+
+static void release(connection *c)
+{
+    connection **p;
+
+    pthread_mutex_lock(&streamsLock);
+    for (p = &streams[c->stream % PT_STREAMS]; *p; p = &(*p)->next)
+        if (*p == c)
+        {
+            *p = c->next;
+            break;
+        }
+    pthread_mutex_unlock(&streamsLock);
+}
+
+/*
+    Sends what it can of the pending output. If the socket is full, the rest waits for EPOLLOUT.
+*/
+static void flush(worker *w, connection *c)
+{
+    struct epoll_event e;
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < c->pending && (n = send(c->fd, c->output + done, c->pending - done, MSG_NOSIGNAL)) > 0)
+        done += n;
+    memmove(c->output, c->output + done, c->pending - done);
+    c->pending -= done;
+
+    if ((c->pending > 0) != c->writing)
+    {
+        c->writing = c->pending > 0;
+        e.events = EPOLLIN | (c->writing ? EPOLLOUT : 0);
+        e.data.ptr = c;
+        epoll_ctl(w->epoll, EPOLL_CTL_MOD, c->fd, &e);
+    }
+}
+
+/*
+    Queues a message. If the client doesn't read its events fast enough, new ones are dropped (and
+    counted) instead of letting the output grow without limit.
+*/
+static void queue(worker *w, connection *c, const unsigned char message[], size_t size)
+{
+    if (c->pending + size > PT_OUTPUT)
+    {
+        ADD(w->dropped, 1);
+        return;
+    }
+    memcpy(c->output + c->pending, message, size);
+    c->pending += size;
+}
+
+static void fail(worker *w, connection *c, int code)
+{
+    unsigned char message[PT_ERROR_SIZE] = {PT_MSG_ERROR, code};
+
+    queue(w, c, message, sizeof(message));
+    ADD(w->errors, 1);
+}
+
+/*
+    The pool of a worker for a sampling frequency, made on first use. NULL if there's no memory for it.
+*/
+static ptPool *poolFor(worker *w, const ptConfig *config)
+{
+    ratePool *p;
+
+    for (p = w->pools; p; p = p->next)
+        if (p->detectors.config.fs == config->fs)
+            return &p->detectors;
+    if (!(p = malloc(sizeof(ratePool))) || !ptPoolInit(&p->detectors, config, 64))
+    {
+        free(p);
+        return NULL;
+    }
+    p->next = w->pools;
+    w->pools = p;
+
+    return &p->detectors;
+}
+
+// Highest sampling frequency whose back search buffer, 600*fs/360 samples, fits PT_HISTORY.
+#define PT_MAX_FS (PT_HISTORY*360/600)
+
+static bool openStream(worker *w, connection *c, unsigned int stream, unsigned int fs)
+{
+    ptConfig config;
+
+    c->stream = stream;
+    // fs comes from the client: checked before ptDefaultConfig() multiplies it, which could overflow.
+    if (fs < 1 || fs > PT_MAX_FS)
+    {
+        fail(w, c, PT_ERROR_RATE);
+        return false;
+    }
+    ptDefaultConfig(&config, (int)fs);
+    if (config.bufferSize > PT_HISTORY || config.windowSize > PT_MAXWINDOW || config.windowSize <= 0)
+    {
+        fail(w, c, PT_ERROR_RATE);
+        return false;
+    }
+    if (!(c->pool = poolFor(w, &config)) || (c->slot = ptPoolOpen(c->pool, c)) < 0)
+    {
+        fail(w, c, PT_ERROR_FULL);
+        return false;
+    }
+    if (!claim(c))
+    {
+        ptPoolClose(c->pool, c->slot);
+        fail(w, c, PT_ERROR_STREAM);
+        return false;
+    }
+    c->open = true;
+
+    return true;
+}
+
+/*
+    Reports a beat found by the pool to the connection of its stream (user). Socket clients get it
+    right away: beats are rare enough for a send each.
+*/
+static void onBeat(int slot, void *user, long unsigned int position, long unsigned int found, void *context)
+{
+    connection *c = user;
+    worker *w = context;
+    unsigned char beat[PT_BEAT_SIZE];
+
+    (void)slot;
+    ADD(w->beats, 1);
+    if (c->shared)
+    {
+        if (!ptShmPushBeat(&c->shm, position, found))
+            ADD(w->dropped, 1);
+        return;
+    }
+    beat[0] = PT_MSG_BEAT;
+    ptPut32(beat + 1, c->stream);
+    ptPut64(beat + 5, position);
+    ptPut64(beat + 13, found);
+    queue(w, c, beat, sizeof(beat));
+    flush(w, c);
+}
+
+/*
+    Queues the samples of a PT_MSG_SAMPLES for the pool's scheduler. If the queue of the stream fills up,
+    the pool runs right away to make room.
+*/
+static void push(worker *w, connection *c, const unsigned char *p, int count)
+{
+    dataType x[PT_POOL_QUEUE];
+    int done, taken, i;
+
+    for (done = 0; done < count; done += taken)
+    {
+        int size = count - done < PT_POOL_QUEUE ? count - done : PT_POOL_QUEUE;
+
+        for (i = 0; i < size; i++)
+            x[i] = (short)(p[2*(done + i)] | (p[2*(done + i) + 1] << 8));
+        taken = ptPoolPush(c->pool, c->slot, x, size);
+        if (taken < size)
+        {
+            ptPoolRun(c->pool, 0, onBeat, w);
+            taken += ptPoolPush(c->pool, c->slot, x + taken, size - taken);
+        }
+    }
+    ADD(w->samples, count);
+}
+
+/*
+    Runs every sample waiting on the ring of a shared memory connection, in place, and publishes the
+    beats found.
+*/
+static void drain(worker *w, connection *c)
+{
+    const short *x;
+    unsigned int count;
+
+    while ((x = ptShmSamples(&c->shm, &count)), count > 0)
+    {
+        ptPoolStepShort(c->pool, c->slot, x, count, onBeat, w);
+        ptShmSamplesDone(&c->shm, count);
+        ADD(w->samples, count);
+    }
+    ptShmPublish(&c->shm);
+}
+
+/*
+    Maps the segment a client created and passed along and hands it the doorbell of this worker, so it
+    can wake the worker up when it writes samples to an idle ring.
+*/
+static bool attachStream(worker *w, connection *c)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    unsigned char reply = PT_MSG_ATTACHED;
+    struct iovec data = {&reply, 1};
+    struct msghdr message;
+    struct cmsghdr *cmsg;
+    int segment = c->peerSegment;
+
+    c->peerSegment = -1;
+    if (segment < 0 || !ptShmAttach(&c->shm, segment))
+    {
+        fail(w, c, PT_ERROR_SHARED);
+        return false;
+    }
+    c->shared = true;
+    if (!openStream(w, c, c->shm.header->stream, c->shm.header->fs))
+        return false;
+    c->shm.wake = c->peerWake;
+    c->nextShared = w->shared;
+    w->shared = c;
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &w->doorbell, sizeof(int));
+
+    return sendmsg(c->fd, &message, MSG_NOSIGNAL) == 1;
+}
+
+/*
+    Keeps a descriptor the client passed on one of the connection's slots, closing the one it replaces.
+*/
+static void keep(int *slot, int fd)
+{
+    if (*slot >= 0)
+        close(*slot);
+    *slot = fd;
+}
+
+/*
+    Reads what the client sent, keeping the segment and the eventfd it may pass along with
+    PT_MSG_ATTACH. Descriptors past those two don't fit the control buffer and the kernel closes them.
+*/
+static ssize_t receive(connection *c)
+{
+    char control[CMSG_SPACE(2*sizeof(int))];
+    struct iovec data = {c->input + c->received, PT_INPUT - c->received};
+    struct msghdr message;
+    struct cmsghdr *cmsg;
+    ssize_t got;
+    int fds[2];
+    size_t n;
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    got = recvmsg(c->fd, &message, MSG_CMSG_CLOEXEC);
+    for (cmsg = CMSG_FIRSTHDR(&message); got >= 0 && cmsg; cmsg = CMSG_NXTHDR(&message, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len >= CMSG_LEN(sizeof(int)))
+        {
+            n = (cmsg->cmsg_len - CMSG_LEN(0))/sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), (n < 2 ? n : 2)*sizeof(int));
+            keep(&c->peerSegment, fds[0]);
+            if (n > 1)
+                keep(&c->peerWake, fds[1]);
+        }
+
+    return got;
+}
+
+/*
+    Handles every whole message received so far. Returns false if the connection must be closed.
+*/
+static bool parse(worker *w, connection *c)
+{
+    size_t used = 0, left;
+    bool ok = true;
+
+    while (ok && (left = c->received - used) > 0)
+    {
+        const unsigned char *p = c->input + used;
+
+        if (p[0] == PT_MSG_OPEN && !c->open)
+        {
+            if (left < PT_OPEN_SIZE)
+                break;
+            ok = openStream(w, c, ptGet32(p + 1), ptGet32(p + 5));
+            used += PT_OPEN_SIZE;
+        }
+        else if (p[0] == PT_MSG_ATTACH && !c->open)
+        {
+            ok = attachStream(w, c);
+            used += PT_ATTACH_SIZE;
+        }
+        else if (p[0] == PT_MSG_SAMPLES && c->open && !c->shared)
+        {
+            int count;
+            if (left < PT_SAMPLES_HEADER || left < (size_t)(PT_SAMPLES_HEADER + 2*(count = p[1] | (p[2] << 8))))
+                break;
+            push(w, c, p + PT_SAMPLES_HEADER, count);
+            used += PT_SAMPLES_HEADER + 2*count;
+        }
+        else
+        {
+            fail(w, c, PT_ERROR_PROTOCOL);
+            ok = false;
+        }
+    }
+    memmove(c->input, c->input + used, c->received - used);
+    c->received -= used;
+
+    return ok;
+}
+
+static void disconnect(worker *w, connection *c)
+{
+    connection **p;
+
+    // The client may have sent its last samples right before closing: they still count.
+    if (c->open && !c->shared)
+        ptPoolRun(c->pool, 0, onBeat, w);
+    if (c->shared && c->open)
+    {
+        drain(w, c);
+        for (p = &w->shared; *p; p = &(*p)->nextShared)
+            if (*p == c)
+            {
+                *p = c->nextShared;
+                break;
+            }
+    }
+    if (c->open)
+    {
+        ptPoolClose(c->pool, c->slot);
+        release(c);
+    }
+    if (c->shared)
+        ptShmClose(&c->shm);
+    if (c->peerSegment >= 0)
+        close(c->peerSegment);
+    if (c->peerWake >= 0)
+        close(c->peerWake);
+    epoll_ctl(w->epoll, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->input);
+    free(c->output);
+    free(c);
+    __atomic_fetch_sub(&w->connections, 1, __ATOMIC_RELAXED);
+}
+
+static void *run(void *context)
+{
+    worker *w = context;
+    struct epoll_event events[256];
+    connection *c;
+    ratePool *p;
+    int n, k, timeout;
+
+    while (!stopping)
+    {
+        // Shared memory rings are read on every wake up. Unless they are read on a fixed period, the
+        // worker only sleeps once every ring is marked as waiting, so that a client writing to one
+        // rings the doorbell.
+        timeout = batch > 0 ? batch : -1;
+        for (c = w->shared; c && timeout < 0; c = c->nextShared)
+            if (!ptShmDetectorSleep(&c->shm))
+                timeout = 0;
+        if ((n = epoll_wait(w->epoll, events, 256, timeout)) < 0)
+            n = 0;
+        for (k = 0; k < n; k++)
+        {
+            bool ok = true;
+
+            c = events[k].data.ptr;
+            if (c == (connection *)w)
+            {
+                eventfd_t ignored;
+                eventfd_read(w->doorbell, &ignored);
+                continue;
+            }
+            if (!c)
+                continue;       // The stop eventfd.
+            if (events[k].events & EPOLLIN)
+            {
+                ssize_t got = receive(c);
+
+                if (got > 0)
+                {
+                    c->received += got;
+                    ok = parse(w, c);
+                }
+                else if (got == 0 || (errno != EAGAIN && errno != EINTR))
+                    ok = false;
+            }
+            else if (events[k].events & (EPOLLERR | EPOLLHUP))
+                ok = false;
+            if (c->pending)
+                flush(w, c);
+            if (!ok)
+                disconnect(w, c);
+        }
+
+        // The samples that came on the sockets were only queued: run them all in one sweep per pool.
+        for (p = w->pools; p; p = p->next)
+            ptPoolRun(&p->detectors, 0, onBeat, w);
+        for (c = w->shared; c; c = c->nextShared)
+            drain(w, c);
+    }
+
+    return NULL;
+}
+
+static double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+static double cpu()
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)*1e-6;
+}
+
+/*
+    Adds up the counters of every worker.
+*/
+static void totals(worker workers[], int count, long unsigned int total[5])
+{
+    int k;
+
+    memset(total, 0, 5*sizeof(long unsigned int));
+    for (k = 0; k < count; k++)
+    {
+        total[0] += READ(workers[k].connections);
+        total[1] += READ(workers[k].samples);
+        total[2] += READ(workers[k].beats);
+        total[3] += READ(workers[k].dropped);
+        total[4] += READ(workers[k].errors);
+    }
+}
+
+static void usage(const char program[])
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -S path       socket (" PT_SOCKET ")\n"
+            "  -j threads    worker threads (number of CPUs)\n"
+            "  -s seconds    prints statistics every so often (0: only at the end)\n"
+            "  -B ms         reads the shared memory rings on this period instead of being woken up\n",
+            program);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *socketPath = PT_SOCKET;
+    struct sockaddr_un address;
+    struct sigaction action;
+    struct epoll_event e;
+    struct rlimit files;
+    long unsigned int total[5], last[5] = {0};
+    worker *workers;
+    double interval = 0, start, lastTime, lastCpu = 0;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN), listener, opt, k, next = 0;
+
+    while ((opt = getopt(argc, argv, "S:j:s:B:h")) != -1)
+    {
+        if (opt == 'S')
+            socketPath = optarg;
+        else if (opt == 'j')
+            threads = atoi(optarg);
+        else if (opt == 's')
+            interval = atof(optarg);
+        else if (opt == 'B')
+            batch = atoi(optarg);
+        else
+            usage(argv[0]);
+    }
+    if (threads < 1 || strlen(socketPath) >= sizeof(address.sun_path))
+        usage(argv[0]);
+
+    // Every stream is a file descriptor: allow as many as the hard limit does.
+    getrlimit(RLIMIT_NOFILE, &files);
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+    unlink(socketPath);
+    if ((listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address))
+        || listen(listener, 1024))
+    {
+        fprintf(stderr, "can't listen on %s: %s\n", socketPath, strerror(errno));
+        return 1;
+    }
+
+    wake = eventfd(0, EFD_CLOEXEC);
+    workers = calloc(threads, sizeof(worker));
+    for (k = 0; k < threads; k++)
+    {
+        workers[k].epoll = epoll_create1(EPOLL_CLOEXEC);
+        workers[k].doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        e.events = EPOLLIN;
+        e.data.ptr = NULL;
+        epoll_ctl(workers[k].epoll, EPOLL_CTL_ADD, wake, &e);
+        e.data.ptr = &workers[k];
+        epoll_ctl(workers[k].epoll, EPOLL_CTL_ADD, workers[k].doorbell, &e);
+        pthread_create(&workers[k].thread, NULL, run, &workers[k]);
+    }
+    fprintf(stderr, "listening on %s with %d workers\n", socketPath, threads);
+
+    // New connections go to the workers in turn.
+    start = lastTime = now();
+    while (!stopping)
+    {
+        struct pollfd p = {listener, POLLIN, 0};
+        int ready = poll(&p, 1, interval > 0 ? (int)(interval*1000) : -1);
+        double t = now();
+
+        if (ready > 0)
+        {
+            int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            connection *c;
+
+            if (fd < 0)
+                continue;
+            if (!(c = calloc(1, sizeof(connection))) || !(c->input = malloc(PT_INPUT)) || !(c->output = malloc(PT_OUTPUT)))
+            {
+                unsigned char message[PT_ERROR_SIZE] = {PT_MSG_ERROR, PT_ERROR_FULL};
+                ssize_t ignored = send(fd, message, sizeof(message), MSG_NOSIGNAL);
+                (void)ignored;
+                if (c)
+                {
+                    free(c->input);
+                    free(c);
+                }
+                close(fd);
+                continue;
+            }
+            c->fd = fd;
+            c->peerSegment = c->peerWake = -1;
+            __atomic_fetch_add(&workers[next].connections, 1, __ATOMIC_RELAXED);
+            e.events = EPOLLIN;
+            e.data.ptr = c;
+            epoll_ctl(workers[next].epoll, EPOLL_CTL_ADD, fd, &e);
+            next = (next + 1) % threads;
+        }
+        if (interval > 0 && t - lastTime >= interval)
+        {
+            double c = cpu();
+
+            totals(workers, threads, total);
+            fprintf(stderr, "%lu streams, %.3f Msamples/s, %.1f beats/s, %lu events dropped, %lu errors, CPU %.0f%%\n",
+                    total[0], (total[1] - last[1])/((t - lastTime)*1e6), (total[2] - last[2])/(t - lastTime), total[3],
+                    total[4], 100*(c - lastCpu)/(t - lastTime));
+            memcpy(last, total, sizeof(last));
+            lastTime = t;
+            lastCpu = c;
+        }
+    }
+
+    // Wake every worker up so it sees stopping.
+    eventfd_write(wake, 1);
+    for (k = 0; k < threads; k++)
+        pthread_join(workers[k].thread, NULL);
+    totals(workers, threads, total);
+    fprintf(stderr, "%lu samples, %lu beats, %lu events dropped, %lu errors in %.1f s, %.1f s of CPU\n", total[1],
+            total[2], total[3], total[4], now() - start, cpu());
+    close(listener);
+    unlink(socketPath);
+
+    return 0;
+}
@@ -0,0 +1,321 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsShm.c                                                        *
+ *       Shared memory rings for ptServer                                        *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Shared memory transport between an acquisition process and ptServer on the    *
+ * same machine. The acquisition process creates a shared memory segment per     *
+ * stream, a memfd sealed at its size and passed over the socket, holding two    *
+ * single-producer single-consumer rings: one of samples, which it writes in     *
+ * place and the detector reads in place, and one of beat events going back.     *
+ * Heads and tails are plain counters on cache lines of their own, updated with  *
+ * acquire/release ordering, so blocks and beats are passed without copies nor   *
+ * locks. A side that runs out of work marks itself as waiting before it sleeps  *
+ * on its eventfd; the other side only signals that eventfd when it finds the    *
+ * mark, so while both are busy there is no system call per block.               *
+ *-------------------------------------------------------------------------------*
+ */
+
+#define _GNU_SOURCE
+
+#include "panTompkinsShm.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Seals a segment must have before the detector maps it. Pages past the end of a file raise SIGBUS
+// when touched, so a client able to shrink the segment could bring the whole server down.
+#define PT_SHM_SEALS (F_SEAL_SHRINK | F_SEAL_GROW)
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+static size_t segmentSize(unsigned int samples, unsigned int beats)
+{
+    return sizeof(ptShmHeader) + samples*sizeof(short) + beats*sizeof(ptShmBeat);
+}
+
+static bool map(ptShm *shm, int fd, size_t size)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (p == MAP_FAILED)
+        return false;
+    shm->header = p;
+    shm->size = size;
+    shm->sampleTail = shm->beatHead = shm->staged = 0;
+    shm->wake = shm->fd = -1;
+
+    return true;
+}
+
+static void setPointers(ptShm *shm, unsigned int samples, unsigned int beats)
+{
+    shm->sampleCapacity = samples;
+    shm->beatCapacity = beats;
+    shm->samples = (short *)(shm->header + 1);
+    shm->beats = (ptShmBeat *)((char *)shm->samples + samples*sizeof(short));
+}
+
+/*
+    Signals the other side if it went to sleep waiting on this ring.
+*/
+static void wakeUp(ptShm *shm, unsigned int *waiting)
+{
+    // The new head must be visible before the flag is read, or a side that is just going to sleep
+    // could miss it: full barrier here, and the same on the sleep functions.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (shm->wake >= 0 && __atomic_load_n(waiting, __ATOMIC_RELAXED) && __atomic_exchange_n(waiting, 0, __ATOMIC_ACQ_REL))
+        eventfd_write(shm->wake, 1);
+}
+
+/*
+    Marks a side as sleeping, unless the ring it waits on already has something. Returns whether it may
+    sleep.
+*/
+static bool idle(unsigned int *waiting, const long unsigned int *head, long unsigned int tail)
+{
+    __atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(head, __ATOMIC_ACQUIRE) != tail)
+    {
+        __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    Creates the segment of a stream, with rings of samples and beats capacities, which must be powers of
+    two. It's an anonymous memfd, sealed at its size; shm->fd is the descriptor to pass to the detector,
+    kept open until ptShmClose().
+*/
+bool ptShmCreate(ptShm *shm, unsigned int stream, int fs, unsigned int samples, unsigned int beats)
+{
+    size_t size = segmentSize(samples, beats);
+    int fd;
+
+    if (!samples || !beats || (samples & (samples - 1)) || (beats & (beats - 1)))
+        return false;
+    if ((fd = memfd_create("ptShm", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+        return false;
+    if (ftruncate(fd, size) || fcntl(fd, F_ADD_SEALS, PT_SHM_SEALS | F_SEAL_SEAL) || !map(shm, fd, size))
+    {
+        close(fd);
+        return false;
+    }
+    shm->fd = fd;
+
+    // ftruncate() gives zeroed pages: heads, tails and flags start at 0.
+    shm->header->stream = stream;
+    shm->header->fs = fs;
+    shm->header->samples = samples;
+    shm->header->beats = beats;
+    shm->header->version = PT_SHM_VERSION;
+    STORE(shm->header->magic, PT_SHM_MAGIC);
+    setPointers(shm, samples, beats);
+
+    return true;
+}
+
+/*
+    Maps a segment created by the acquisition process, passed as the descriptor fd, which is closed
+    either way. It must be sealed so its size can't change (a name, or an unsealed file, could be cut
+    short by the client while mapped here) and its header must be consistent with that size. Only the
+    values read here are trusted afterwards: the capacities, and the counters the detector keeps from
+    now on.
+*/
+bool ptShmAttach(ptShm *shm, int fd)
+{
+    struct stat st;
+    const ptShmHeader *h;
+    unsigned int samples, beats;
+    int seals = fcntl(fd, F_GET_SEALS);
+    bool mapped;
+
+    mapped = seals >= 0 && (seals & PT_SHM_SEALS) == PT_SHM_SEALS && !fstat(fd, &st)
+          && (size_t)st.st_size >= sizeof(ptShmHeader) && map(shm, fd, st.st_size);
+    close(fd);
+    if (!mapped)
+        return false;
+
+    // Each value is read once: the client could change it between a check and a use.
+    h = shm->header;
+    samples = __atomic_load_n(&h->samples, __ATOMIC_RELAXED);
+    beats = __atomic_load_n(&h->beats, __ATOMIC_RELAXED);
+    if (LOAD(shm->header->magic) != PT_SHM_MAGIC || h->version != PT_SHM_VERSION || !samples || !beats
+        || (samples & (samples - 1)) || (beats & (beats - 1)) || segmentSize(samples, beats) != shm->size)
+    {
+        munmap(shm->header, shm->size);
+        return false;
+    }
+    setPointers(shm, samples, beats);
+    shm->sampleTail = LOAD(h->sampleTail);
+    shm->beatHead = LOAD(h->beatHead);
+
+    return true;
+}
+
+void ptShmClose(ptShm *shm)
+{
+    if (shm->header)
+        munmap(shm->header, shm->size);
+    if (shm->header && shm->fd >= 0)
+        close(shm->fd);
+    shm->header = NULL;
+}
+
+/*
+    How many samples can be written before the ring is full.
+*/
+unsigned int ptShmSpace(ptShm *shm)
+{
+    return shm->sampleCapacity - (shm->header->sampleHead - LOAD(shm->header->sampleTail));
+}
+
+/*
+    Where the next samples go: count is set to how many fit there without wrapping around (0 if the ring
+    is full). Write them in place, then ptShmCommit().
+*/
+short *ptShmReserve(ptShm *shm, unsigned int *count)
+{
+    ptShmHeader *h = shm->header;
+    long unsigned int head = h->sampleHead, room = shm->sampleCapacity - (head - LOAD(h->sampleTail));
+    unsigned int at = head & (shm->sampleCapacity - 1);
+
+    *count = room < shm->sampleCapacity - at ? room : shm->sampleCapacity - at;
+    return shm->samples + at;
+}
+
+/*
+    Hands count samples written after ptShmReserve() to the detector, waking it up if it was idle.
+*/
+void ptShmCommit(ptShm *shm, unsigned int count)
+{
+    STORE(shm->header->sampleHead, shm->header->sampleHead + count);
+    wakeUp(shm, &shm->header->detectorWaiting);
+}
+
+/*
+    Beats ready to be read, up to the end of the ring. Call ptShmBeatsDone() once they were used.
+*/
+const ptShmBeat *ptShmBeats(ptShm *shm, unsigned int *count)
+{
+    ptShmHeader *h = shm->header;
+    long unsigned int tail = h->beatTail, ready = LOAD(h->beatHead) - tail;
+    unsigned int at = tail & (shm->beatCapacity - 1);
+
+    *count = ready < shm->beatCapacity - at ? ready : shm->beatCapacity - at;
+    return shm->beats + at;
+}
+
+void ptShmBeatsDone(ptShm *shm, unsigned int count)
+{
+    STORE(shm->header->beatTail, shm->header->beatTail + count);
+}
+
+/*
+    Tells the detector the acquisition process will sleep on its eventfd until a beat comes. Returns
+    false if there are beats to read already.
+*/
+bool ptShmClientSleep(ptShm *shm)
+{
+    return idle(&shm->header->clientWaiting, &shm->header->beatHead, shm->header->beatTail);
+}
+
+/*
+    Samples ready to be read, up to the end of the ring. Call ptShmSamplesDone() once they were used.
+*/
+const short *ptShmSamples(ptShm *shm, unsigned int *count)
+{
+    long unsigned int tail = shm->sampleTail, ready = LOAD(shm->header->sampleHead) - tail;
+    unsigned int at = tail & (shm->sampleCapacity - 1);
+
+    // A misbehaving writer could claim more than the ring holds.
+    if (ready > shm->sampleCapacity)
+        ready = shm->sampleCapacity;
+    *count = ready < shm->sampleCapacity - at ? ready : shm->sampleCapacity - at;
+    return shm->samples + at;
+}
+
+void ptShmSamplesDone(ptShm *shm, unsigned int count)
+{
+    shm->sampleTail += count;
+    STORE(shm->header->sampleTail, shm->sampleTail);
+}
+
+/*
+    Writes a beat on the event ring. It's only seen by the acquisition process after ptShmPublish(). If
+    the ring is full, the beat is dropped and counted.
+*/
+bool ptShmPushBeat(ptShm *shm, long unsigned int position, long unsigned int found)
+{
+    ptShmHeader *h = shm->header;
+    long unsigned int head = shm->beatHead + shm->staged;
+    ptShmBeat *b;
+
+    if (head - LOAD(h->beatTail) >= shm->beatCapacity)
+    {
+        __atomic_store_n(&h->dropped, h->dropped + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    b = &shm->beats[head & (shm->beatCapacity - 1)];
+    b->position = position;
+    b->found = found;
+    shm->staged++;
+
+    return true;
+}
+
+/*
+    Makes the beats written since the last call visible, waking the acquisition process up if it was
+    waiting for them.
+*/
+void ptShmPublish(ptShm *shm)
+{
+    if (!shm->staged)
+        return;
+    shm->beatHead += shm->staged;
+    STORE(shm->header->beatHead, shm->beatHead);
+    shm->staged = 0;
+    wakeUp(shm, &shm->header->clientWaiting);
+}
+
+/*
+    Tells the acquisition process the detector will sleep until more samples come. Returns false if
+    there are samples to read already.
+*/
+bool ptShmDetectorSleep(ptShm *shm)
+{
+    return idle(&shm->header->detectorWaiting, &shm->header->sampleHead, shm->sampleTail);
+}
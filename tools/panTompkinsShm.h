@@ -0,0 +1,120 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsShm.h                                                        *
+ *       Header for panTompkinsShm.c                                             *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ */
+
+#ifndef PAN_TOMPKINS_SHM
+#define PAN_TOMPKINS_SHM
+
+#include "panTompkins.h"
+#include <stddef.h>
+
+#define PT_SHM_MAGIC 0x4D485350u    // "PSHM"
+#define PT_SHM_VERSION 1
+
+// Keeps the fields written by each side on cache lines of their own.
+#define PT_SHM_LINE 64
+
+/*
+    A beat on the event ring: where the R peak is and the newest sample read when it was found.
+*/
+typedef struct
+{
+    long unsigned int position, found;
+} ptShmBeat;
+
+/*
+    Start of a shared segment. It's followed by the sample ring and the beat ring, both with a power of
+    two capacity. Each ring has a single writer and a single reader: the acquisition process writes the
+    samples and reads the beats, the detector does the opposite. Heads and tails only grow; the ring
+    position is the counter modulo the capacity.
+*/
+typedef struct
+{
+    unsigned int magic, version, stream, fs, samples, beats;
+    char padding0[PT_SHM_LINE - 6*sizeof(unsigned int)];
+
+    long unsigned int sampleHead;   // Written by the acquisition process.
+    char padding1[PT_SHM_LINE - sizeof(long unsigned int)];
+    long unsigned int sampleTail;   // Written by the detector.
+    long unsigned int dropped;      // Beats the detector couldn't put on a full event ring.
+    char padding2[PT_SHM_LINE - 2*sizeof(long unsigned int)];
+    long unsigned int beatHead;     // Written by the detector.
+    char padding3[PT_SHM_LINE - sizeof(long unsigned int)];
+    long unsigned int beatTail;     // Written by the acquisition process.
+    char padding4[PT_SHM_LINE - sizeof(long unsigned int)];
+
+    // Set by a side before it goes to sleep. The other one clears it and signals the eventfd of the
+    // sleeping side, so there's a system call only for the first block after a side went idle.
+    unsigned int detectorWaiting;
+    char padding5[PT_SHM_LINE - sizeof(unsigned int)];
+    unsigned int clientWaiting;
+    char padding6[PT_SHM_LINE - sizeof(unsigned int)];
+} ptShmHeader;
+
+/*
+    A mapped segment, as seen by one of the sides. The other side can write anything on the header at
+    any time, so the capacities are copied here once they're checked, and the detector keeps its own
+    counters here too: the only values it reads back from the segment are the sample head and beat
+    tail, always masked with the private capacities.
+*/
+typedef struct
+{
+    ptShmHeader *header;
+    short *samples;
+    ptShmBeat *beats;
+    size_t size;
+    unsigned int sampleCapacity, beatCapacity;
+    long unsigned int sampleTail;   // Samples read (detector side).
+    long unsigned int beatHead;     // Beats published (detector side).
+    long unsigned int staged;       // Beats written but not published yet (detector side).
+    int wake;                       // eventfd of the other side, or -1 if it polls.
+    int fd;                         // The segment's memfd, to pass to the detector (acquisition side), or -1.
+} ptShm;
+
+bool ptShmCreate(ptShm *shm, unsigned int stream, int fs, unsigned int samples, unsigned int beats);
+bool ptShmAttach(ptShm *shm, int fd);
+void ptShmClose(ptShm *shm);
+
+// Acquisition side.
+unsigned int ptShmSpace(ptShm *shm);
+short *ptShmReserve(ptShm *shm, unsigned int *count);
+void ptShmCommit(ptShm *shm, unsigned int count);
+const ptShmBeat *ptShmBeats(ptShm *shm, unsigned int *count);
+void ptShmBeatsDone(ptShm *shm, unsigned int count);
+bool ptShmClientSleep(ptShm *shm);
+
+// Detector side.
+const short *ptShmSamples(ptShm *shm, unsigned int *count);
+void ptShmSamplesDone(ptShm *shm, unsigned int count);
+bool ptShmPushBeat(ptShm *shm, long unsigned int position, long unsigned int found);
+void ptShmPublish(ptShm *shm);
+bool ptShmDetectorSleep(ptShm *shm);
+
+#endif
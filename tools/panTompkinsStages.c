@@ -0,0 +1,502 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsStages.c                                                     *
+ *       Per-stage microbenchmarks of the filter chain and the decision logic    *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * Microbenchmarks for each stage of the detector, to find out where the time    *
+ * goes. Every stage runs on its own over a whole record                         *
+ * (examples/test_input.txt by default), reading the real output of the stage    *
+ * before it:                                                                    *
+ * - filters: DC block, low pass, high pass, derivative, squaring and the        *
+ *   integrator, both as on panTompkins() (the whole window added up on every    *
+ *   sample) and with a running sum.                                             *
+ * - decision logic: slope search, threshold update and back search, replayed    *
+ *   from the state of a real run so the back search scans as far as it does on  *
+ *   panTompkins(). The whole ptDecisionStep() is timed too.                     *
+ * - buffers: the filter chain on shifted buffers, as on panTompkins(), against  *
+ *   the same chain on rings (ptFilterStep()).                                   *
+ *                                                                               *
+ * The cost is given per sample, in time stamp counter ticks on x86 (close to    *
+ * core cycles when the CPU isn't changing its clock), and in nanoseconds. On    *
+ * Linux, hardware counters (core cycles, instructions, branch misses, L1 data   *
+ * and last level cache misses, see panTompkinsPerf) are given per sample too.   *
+ *                                                                               *
+ * Build from the repository root:                                               *
+ * gcc -O2 -I. -Itools tools/panTompkinsStages.c tools/panTompkinsRecord.c \     *
+ *     tools/panTompkinsSynth.c tools/panTompkinsPerf.c panTompkinsCore.c \      *
+ *     -lm -o ptStages                                                           *
+ *-------------------------------------------------------------------------------*
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "panTompkinsRecord.h"
+#include "panTompkinsCore.h"
+#include "panTompkinsDispatch.h"
+#include "panTompkinsPerf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if PT_X86
+#include <x86intrin.h>
+#endif
+
+/*
+    Everything a stage needs, precomputed over the whole record: the output of every filter and, for
+    the decision stages, the state of the decision logic right before each sample.
+*/
+typedef struct
+{
+    long unsigned int n;
+    ptConfig config;
+    dataType *signal, *dcblock, *lowpass, *highpass, *derivative, *squared, *integral;
+    dataType *threshold_i2, *threshold_f2;      // Second thresholds before each sample.
+    long unsigned int *lastQRS;                 // lastQRS before each sample.
+    dataType *out;                              // Scratch output, so the work can't be optimized away.
+} stageData;
+
+typedef struct
+{
+    const char *name;
+    void (*run)(const stageData *d);
+} stage;
+
+// A sink the compiler has to keep writing to.
+static volatile long unsigned int sink;
+
+static long unsigned int ticks()
+{
+#if PT_X86
+    return __rdtsc();
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long unsigned int)t.tv_sec*1000000000ul + t.tv_nsec;
+#endif
+}
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+/*
+    The filter stages, one at a time, as on panTompkins(): each one reads the output of the previous
+    stage and writes its own.
+*/
+static void dcBlock(const stageData *d)
+{
+    long unsigned int n;
+    d->out[0] = 0;
+    for (n = 1; n < d->n; n++)
+        d->out[n] = d->signal[n] - d->signal[n-1] + 0.995*d->out[n-1];
+}
+
+static void lowPass(const stageData *d)
+{
+    long unsigned int n;
+    for (n = 12; n < d->n; n++)
+        d->out[n] = 2*d->out[n-1] - d->out[n-2] + d->dcblock[n] - 2*d->dcblock[n-6] + d->dcblock[n-12];
+}
+
+static void highPass(const stageData *d)
+{
+    long unsigned int n;
+    for (n = 32; n < d->n; n++)
+        d->out[n] = 32*d->lowpass[n-16] - d->out[n-1] - d->lowpass[n] + d->lowpass[n-32];
+}
+
+static void derivative(const stageData *d)
+{
+    long unsigned int n;
+    for (n = 1; n < d->n; n++)
+        d->out[n] = d->highpass[n] - d->highpass[n-1];
+}
+
+static void squaring(const stageData *d)
+{
+    long unsigned int n;
+    for (n = 0; n < d->n; n++)
+        d->out[n] = d->derivative[n]*d->derivative[n];
+}
+
+// The integrator as on panTompkins(): the whole window is added up again on every sample.
+static void integratorWindow(const stageData *d)
+{
+    long unsigned int n, i, w = d->config.windowSize;
+    for (n = w; n < d->n; n++)
+    {
+        dataType sum = 0;
+        for (i = 0; i < w; i++)
+            sum += d->squared[n - i];
+        d->out[n] = sum/(dataType)w;
+    }
+}
+
+// The same integrator with a running sum: one addition and one subtraction per sample.
+static void integratorRunning(const stageData *d)
+{
+    long unsigned int n, w = d->config.windowSize;
+    unsigned int sum = 0;
+    for (n = 0; n < w; n++)
+        sum += d->squared[n];
+    for (n = w; n < d->n; n++)
+    {
+        sum += d->squared[n] - d->squared[n - w];
+        d->out[n] = (dataType)sum/(dataType)w;
+    }
+}
+
+/*
+    The decision stages. They run on every sample here, to give a cost per call; on panTompkins() the
+    slope search only runs on peak candidates and the threshold update on peaks, while the back search
+    runs on nearly every sample once the refractory period is over.
+*/
+
+// Largest squared slope over the last 10 samples.
+static void slopeSearch(const stageData *d)
+{
+    long unsigned int n, j, slope;
+    for (n = 10; n < d->n; n++)
+    {
+        slope = 0;
+        for (j = n - 10; j <= n; j++)
+            if ((long unsigned int)d->squared[j] > slope)
+                slope = d->squared[j];
+        d->out[n] = slope;
+    }
+}
+
+// A noise peak update of npk and both thresholds, for the integral and the filtered signal.
+static void thresholdUpdate(const stageData *d)
+{
+    dataType npk_i = 0, npk_f = 0, threshold_i1, threshold_f1;
+    dataType spk_i = d->integral[d->n/2], spk_f = d->highpass[d->n/2];
+    long unsigned int n;
+    for (n = 0; n < d->n; n++)
+    {
+        npk_i = 0.125*d->integral[n] + 0.875*npk_i;
+        threshold_i1 = npk_i + 0.25*(spk_i - npk_i);
+        npk_f = 0.125*d->highpass[n] + 0.875*npk_f;
+        threshold_f1 = npk_f + 0.25*(spk_f - npk_f);
+        d->out[n] = 0.5*threshold_i1 + 0.5*threshold_f1;
+    }
+}
+
+/*
+    The back search scan of panTompkins(): from the end of the refractory period after the last QRS up
+    to the newest sample, looking for one above both second thresholds. The state comes from a real run,
+    so the scan is as long as it is on panTompkins().
+*/
+static void backSearch(const stageData *d)
+{
+    long unsigned int n, i, start, found = 0;
+    long unsigned int refractory = d->config.refractory, buffer = d->config.bufferSize;
+    for (n = 0; n < d->n; n++)
+    {
+        long unsigned int sample = n + 1, last = d->lastQRS[n];
+        if (sample <= last + refractory)
+            continue;
+        // The buffer only holds the last bufferSize samples.
+        start = last - 1 + refractory;
+        if (sample - last - refractory > (n < buffer ? n : buffer - 1))
+            continue;
+        for (i = start; i < n; i++)
+            if (d->integral[i] > d->threshold_i2[n] && d->highpass[i] > d->threshold_f2[n])
+            {
+                found += i;
+                break;
+            }
+    }
+    sink = found;
+}
+
+/*
+    The whole filter chain on shifted buffers, as on panTompkins(): once the buffers are full, all eight
+    of them move one position on every sample.
+*/
+static void chainShift(const stageData *d)
+{
+    static dataType signal[PT_HISTORY], dcblock[PT_HISTORY], lowpass[PT_HISTORY], highpass[PT_HISTORY];
+    static dataType derivative[PT_HISTORY], squared[PT_HISTORY], integral[PT_HISTORY], output[PT_HISTORY];
+    long unsigned int n, i, buffer = d->config.bufferSize, w = d->config.windowSize;
+    long unsigned int current = 0;
+
+    for (n = 0; n < d->n; n++)
+    {
+        if (n >= buffer)
+        {
+            for (i = 0; i < buffer - 1; i++)
+            {
+                signal[i] = signal[i+1];
+                dcblock[i] = dcblock[i+1];
+                lowpass[i] = lowpass[i+1];
+                highpass[i] = highpass[i+1];
+                derivative[i] = derivative[i+1];
+                squared[i] = squared[i+1];
+                integral[i] = integral[i+1];
+                output[i] = output[i+1];
+            }
+            current = buffer - 1;
+        }
+        else
+            current = n;
+        signal[current] = d->signal[n];
+        if (current < 32)
+        {
+            // Only the first samples of the record get here, where the taps would read before the
+            // first sample. They don't matter for timing.
+            dcblock[current] = lowpass[current] = highpass[current] = derivative[current] = 0;
+            squared[current] = integral[current] = output[current] = 0;
+            continue;
+        }
+        dcblock[current] = signal[current] - signal[current-1] + 0.995*dcblock[current-1];
+        lowpass[current] = 2*lowpass[current-1] - lowpass[current-2] + dcblock[current] - 2*dcblock[current-6] + dcblock[current-12];
+        highpass[current] = 32*lowpass[current-16] - highpass[current-1] - lowpass[current] + lowpass[current-32];
+        derivative[current] = highpass[current] - highpass[current-1];
+        squared[current] = derivative[current]*derivative[current];
+        integral[current] = 0;
+        for (i = 0; i < w; i++)
+            integral[current] += squared[current - i];
+        integral[current] /= (dataType)w;
+        output[current] = 0;
+    }
+    sink = integral[current];
+}
+
+// The same filter chain on rings, as on ptFilterStep(): nothing moves, the newest sample just goes on
+// the next position.
+static void chainRing(const stageData *d)
+{
+    static ptFilter filter;
+    long unsigned int n;
+
+    ptFilterInit(&filter, &d->config);
+    for (n = 0; n < d->n; n++)
+        ptFilterStep(&filter, d->signal[n]);
+    sink = filter.integral[(d->n - 1) & PT_MASK];
+}
+
+// The whole decision logic, ptDecisionStep(), for reference.
+static void decision(const stageData *d)
+{
+    ptDecision decision;
+    ptHistory history;
+    long unsigned int n, beat, beats = 0;
+
+    history.highpass = d->highpass;
+    history.squared = d->squared;
+    history.integral = d->integral;
+    history.mask = ~0ul;
+    history.stride = 1;
+    ptDecisionInit(&decision);
+    for (n = 0; n < d->n; n++)
+        beats += ptDecisionStep(&decision, &d->config, &history, &beat);
+    sink = beats;
+}
+
+static const stage stages[] =
+{
+    {"dc_block", dcBlock},
+    {"low_pass", lowPass},
+    {"high_pass", highPass},
+    {"derivative", derivative},
+    {"squaring", squaring},
+    {"integrator_window", integratorWindow},
+    {"integrator_running_sum", integratorRunning},
+    {"slope_search", slopeSearch},
+    {"threshold_update", thresholdUpdate},
+    {"back_search", backSearch},
+    {"filter_chain_shift", chainShift},
+    {"filter_chain_ring", chainRing},
+    {"decision", decision},
+};
+
+#define STAGES (sizeof(stages)/sizeof(stages[0]))
+
+/*
+    Runs the filters and the decision logic once over the record, keeping the output of every stage
+    and the decision state before each sample.
+*/
+static bool prepare(stageData *d, const ptRecord *record)
+{
+    static ptFilter filter;
+    ptDecision decision;
+    ptHistory history;
+    long unsigned int n, beat;
+    size_t size = record->n*sizeof(dataType);
+    dataType **arrays[] = {&d->signal, &d->dcblock, &d->lowpass, &d->highpass, &d->derivative, &d->squared,
+                           &d->integral, &d->threshold_i2, &d->threshold_f2, &d->out};
+    unsigned int k;
+
+    d->n = record->n;
+    ptDefaultConfig(&d->config, record->fs);
+    for (k = 0; k < sizeof(arrays)/sizeof(arrays[0]); k++)
+        if (!(*arrays[k] = malloc(size)))
+            return false;
+    if (!(d->lastQRS = malloc(record->n*sizeof(long unsigned int))))
+        return false;
+    memcpy(d->signal, record->x, size);
+
+    ptFilterInit(&filter, &d->config);
+    ptFilterHistory(&filter, &history);
+    ptDecisionInit(&decision);
+    for (n = 0; n < d->n; n++)
+    {
+        int c = n & PT_MASK;
+
+        d->threshold_i2[n] = decision.threshold_i2;
+        d->threshold_f2[n] = decision.threshold_f2;
+        d->lastQRS[n] = decision.lastQRS;
+        ptFilterStep(&filter, d->signal[n]);
+        ptDecisionStep(&decision, &d->config, &history, &beat);
+        d->dcblock[n] = filter.dcblock[n & (PT_LINE_DCBLOCK - 1)];
+        d->lowpass[n] = filter.lowpass[n & (PT_LINE_LOWPASS - 1)];
+        d->highpass[n] = filter.highpass[c];
+        d->derivative[n] = filter.derivative[n & (PT_LINE_DERIVATIVE - 1)];
+        d->squared[n] = filter.squared[c];
+        d->integral[n] = filter.integral[c];
+    }
+
+    return true;
+}
+
+static void usage(const char program[])
+{
+    fprintf(stderr,
+            "usage: %s [-i record.txt | -y samples[:fs]] [-r repeats] [-j]\n"
+            "  -i  text record at 360 Hz, one sample per line (examples/test_input.txt)\n"
+            "  -y  synthetic record of the given length and sampling frequency instead\n"
+            "  -r  how many times each stage runs; the best one is reported (5)\n"
+            "  -j  JSON output\n",
+            program);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    static stageData data;
+    const char *file = "examples/test_input.txt", *synth = NULL;
+    int repeats = 5, opt, r;
+    bool json = false, ok, counters;
+    ptRecord record;
+    ptPerf perf;
+    unsigned int k;
+
+    while ((opt = getopt(argc, argv, "i:y:r:jh")) != -1)
+    {
+        if (opt == 'i')
+            file = optarg;
+        else if (opt == 'y')
+            synth = optarg;
+        else if (opt == 'r' && atoi(optarg) > 0)
+            repeats = atoi(optarg);
+        else if (opt == 'j')
+            json = true;
+        else
+            usage(argv[0]);
+    }
+    if (synth)
+    {
+        const char *fs = strchr(synth, ':');
+        ok = ptRecordSynth(&record, strtoul(synth, NULL, 10), fs ? atoi(fs + 1) : 360, 1);
+    }
+    else
+        ok = ptRecordLoad(&record, file, 360);
+    if (!ok || record.n < 64 || !prepare(&data, &record))
+    {
+        fprintf(stderr, "can't read %s, or it is too short\n", synth ? synth : file);
+        return 1;
+    }
+    if (data.config.bufferSize > PT_HISTORY || data.config.windowSize > PT_MAXWINDOW)
+    {
+        fprintf(stderr, "%d Hz needs a larger PT_HISTORY (-DPT_HISTORY=4096)\n", record.fs);
+        return 1;
+    }
+
+    counters = ptPerfOpen(&perf);
+    if (!counters)
+        fprintf(stderr, "hardware counters not available (see /proc/sys/kernel/perf_event_paranoid)\n");
+    if (json)
+        printf("{\n  \"record\": \"%s\", \"samples\": %lu, \"fs\": %d, \"unit\": \"%s\",\n  \"stages\": [",
+               synth ? synth : file, data.n, record.fs, PT_X86 ? "tsc_cycles" : "ns");
+    else
+        printf("%-24s %14s %10s %10s %10s %10s %10s %10s\n", "stage", PT_X86 ? "ticks/sample" : "ns/sample",
+               "ns/sample", "cycles", "instr", "br-miss", "L1D-miss", "LLC-miss");
+    for (k = 0; k < STAGES; k++)
+    {
+        long unsigned int best = ~0ul, t;
+        double seconds = 1e30, s, value[PT_PERF_COUNTERS];
+        int c;
+
+        for (r = 0; r < repeats; r++)
+        {
+            s = now();
+            t = ticks();
+            stages[k].run(&data);
+            t = ticks() - t;
+            s = now() - s;
+            best = t < best ? t : best;
+            seconds = s < seconds ? s : seconds;
+        }
+
+        // One more run for the hardware counters.
+        ptPerfStart(&perf);
+        stages[k].run(&data);
+        ptPerfStop(&perf, value);
+
+        if (json)
+        {
+            printf("%s\n    {\"name\": \"%s\", \"per_sample\": %.3f, \"ns_per_sample\": %.3f, \"counters_per_sample\": ",
+                   k ? "," : "", stages[k].name, (double)best/data.n, seconds*1e9/data.n);
+            ptPerfPrint(value, data.n);
+            printf("}");
+        }
+        else
+        {
+            printf("%-24s %14.3f %10.3f", stages[k].name, (double)best/data.n, seconds*1e9/data.n);
+            for (c = 0; c < PT_PERF_COUNTERS; c++)
+                if (value[c] < 0)
+                    printf(" %10s", "-");
+                else
+                    printf(" %10.3f", value[c]/data.n);
+            printf("\n");
+        }
+    }
+    if (json)
+        printf("\n  ]\n}\n");
+    ptPerfClose(&perf);
+
+    return 0;
+}
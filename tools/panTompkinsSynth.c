@@ -0,0 +1,229 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsSynth.c                                                      *
+ *       Synthetic ECG generator with known R peaks, variable heart rate, ectopic*
+ *       beats and noise                                                         *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ * Description                                                                   *
+ *                                                                               *
+ * A synthetic ECG generator in the style of ECGSYN (McSharry PE, Clifford GD,   *
+ * Tarassenko L, Smith L. A dynamical model for generating synthetic             *
+ * electrocardiogram signals. IEEE Transactions on Biomedical Engineering 50(3): *
+ * 289-294, March 2003), to test the detector on records of any length and       *
+ * sampling frequency with known R peak positions.                               *
+ *                                                                               *
+ * Each beat is a turn of a phase from -pi to pi, with the P, Q, R, S and T      *
+ * waves as gaussians over it; the R peak is at phase 0. The length of each beat *
+ * follows the mean heart rate modulated on the LF (0.1 Hz) and HF (0.25 Hz)     *
+ * bands, plus jitter. Premature ventricular beats (no P wave, wide QRS,         *
+ * inverted T, followed by a compensatory pause) show up with a given            *
+ * probability. Baseline wander, mains hum and muscle (EMG) noise are added on   *
+ * top.                                                                          *
+ *                                                                               *
+ * It's deterministic: the same options and seed give the same record. Samples   *
+ * are generated one at a time, so the length of a record is only limited by the *
+ * disk.                                                                         *
+ *-------------------------------------------------------------------------------*
+ */
+
+#include "panTompkinsSynth.h"
+#include <math.h>
+
+#define PI 3.14159265358979323846
+
+/*
+    The waves of a beat as on ECGSYN (McSharry et al., 2003): gaussians over the phase of the beat, at
+    angle theta (rad), with height a and width b (rad). Integrating ECGSYN's dz/dt over the phase gives
+    a sum of a*b^2*exp(-(phase - theta)^2/(2b^2)), which is what is computed here for a 1 s beat.
+*/
+typedef struct
+{
+    double theta, a, b;
+} wave;
+
+static const wave normal[5] =
+{
+    {-PI/3.0,   1.2,  0.25},    // P
+    {-PI/12.0, -5.0,  0.1},     // Q
+    {0.0,      30.0,  0.1},     // R
+    {PI/12.0,  -7.5,  0.1},     // S
+    {PI/1.8,    0.75, 0.4},     // T
+};
+
+// A premature ventricular beat: no P wave, a wide QRS and an inverted, wide T wave.
+static const wave ventricular[5] =
+{
+    {-PI/3.0,   0.0,  0.25},
+    {-PI/8.0,  -4.0,  0.2},
+    {0.0,      22.0,  0.22},
+    {PI/8.0,  -12.0,  0.2},
+    {PI/1.8,   -1.5,  0.45},
+};
+
+// xorshift32: small, fast and the same on every platform.
+static unsigned int nextRandom(unsigned int *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Uniform in (0, 1].
+static double uniform(unsigned int *state)
+{
+    return ((nextRandom(state) >> 8) + 1.0)/16777216.0;
+}
+
+// Standard normal, Box-Muller.
+static double gaussian(unsigned int *state)
+{
+    double u = uniform(state), v = uniform(state);
+    return sqrt(-2.0*log(u))*cos(2*PI*v);
+}
+
+/*
+    The model value at phase theta. The QRS waves take the same time whatever the heart rate, so their
+    widths and their distance to the R peak shrink, on the phase, as the beat gets longer; P and T
+    stretch a little, as they do. Only the width changes with the rate, not the height of a wave; what
+    the neighbouring waves add to the R peak still does, so newBeat() calibrates each beat.
+*/
+static double model(const wave w[], double theta, double rr)
+{
+    double v = 0, d, b;
+    int k;
+
+    for (k = 0; k < 5; k++)
+    {
+        b = (k == 0 || k == 4) ? w[k].b/sqrt(rr) : w[k].b/rr;
+        d = (k == 0 || k == 4) ? theta - w[k].theta : theta - w[k].theta/rr;
+        d = fmod(d + 3*PI, 2*PI) - PI;
+        // Past 6 widths a gaussian is below 1e-8 of its height.
+        if (d > 6*b || d < -6*b)
+            continue;
+        v += w[k].a*w[k].b*w[k].b*exp(-d*d/(2*b*b));
+    }
+
+    return v;
+}
+
+/*
+    Picks the length of the next beat: the mean RR modulated on the LF (Mayer waves) and HF (breathing)
+    bands, plus a little jitter. An ectopic beat comes early and is followed by a compensatory pause, so
+    the pair lasts two normal beats. The model is scaled so a normal R wave is rAmplitude high at that
+    length.
+*/
+static void newBeat(ptSynth *s)
+{
+    const ptSynthOptions *o = &s->options;
+    double t = (double)s->sample/o->fs, lf, hf, hr, rr;
+
+    lf = sin(2*PI*0.1*t + s->lfPhase);
+    hf = sin(2*PI*0.25*t + s->hfPhase);
+    hr = o->hrMean + o->hrStd*(sqrt(2*o->lfhfRatio/(1 + o->lfhfRatio))*lf + sqrt(2/(1 + o->lfhfRatio))*hf)*0.9
+       + o->hrStd*0.3*gaussian(&s->random);
+    hr = hr < 20 ? 20 : (hr > 300 ? 300 : hr);
+    rr = 60.0/hr;
+
+    if (s->nextRR > 0)
+    {
+        s->rr = s->nextRR;
+        s->nextRR = 0;
+        s->ectopic = false;
+    }
+    else if (uniform(&s->random) <= o->ectopic)
+    {
+        s->rr = 0.65*rr;
+        s->nextRR = 1.35*rr;
+        s->ectopic = true;
+    }
+    else
+    {
+        s->rr = rr;
+        s->ectopic = false;
+    }
+    s->scale = o->rAmplitude/model(normal, 0, s->rr);
+}
+
+void ptSynthDefaults(ptSynthOptions *options)
+{
+    options->fs = 360;
+    options->seed = 1;
+    options->hrMean = 72;
+    options->hrStd = 3;
+    options->lfhfRatio = 0.5;
+    options->ectopic = 0;
+    options->rAmplitude = 1.2;
+    options->wander = 0.1;
+    options->mains = 0;
+    options->mainsFrequency = 60;
+    options->emg = 0.01;
+    options->gain = 200;
+    options->baseline = 1024;
+}
+
+void ptSynthInit(ptSynth *synth, const ptSynthOptions *options)
+{
+    synth->options = *options;
+    synth->sample = 0;
+    synth->random = options->seed ? options->seed : 1;
+    synth->lfPhase = 2*PI*uniform(&synth->random);
+    synth->hfPhase = 2*PI*uniform(&synth->random);
+    synth->wanderPhase = 2*PI*uniform(&synth->random);
+    synth->nextRR = 0;
+    newBeat(synth);
+    // Start halfway between two R peaks.
+    synth->theta = -PI;
+}
+
+/*
+    Returns the next sample. rPeak tells whether it is the first sample at or past a R peak, so known R
+    peak positions can be written along with the record.
+*/
+dataType ptSynthNext(ptSynth *s, bool *rPeak)
+{
+    const ptSynthOptions *o = &s->options;
+    double t = (double)s->sample/o->fs, v, previous = s->theta;
+
+    s->theta += 2*PI/(s->rr*o->fs);
+    if (s->theta >= PI)
+    {
+        s->theta -= 2*PI;
+        previous -= 2*PI;
+        newBeat(s);
+    }
+    *rPeak = (previous < 0 && s->theta >= 0);
+
+    v = s->scale*model(s->ectopic ? ventricular : normal, s->theta, s->rr);
+    v += o->wander*sin(2*PI*0.22*t + s->wanderPhase);
+    v += o->mains*sin(2*PI*o->mainsFrequency*t);
+    if (o->emg > 0)
+        v += o->emg*gaussian(&s->random);
+    s->sample++;
+
+    return (dataType)floor(o->baseline + o->gain*v + 0.5);
+}
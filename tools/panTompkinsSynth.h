@@ -0,0 +1,79 @@
+/**
+ * ------------------------------------------------------------------------------*
+ * File: panTompkinsSynth.h                                                      *
+ *       Header for the synthetic ECG generator                                  *
+ * Author: Rafael de Moura Moreira <rafaelmmoreira@gmail.com>                    *
+ * License: MIT License                                                          *
+ * ------------------------------------------------------------------------------*
+ * MIT License                                                                   *
+ *                                                                               *
+ * Copyright (c) 2018 Rafael de Moura Moreira                                    *
+ *                                                                               *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy  *
+ * of this software and associated documentation files (the "Software"), to deal *
+ * in the Software without restriction, including without limitation the rights  *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell     *
+ * copies of the Software, and to permit persons to whom the Software is         *
+ * furnished to do so, subject to the following conditions:                      *
+ *                                                                               *
+ * The above copyright notice and this permission notice shall be included in all*
+ * copies or substantial portions of the Software.                               *
+ *                                                                               *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR    *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,      *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE   *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER        *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE *
+ * SOFTWARE.                                                                     *
+ *-------------------------------------------------------------------------------*
+ */
+
+#ifndef PAN_TOMPKINS_SYNTH
+#define PAN_TOMPKINS_SYNTH
+
+#include "panTompkins.h"
+
+/*
+    What to generate. ptSynthDefaults() fills in a clean 72 bpm record at 360 Hz with a little noise,
+    scaled like the MIT-BIH records. Amplitudes are in mV, frequencies in Hz.
+*/
+typedef struct
+{
+    int fs;                 // Sampling frequency.
+    unsigned int seed;      // Same seed, same record.
+    double hrMean;          // Mean heart rate, in bpm.
+    double hrStd;           // Standard deviation of the heart rate, in bpm.
+    double lfhfRatio;       // How much of the variability is on the LF band (0.1 Hz) against the HF (0.25 Hz).
+    double ectopic;         // Probability of a beat being a premature ventricular one.
+    double rAmplitude;      // Height of a normal R wave.
+    double wander;          // Baseline wander (breathing), peak amplitude.
+    double mains;           // Mains hum amplitude.
+    double mainsFrequency;  // 50 or 60.
+    double emg;             // Muscle noise (white gaussian) standard deviation.
+    double gain;            // Output units per mV (200 on the MIT-BIH records).
+    int baseline;           // Output value of 0 mV (1024 on the MIT-BIH records).
+} ptSynthOptions;
+
+/*
+    State of the generator. Samples come out one at a time, so records of any length can be written
+    without keeping them in memory.
+*/
+typedef struct
+{
+    ptSynthOptions options;
+    long unsigned int sample;   // Next sample to generate.
+    unsigned int random;        // Random number generator state.
+    double theta;               // Phase on the current beat, from -pi to pi. The R peak is at 0.
+    double rr;                  // Length of the current beat, in seconds.
+    double nextRR;              // Length of the next one, if already decided (compensatory pause).
+    double scale;               // mV per unit of the wave model, for the current beat.
+    double lfPhase, hfPhase, wanderPhase;
+    bool ectopic;               // Whether the current beat is a premature ventricular one.
+} ptSynth;
+
+void ptSynthDefaults(ptSynthOptions *options);
+void ptSynthInit(ptSynth *synth, const ptSynthOptions *options);
+dataType ptSynthNext(ptSynth *synth, bool *rPeak);
+
+#endif